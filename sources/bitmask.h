@@ -0,0 +1,92 @@
+#ifdef _MSC_VER
+#pragma once
+#endif
+
+#ifndef _BITMASK_H_
+#define _BITMASK_H_
+
+#include <cstdint>
+#include <vector>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+inline int popCount64(uint64_t bits) {
+#ifdef _MSC_VER
+    return static_cast<int>(__popcnt64(bits));
+#else
+    return __builtin_popcountll(bits);
+#endif
+}
+
+inline int countTrailingZeros64(uint64_t bits) {
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward64(&index, bits);
+    return static_cast<int>(index);
+#else
+    return __builtin_ctzll(bits);
+#endif
+}
+
+// Word with the bits [begin, end) set, where 0 <= begin <= end <= 64.
+inline uint64_t spanBits(int begin, int end) {
+    const uint64_t upper = end >= 64 ? ~0ULL : (1ULL << end) - 1;
+    const uint64_t lower = (1ULL << begin) - 1;
+    return upper & ~lower;
+}
+
+// Spreads 32 bits so that every bit occupies two adjacent bits, i.e.,
+// bit i of the input is copied to the bits 2i and 2i+1 of the output.
+inline uint64_t duplicateBits32(uint32_t bits) {
+    uint64_t x = bits;
+    x = (x | (x << 16)) & 0x0000FFFF0000FFFFULL;
+    x = (x | (x <<  8)) & 0x00FF00FF00FF00FFULL;
+    x = (x | (x <<  4)) & 0x0F0F0F0F0F0F0F0FULL;
+    x = (x | (x <<  2)) & 0x3333333333333333ULL;
+    x = (x | (x <<  1)) & 0x5555555555555555ULL;
+    return x | (x << 1);
+}
+
+// Binary image which stores one bit per pixel. Every row starts at a 64-bit
+// word boundary, so that rows can be processed independently by threads.
+class BitMask {
+public:
+    BitMask() = default;
+
+    void resize(int width, int height) {
+        width_  = width;
+        height_ = height;
+        words_  = (width + 63) / 64;
+        bits_.assign(static_cast<size_t>(words_) * height, 0);
+    }
+
+    inline int width() const { return width_; }
+    inline int height() const { return height_; }
+    inline int wordsPerRow() const { return words_; }
+
+    inline uint64_t* row(int y) { return &bits_[static_cast<size_t>(y) * words_]; }
+    inline const uint64_t* row(int y) const { return &bits_[static_cast<size_t>(y) * words_]; }
+
+    inline bool test(int x, int y) const {
+        return (row(y)[x >> 6] >> (x & 63)) & 1;
+    }
+
+    inline int countRow(int y) const {
+        int count = 0;
+        const uint64_t* r = row(y);
+        for (int w = 0; w < words_; w++) {
+            count += popCount64(r[w]);
+        }
+        return count;
+    }
+
+private:
+    int width_  = 0;
+    int height_ = 0;
+    int words_  = 0;
+    std::vector<uint64_t> bits_;
+};
+
+#endif  // _BITMASK_H_
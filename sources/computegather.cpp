@@ -0,0 +1,218 @@
+#include "computegather.h"
+
+#include <algorithm>
+#include <iostream>
+#include <vector>
+
+#include <QtGui/qopenglcontext.h>
+#include <QtGui/qopenglextrafunctions.h>
+
+#include "shadersource.h"
+
+// Storage buffer bindings, which must match the gather shaders.
+static constexpr int SAMPLE_BINDING       = 0;
+static constexpr int TILE_COUNT_BINDING   = 1;
+static constexpr int TILE_CURSOR_BINDING  = 2;
+static constexpr int TILE_SAMPLE_BINDING  = 3;
+static constexpr int TILE_OFFSET_BINDING  = 4;
+
+// Work group size of the binning pass.
+static constexpr int BIN_GROUP_SIZE = 256;
+
+// Initial capacity of the list of the tile samples, in tiles overlapped by
+// every sample on average.
+static constexpr int TILES_PER_SAMPLE = 16;
+
+ComputeGather::ComputeGather(const QString& shaderDirectory, int materialBinding) {
+    binShader_    = linkComputeShader(shaderDirectory + "gather_bin.cs");
+    scanShader_   = linkComputeShader(shaderDirectory + "gather_scan.cs");
+    gatherShader_ = linkComputeShader(shaderDirectory + "gather.cs");
+    isValid_ = binShader_ && scanShader_ && gatherShader_;
+    if (!isValid_) {
+        return;
+    }
+
+    auto f = QOpenGLContext::currentContext()->extraFunctions();
+    const GLuint blockIndex = f->glGetUniformBlockIndex(gatherShader_->programId(), "Material");
+    f->glUniformBlockBinding(gatherShader_->programId(), blockIndex, materialBinding);
+
+    GLuint buffers[5];
+    f->glGenBuffers(5, buffers);
+    tileCounts_    = buffers[0];
+    tileCursors_   = buffers[1];
+    tileOffsets_   = buffers[2];
+    tileSamples_   = buffers[3];
+    totalReadback_ = buffers[4];
+
+    f->glBindBuffer(GL_COPY_WRITE_BUFFER, totalReadback_);
+    f->glBufferData(GL_COPY_WRITE_BUFFER, sizeof(GLuint), nullptr, GL_STREAM_READ);
+    f->glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+}
+
+ComputeGather::~ComputeGather() {
+    if (tileCounts_ != 0) {
+        auto f = QOpenGLContext::currentContext()->extraFunctions();
+        GLuint buffers[5] = { tileCounts_, tileCursors_, tileOffsets_, tileSamples_, totalReadback_ };
+        f->glDeleteBuffers(5, buffers);
+        if (totalFence_) {
+            f->glDeleteSync(totalFence_);
+        }
+    }
+}
+
+bool ComputeGather::isSupported() {
+    QOpenGLContext* context = QOpenGLContext::currentContext();
+    return context->format().version() >= qMakePair(4, 3) ||
+           context->hasExtension("GL_ARB_compute_shader");
+}
+
+void ComputeGather::resizeTiles(int numTiles) {
+    if (numTiles == numTiles_) {
+        return;
+    }
+    numTiles_ = numTiles;
+
+    // The scan clears the counts after reading them, so that they are only
+    // zeroed here.
+    auto f = QOpenGLContext::currentContext()->extraFunctions();
+    const std::vector<GLuint> zeros(numTiles + 1, 0);
+    f->glBindBuffer(GL_SHADER_STORAGE_BUFFER, tileCounts_);
+    f->glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(GLuint) * numTiles, zeros.data(), GL_DYNAMIC_DRAW);
+    f->glBindBuffer(GL_SHADER_STORAGE_BUFFER, tileCursors_);
+    f->glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(GLuint) * numTiles, nullptr, GL_DYNAMIC_DRAW);
+    f->glBindBuffer(GL_SHADER_STORAGE_BUFFER, tileOffsets_);
+    f->glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(GLuint) * (numTiles + 1), zeros.data(), GL_DYNAMIC_DRAW);
+    f->glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+void ComputeGather::reserveTileSamples(int size) {
+    if (size <= tileSamplesSize_) {
+        return;
+    }
+
+    // Grow geometrically, so that the buffer settles after a few overflows.
+    tileSamplesSize_ = std::max(size, tileSamplesSize_ * 3 / 2);
+    auto f = QOpenGLContext::currentContext()->extraFunctions();
+    f->glBindBuffer(GL_SHADER_STORAGE_BUFFER, tileSamples_);
+    f->glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(GLuint) * tileSamplesSize_, nullptr, GL_DYNAMIC_DRAW);
+    f->glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+void ComputeGather::gather(const GatherParams& params) {
+    auto f = QOpenGLContext::currentContext()->extraFunctions();
+
+    const int tilesX = (params.width  + tileSize - 1) / tileSize;
+    const int tilesY = (params.height + tileSize - 1) / tileSize;
+    resizeTiles(tilesX * tilesY);
+    reserveTileSamples(std::max(params.numSamples * TILES_PER_SAMPLE, 1));
+
+    f->glBindBufferBase(GL_SHADER_STORAGE_BUFFER, SAMPLE_BINDING, params.sampleBuffer);
+    f->glBindBufferBase(GL_SHADER_STORAGE_BUFFER, TILE_COUNT_BINDING, tileCounts_);
+    f->glBindBufferBase(GL_SHADER_STORAGE_BUFFER, TILE_CURSOR_BINDING, tileCursors_);
+    f->glBindBufferBase(GL_SHADER_STORAGE_BUFFER, TILE_OFFSET_BINDING, tileOffsets_);
+
+    const int binGroups = (params.numSamples + BIN_GROUP_SIZE - 1) / BIN_GROUP_SIZE;
+
+    // Count the samples overlapping every tile. Sizes are set to the "ivec2"
+    // uniforms by "glUniform2i()", since a "QSize" would set floats.
+    binShader_->bind();
+    binShader_->setUniformValue("uMVPMat", params.mvpMat);
+    f->glUniform2i(binShader_->uniformLocation("uScreenSize"), params.width, params.height);
+    f->glUniform2i(binShader_->uniformLocation("uTileCount"), tilesX, tilesY);
+    binShader_->setUniformValue("uNumSamples", params.numSamples);
+    binShader_->setUniformValue("uSampleOrigin", params.bounds.origin);
+    binShader_->setUniformValue("uSampleExtent", params.bounds.extent);
+    binShader_->setUniformValueArray("uSupport", params.supports, params.numSupports, 1);
+    binShader_->setUniformValue("uCapacity", tileSamplesSize_);
+    binShader_->setUniformValue("uPass", 0);
+    if (binGroups > 0) {
+        f->glDispatchCompute(binGroups, 1, 1);
+    }
+    f->glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+    // Offsets of the tiles in the sample list.
+    scanShader_->bind();
+    scanShader_->setUniformValue("uNumTiles", numTiles_);
+    f->glDispatchCompute(1, 1, 1);
+    f->glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
+
+    // The total count after the last tile is copied for "pollTileSamples()",
+    // unless the previous copy has not been read yet.
+    if (!totalFence_) {
+        f->glBindBuffer(GL_COPY_READ_BUFFER, tileOffsets_);
+        f->glBindBuffer(GL_COPY_WRITE_BUFFER, totalReadback_);
+        f->glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, sizeof(GLuint) * numTiles_, 0, sizeof(GLuint));
+        f->glBindBuffer(GL_COPY_READ_BUFFER, 0);
+        f->glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+        totalFence_ = f->glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    }
+    f->glBindBufferBase(GL_SHADER_STORAGE_BUFFER, TILE_SAMPLE_BINDING, tileSamples_);
+
+    // Write the sample indices of every tile.
+    binShader_->bind();
+    binShader_->setUniformValue("uPass", 1);
+    if (binGroups > 0) {
+        f->glDispatchCompute(binGroups, 1, 1);
+    }
+    f->glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+    // Sum the samples of the tiles for every pixel.
+    gatherShader_->bind();
+    f->glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, params.depthMap);
+    f->glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_1D, params.profileMap);
+    gatherShader_->setUniformValue("uDepthMap", 0);
+    gatherShader_->setUniformValue("uInvMVPMat", params.mvpMat.inverted());
+    gatherShader_->setUniformValue("uProfileMap", 1);
+    gatherShader_->setUniformValue("uProfileMaxDist", params.profileMaxDist);
+    gatherShader_->setUniformValue("uDipoleMode", params.dipoleMode);
+    gatherShader_->setUniformValue("uMtrlScale", params.mtrlScale);
+    gatherShader_->setUniformValue("uLightPos", params.lightPos);
+    gatherShader_->setUniformValue("uSampleOrigin", params.bounds.origin);
+    gatherShader_->setUniformValue("uSampleExtent", params.bounds.extent);
+    f->glUniform2i(gatherShader_->uniformLocation("uDepthSize"), params.depthWidth, params.depthHeight);
+    f->glUniform2i(gatherShader_->uniformLocation("uScreenSize"), params.width, params.height);
+    f->glUniform2i(gatherShader_->uniformLocation("uTileCount"), tilesX, tilesY);
+    gatherShader_->setUniformValue("uCapacity", tileSamplesSize_);
+    gatherShader_->setUniformValueArray("uSupport", params.supports, params.numSupports, 1);
+
+    f->glBindImageTexture(0, params.target, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA32F);
+    f->glDispatchCompute(tilesX, tilesY, 1);
+    f->glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT | GL_FRAMEBUFFER_BARRIER_BIT);
+
+    f->glBindImageTexture(0, 0, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA32F);
+    gatherShader_->release();
+}
+
+void ComputeGather::pollTileSamples() {
+    if (!totalFence_) {
+        return;
+    }
+
+    auto f = QOpenGLContext::currentContext()->extraFunctions();
+    const GLenum status = f->glClientWaitSync(totalFence_, 0, 0);
+    if (status == GL_TIMEOUT_EXPIRED) {
+        return;
+    }
+    f->glDeleteSync(totalFence_);
+    totalFence_ = 0;
+    if (status == GL_WAIT_FAILED) {
+        return;
+    }
+
+    // The copy has completed, so that mapping it does not stall.
+    GLuint total = 0;
+    f->glBindBuffer(GL_COPY_READ_BUFFER, totalReadback_);
+    const void* mapped = f->glMapBufferRange(GL_COPY_READ_BUFFER, 0, sizeof(GLuint), GL_MAP_READ_BIT);
+    if (mapped) {
+        total = *static_cast<const GLuint*>(mapped);
+        f->glUnmapBuffer(GL_COPY_READ_BUFFER);
+    }
+    f->glBindBuffer(GL_COPY_READ_BUFFER, 0);
+
+    if (static_cast<int>(total) > tileSamplesSize_) {
+        reserveTileSamples(static_cast<int>(total));
+        capacityVersion_++;
+    }
+}
@@ -0,0 +1,96 @@
+#ifdef _MSC_VER
+#pragma once
+#endif
+
+#ifndef _COMPUTE_GATHER_H_
+#define _COMPUTE_GATHER_H_
+
+#include <memory>
+
+#include <QtGui/qopenglshaderprogram.h>
+#include <QtGui/qmatrix4x4.h>
+#include <QtGui/qvector3d.h>
+
+#include "packedsample.h"
+
+// Inputs of one gather pass. Textures and buffers are given by their names.
+struct GatherParams {
+    QMatrix4x4 mvpMat;
+    QVector3D lightPos;
+
+    GLuint sampleBuffer = 0;
+    int numSamples = 0;
+    SampleBounds bounds;
+
+    // Depth buffer of the G-buffers rendered by "mvpMat", and its size,
+    // which may be smaller than the texture.
+    GLuint depthMap = 0;
+    int depthWidth = 0;
+    int depthHeight = 0;
+    GLuint profileMap = 0;
+    float profileMaxDist = 0.0f;
+    int dipoleMode = 0;
+    float mtrlScale = 1.0f;
+    const float* supports = nullptr;
+    int numSupports = 0;
+
+    // RGBA32F texture, which is overwritten for every pixel.
+    GLuint target = 0;
+    int width = 0;
+    int height = 0;
+};
+
+// Translucency gathered by compute shaders (OpenGL 4.3) instead of splatting.
+// The samples are binned into the screen tiles overlapped by their supports,
+// and every work group then sums the dipole of the samples of its tile for
+// the pixels covered by the mesh. The "Material" block must be bound to the
+// given binding point before "gather()".
+//
+// The list of the sample indices of the tiles has a fixed capacity, beyond
+// which the indices are dropped, so that the CPU never waits for the count.
+// The total count is read back in a later frame instead, and the list grows
+// when it has overflowed.
+class ComputeGather {
+public:
+    ComputeGather(const QString& shaderDirectory, int materialBinding);
+    virtual ~ComputeGather();
+
+    static bool isSupported();
+    inline bool isValid() const { return isValid_; }
+
+    void gather(const GatherParams& params);
+
+    // Reads the total count of the last gather back if the GPU has written
+    // it, without waiting. "capacityVersion()" changes when the list grows,
+    // i.e., the last gather has dropped some samples and should be redone.
+    void pollTileSamples();
+    inline bool isPending() const { return totalFence_ != 0; }
+    inline int capacityVersion() const { return capacityVersion_; }
+
+    static constexpr int tileSize = 16;
+
+private:
+    void resizeTiles(int numTiles);
+    void reserveTileSamples(int size);
+
+    std::unique_ptr<QOpenGLShaderProgram> binShader_ = nullptr;
+    std::unique_ptr<QOpenGLShaderProgram> scanShader_ = nullptr;
+    std::unique_ptr<QOpenGLShaderProgram> gatherShader_ = nullptr;
+    bool isValid_ = false;
+
+    // Per-tile sample counts, write cursors and offsets into "tileSamples_",
+    // which holds the sample indices of every tile.
+    GLuint tileCounts_ = 0;
+    GLuint tileCursors_ = 0;
+    GLuint tileOffsets_ = 0;
+    GLuint tileSamples_ = 0;
+    int numTiles_ = 0;
+    int tileSamplesSize_ = 0;
+
+    // Copy of the total count, which is mapped once its fence is signaled.
+    GLuint totalReadback_ = 0;
+    GLsync totalFence_ = 0;
+    int capacityVersion_ = 0;
+};
+
+#endif  // _COMPUTE_GATHER_H_
@@ -0,0 +1,172 @@
+#include "dipoleprofile.h"
+
+#include <cmath>
+#include <algorithm>
+
+namespace {
+
+static const double Pi = 4.0 * std::atan(1.0);
+
+// Number of the quadrature points on [0, maxDist] for errors. It is a
+// multiple of the table sizes in use, so that no point falls on a texel
+// center, where the table is exact.
+static constexpr int NUM_QUADRATURE = 4096;
+
+template <class Float>
+Float Fdr(Float eta) {
+    if (eta >= 1) {
+        return Float(-1.4399) / (eta * eta) + Float(0.7099) / eta + Float(0.6681) + Float(0.0636) * eta;
+    } else {
+        return Float(-0.4399) + Float(0.7099) / eta - Float(0.3319) / (eta * eta) + Float(0.0636) / (eta * eta * eta);
+    }
+}
+
+template <class Float>
+Float diffRef(Float sigma_a, Float sigmap_s, Float eta, Float dist) {
+    const Float A = (1 + Fdr(eta)) / (1 - Fdr(eta));
+    const Float sigmapt  = sigma_a + sigmap_s;
+    const Float sigma_tr = std::sqrt(3 * sigma_a * sigmapt);
+    const Float alphap   = sigmap_s / sigmapt;
+    const Float zpos     = 1 / sigmapt;
+    const Float zneg     = zpos * (1 + (Float(4) / Float(3)) * A);
+
+    const Float d2 = dist * dist;
+    const Float dpos = std::sqrt(d2 + zpos * zpos);
+    const Float dneg = std::sqrt(d2 + zneg * zneg);
+    const Float posterm = zpos * (dpos * sigma_tr + 1) * std::exp(-sigma_tr * dpos) / (dpos * dpos * dpos);
+    const Float negterm = zneg * (dneg * sigma_tr + 1) * std::exp(-sigma_tr * dneg) / (dneg * dneg * dneg);
+    return std::max(Float(0), (alphap / (4 * Float(Pi))) * (posterm + negterm));
+}
+
+double diffRef(const DipoleMaterial& mtrl, int c, double dist) {
+    return diffRef<double>(mtrl.sigma_a[c], mtrl.sigmap_s[c], mtrl.eta, dist);
+}
+
+float maxReflectance(const DipoleMaterial& mtrl, float dist) {
+    const QVector3D rd = diffuseReflectance(mtrl, dist);
+    return std::max(rd.x(), std::max(rd.y(), rd.z()));
+}
+
+// Midpoint rule for the area measure r dr on [0, maxDist] in the variable u
+// of the table, i.e., r = maxDist * u^2 and dr = 2 * maxDist * u * du.
+void quadrature(double maxDist, int k, double* r, double* weight) {
+    const double u  = (k + 0.5) / NUM_QUADRATURE;
+    const double du = 1.0 / NUM_QUADRATURE;
+    *r = maxDist * u * u;
+    *weight = *r * (2.0 * maxDist * u * du);
+}
+
+}  // anonymous namespace
+
+DipoleCoefficients dipoleCoefficients(const DipoleMaterial& mtrl) {
+    DipoleCoefficients coeffs;
+    coeffs.A = (1.0f + Fdr(mtrl.eta)) / (1.0f - Fdr(mtrl.eta));
+    for (int c = 0; c < 3; c++) {
+        const float sigmapt = mtrl.sigma_a[c] + mtrl.sigmap_s[c];
+        coeffs.sigma_tr[c] = std::sqrt(3.0f * mtrl.sigma_a[c] * sigmapt);
+        coeffs.alphap[c]   = mtrl.sigmap_s[c] / sigmapt;
+        coeffs.zpos[c]     = 1.0f / sigmapt;
+        coeffs.zneg[c]     = coeffs.zpos[c] * (1.0f + (4.0f / 3.0f) * coeffs.A);
+    }
+    return coeffs;
+}
+
+QVector3D diffuseReflectance(const DipoleMaterial& mtrl, float dist) {
+    return QVector3D(diffRef(mtrl, 0, dist), diffRef(mtrl, 1, dist), diffRef(mtrl, 2, dist));
+}
+
+float supportRadius(const DipoleMaterial& mtrl, float weight, float epsilon, float maxDist) {
+    if (maxReflectance(mtrl, maxDist) * weight >= epsilon) {
+        return maxDist;
+    }
+
+    float lo = 0.0f;
+    float hi = maxDist;
+    for (int i = 0; i < 32; i++) {
+        const float mid = 0.5f * (lo + hi);
+        if (maxReflectance(mtrl, mid) * weight < epsilon) {
+            hi = mid;
+        } else {
+            lo = mid;
+        }
+    }
+    return hi;
+}
+
+float splatArea(float radius) {
+    const float r = radius * 0.1f;
+    return static_cast<float>(r * r * Pi * 0.001);
+}
+
+DipoleProfile::DipoleProfile(const DipoleMaterial& mtrl, float maxDist, int tableSize)
+    : mtrl_{ mtrl }
+    , maxDist_{ maxDist }
+    , tableSize_{ tableSize } {
+    table_.resize(static_cast<size_t>(tableSize) * 3);
+    for (int i = 0; i < tableSize; i++) {
+        const double u = (i + 0.5) / tableSize;
+        for (int c = 0; c < 3; c++) {
+            table_[i * 3 + c] = static_cast<float>(diffRef(mtrl, c, maxDist * u * u));
+        }
+    }
+
+    coeffs_ = dipoleCoefficients(mtrl);
+}
+
+QVector3D DipoleProfile::evaluate(DipoleMode mode, float dist) const {
+    QVector3D rd;
+    if (mode == DipoleMode::Table) {
+        // Linear interpolation of the texels with the edges clamped.
+        const float t = std::sqrt(std::min(dist / maxDist_, 1.0f)) * tableSize_ - 0.5f;
+        const int   i = std::max(0, std::min(static_cast<int>(std::floor(t)), tableSize_ - 1));
+        const int   j = std::min(i + 1, tableSize_ - 1);
+        const float s = std::max(0.0f, std::min(t - i, 1.0f));
+        for (int c = 0; c < 3; c++) {
+            rd[c] = table_[i * 3 + c] * (1.0f - s) + table_[j * 3 + c] * s;
+        }
+    } else {
+        // Same as "diffRef()" and "diffRefFast()" of "dipole.fs".
+        const bool isFast = mode == DipoleMode::Fast;
+        const float d2 = dist * dist;
+        for (int c = 0; c < 3; c++) {
+            const float zpos = coeffs_.zpos[c];
+            const float zneg = coeffs_.zneg[c];
+            const float sigma_tr = coeffs_.sigma_tr[c];
+            const float dpos2 = d2 + zpos * zpos;
+            const float dneg2 = d2 + zneg * zneg;
+            float posterm, negterm;
+            if (isFast) {
+                const float invpos = 1.0f / std::sqrt(dpos2);
+                const float invneg = 1.0f / std::sqrt(dneg2);
+                const float dpos = dpos2 * invpos;
+                const float dneg = dneg2 * invneg;
+                posterm = zpos * (dpos * sigma_tr + 1.0f) * std::exp(-sigma_tr * dpos) * (invpos * invpos * invpos);
+                negterm = zneg * (dneg * sigma_tr + 1.0f) * std::exp(-sigma_tr * dneg) * (invneg * invneg * invneg);
+            } else {
+                const float dpos = std::sqrt(dpos2);
+                const float dneg = std::sqrt(dneg2);
+                posterm = zpos * (dpos * sigma_tr + 1.0f) * std::exp(-sigma_tr * dpos) / (dpos * dpos * dpos);
+                negterm = zneg * (dneg * sigma_tr + 1.0f) * std::exp(-sigma_tr * dneg) / (dneg * dneg * dneg);
+            }
+            rd[c] = std::max(0.0f, coeffs_.alphap[c] / (4.0f * static_cast<float>(Pi)) * (posterm + negterm));
+        }
+    }
+    return rd;
+}
+
+double DipoleProfile::error(DipoleMode mode) const {
+    double diff2 = 0.0;
+    double norm2 = 0.0;
+    for (int q = 0; q < NUM_QUADRATURE; q++) {
+        double r, weight;
+        quadrature(maxDist_, q, &r, &weight);
+
+        const QVector3D rd = evaluate(mode, static_cast<float>(r));
+        for (int c = 0; c < 3; c++) {
+            const double ref = diffRef(mtrl_, c, r);
+            diff2 += weight * (rd[c] - ref) * (rd[c] - ref);
+            norm2 += weight * ref * ref;
+        }
+    }
+    return norm2 > 0.0 ? std::sqrt(diff2 / norm2) : 0.0;
+}
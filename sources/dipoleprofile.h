@@ -0,0 +1,78 @@
+#ifdef _MSC_VER
+#pragma once
+#endif
+
+#ifndef _DIPOLE_PROFILE_H_
+#define _DIPOLE_PROFILE_H_
+
+#include <vector>
+
+#include <QtGui/qvector3d.h>
+
+// Scattering coefficients of a material, already scaled by the material scale.
+struct DipoleMaterial {
+    QVector3D sigma_a;
+    QVector3D sigmap_s;
+    float eta;
+};
+
+// Constants of the dipole which only depend on the material.
+struct DipoleCoefficients {
+    QVector3D sigma_tr;
+    QVector3D alphap;
+    QVector3D zpos;
+    QVector3D zneg;
+    float A;
+};
+
+DipoleCoefficients dipoleCoefficients(const DipoleMaterial& mtrl);
+
+// Diffuse reflectance Rd of the dipole model at the distance, which is the
+// same as "diffRef()" in "dipole.fs".
+QVector3D diffuseReflectance(const DipoleMaterial& mtrl, float dist);
+
+// Smallest distance where the largest channel of "Rd * weight" falls below
+// "epsilon". Rd decreases monotonically with the distance, so the distance
+// is found by bisection, and is clamped to "maxDist".
+float supportRadius(const DipoleMaterial& mtrl, float weight, float epsilon, float maxDist);
+
+// Area "dA" weighting a splat of the sample radius in "dipole.fs".
+float splatArea(float radius);
+
+// Evaluation modes of Rd in "dipole.fs".
+enum class DipoleMode : int {
+    Exact = 0,  // Analytic dipole for every fragment.
+    Table,      // Lookup of the tabulated profile.
+    Fast        // Analytic dipole with reciprocal square roots.
+};
+
+// Radial profile Rd(r) of a material over [0, maxDist]. The profile is
+// tabulated at r = maxDist * u^2 for the texel centers u, so that the peak
+// around r = 0 gets more texels than the tail.
+class DipoleProfile {
+public:
+    DipoleProfile(const DipoleMaterial& mtrl, float maxDist, int tableSize);
+
+    // Rd as it is computed by the shader in the given mode.
+    QVector3D evaluate(DipoleMode mode, float dist) const;
+
+    // Relative L2 error of the mode over the disk of radius "maxDist". The
+    // single precision arithmetic of the shader is emulated by "evaluate()",
+    // and compared with the dipole in double precision at the midpoints of
+    // a uniform grid of the table variable.
+    double error(DipoleMode mode) const;
+
+    inline float maxDist() const { return maxDist_; }
+    inline int tableSize() const { return tableSize_; }
+    inline const float* table() const { return table_.data(); }
+
+
+private:
+    DipoleMaterial mtrl_;
+    float maxDist_;
+    int tableSize_;
+    std::vector<float> table_;
+    DipoleCoefficients coeffs_;
+};
+
+#endif  // _DIPOLE_PROFILE_H_
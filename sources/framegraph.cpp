@@ -0,0 +1,547 @@
+#include "framegraph.h"
+
+#include <algorithm>
+#include <iostream>
+
+#include <QtGui/qopenglcontext.h>
+#include <QtGui/qopenglextrafunctions.h>
+
+// Sizes of the textures of the pool are rounded up to multiples of this.
+static constexpr int TARGET_SIZE_BUCKET = 128;
+
+namespace {
+
+bool isStencilFormat(GLenum format) {
+    return format == GL_DEPTH24_STENCIL8 || format == GL_DEPTH32F_STENCIL8;
+}
+
+bool isDepthFormat(GLenum format) {
+    return isStencilFormat(format) ||
+           format == GL_DEPTH_COMPONENT16 || format == GL_DEPTH_COMPONENT24 ||
+           format == GL_DEPTH_COMPONENT32 || format == GL_DEPTH_COMPONENT32F;
+}
+
+bool isIntegerFormat(GLenum format) {
+    return format == GL_R32UI || format == GL_RG32UI || format == GL_RGBA32UI ||
+           format == GL_R32I  || format == GL_RG32I  || format == GL_RGBA32I;
+}
+
+size_t bytesPerPixel(GLenum format) {
+    switch (format) {
+    case GL_RGBA32F:
+    case GL_RGBA32UI:
+    case GL_RGBA32I:
+        return 16;
+    case GL_RGBA16F:
+    case GL_RG32F:
+    case GL_RG32UI:
+    case GL_RG32I:
+    case GL_DEPTH32F_STENCIL8:
+        return 8;
+    default:
+        return 4;
+    }
+}
+
+size_t targetBytes(const TargetDesc& desc) {
+    return bytesPerPixel(desc.format) * desc.width * desc.height;
+}
+
+TargetDesc bucketDesc(const TargetDesc& desc) {
+    TargetDesc bucket = desc;
+    bucket.width  = (desc.width  + TARGET_SIZE_BUCKET - 1) / TARGET_SIZE_BUCKET * TARGET_SIZE_BUCKET;
+    bucket.height = (desc.height + TARGET_SIZE_BUCKET - 1) / TARGET_SIZE_BUCKET * TARGET_SIZE_BUCKET;
+    return bucket;
+}
+
+// Targets are read by "texelFetch()" or at the texel centers, so that
+// they are not filtered.
+GLuint createTexture(const TargetDesc& desc) {
+    GLenum format = GL_RGBA;
+    GLenum type = GL_FLOAT;
+    if (isStencilFormat(desc.format)) {
+        format = GL_DEPTH_STENCIL;
+        type = desc.format == GL_DEPTH24_STENCIL8 ? GL_UNSIGNED_INT_24_8 : GL_FLOAT_32_UNSIGNED_INT_24_8_REV;
+    } else if (isDepthFormat(desc.format)) {
+        format = GL_DEPTH_COMPONENT;
+    } else if (isIntegerFormat(desc.format)) {
+        format = GL_RGBA_INTEGER;
+        type = GL_UNSIGNED_INT;
+    }
+
+    GLuint texture = 0;
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glTexImage2D(GL_TEXTURE_2D, 0, desc.format, desc.width, desc.height, 0, format, type, nullptr);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    return texture;
+}
+
+}  // anonymous namespace
+
+RenderTargetPool::RenderTargetPool(int keepFrames)
+    : keepFrames_{ keepFrames } {
+}
+
+RenderTargetPool::~RenderTargetPool() {
+    clear();
+}
+
+GLuint RenderTargetPool::acquire(const TargetDesc& desc) {
+    const TargetDesc bucket = bucketDesc(desc);
+    for (Entry& entry : entries_) {
+        if (!entry.isUsed && entry.desc == bucket) {
+            entry.isUsed = true;
+            entry.idleFrames = 0;
+            return entry.texture;
+        }
+    }
+
+    Entry entry;
+    entry.desc = bucket;
+    entry.texture = createTexture(bucket);
+    entry.isUsed = true;
+    entries_.push_back(entry);
+    return entry.texture;
+}
+
+void RenderTargetPool::release(GLuint texture) {
+    for (Entry& entry : entries_) {
+        if (entry.texture == texture) {
+            entry.isUsed = false;
+            return;
+        }
+    }
+}
+
+std::vector<GLuint> RenderTargetPool::endFrame() {
+    // Textures used in this frame have not been idle for any frame, which
+    // includes those held across frames.
+    for (Entry& entry : entries_) {
+        if (entry.isUsed) {
+            entry.idleFrames = 0;
+        }
+    }
+
+    size_t usedBytes = 0;
+    for (const Entry& entry : entries_) {
+        if (entry.idleFrames == 0) {
+            usedBytes += targetBytes(entry.desc);
+        }
+    }
+
+    // The idle textures are kept from the most recently used one, while
+    // they fit in the memory of the used ones.
+    std::stable_sort(entries_.begin(), entries_.end(), [](const Entry& a, const Entry& b) {
+        return a.idleFrames < b.idleFrames;
+    });
+
+    std::vector<GLuint> deleted;
+    std::vector<Entry> kept;
+    size_t idleBytes = 0;
+    for (Entry& entry : entries_) {
+        if (entry.idleFrames > 0) {
+            idleBytes += targetBytes(entry.desc);
+            if (entry.idleFrames > keepFrames_ || idleBytes > usedBytes) {
+                glDeleteTextures(1, &entry.texture);
+                deleted.push_back(entry.texture);
+                continue;
+            }
+        }
+        entry.idleFrames++;
+        kept.push_back(entry);
+    }
+    entries_.swap(kept);
+    return deleted;
+}
+
+void RenderTargetPool::clear() {
+    for (const Entry& entry : entries_) {
+        glDeleteTextures(1, &entry.texture);
+    }
+    entries_.clear();
+}
+
+size_t RenderTargetPool::memoryBytes() const {
+    size_t bytes = 0;
+    for (const Entry& entry : entries_) {
+        bytes += targetBytes(entry.desc);
+    }
+    return bytes;
+}
+
+FrameGraph::Builder::Builder(FrameGraph& graph, int pass)
+    : graph_{ graph }
+    , pass_{ pass } {
+}
+
+TargetHandle FrameGraph::Builder::create(const TargetDesc& desc) {
+    Target target;
+    target.desc = desc;
+    target.version = ++graph_.version_;
+    graph_.targets_.push_back(target);
+    return static_cast<TargetHandle>(graph_.targets_.size()) - 1;
+}
+
+TargetHandle FrameGraph::Builder::createPersistent(const std::string& name, const TargetDesc& desc) {
+    // The contents are lost when the target is allocated again, even if the
+    // pool hands out the same texture for the new size.
+    PersistentTarget& persistent = graph_.persistentTargets_[name];
+    if (persistent.texture == 0 || !(persistent.desc == desc)) {
+        if (persistent.texture != 0) {
+            graph_.pool_.release(persistent.texture);
+        }
+        persistent.desc = desc;
+        persistent.texture = graph_.pool_.acquire(desc);
+        persistent.version = ++graph_.version_;
+    }
+    persistent.isDeclared = true;
+
+    Target target;
+    target.desc = desc;
+    target.texture = persistent.texture;
+    target.isTransient = false;
+    target.persistentName = name;
+    target.version = persistent.version;
+    graph_.targets_.push_back(target);
+    return static_cast<TargetHandle>(graph_.targets_.size()) - 1;
+}
+
+void FrameGraph::Builder::read(TargetHandle target) {
+    graph_.passes_[pass_].reads.push_back(target);
+}
+
+void FrameGraph::Builder::write(TargetHandle target) {
+    graph_.passes_[pass_].writes.push_back(target);
+}
+
+void FrameGraph::Builder::attach(TargetHandle target) {
+    graph_.passes_[pass_].writes.push_back(target);
+    graph_.passes_[pass_].attachments.push_back(target);
+}
+
+void FrameGraph::Builder::markOutput() {
+    graph_.passes_[pass_].isOutput = true;
+}
+
+void FrameGraph::Builder::setInputs(const PassInputs& inputs) {
+    graph_.passes_[pass_].inputs = inputs;
+    graph_.passes_[pass_].hasInputs = true;
+}
+
+FrameGraph::Resources::Resources(FrameGraph& graph)
+    : graph_{ graph } {
+}
+
+GLuint FrameGraph::Resources::texture(TargetHandle target) const {
+    return graph_.targets_[target].texture;
+}
+
+const TargetDesc& FrameGraph::Resources::desc(TargetHandle target) const {
+    return graph_.targets_[target].desc;
+}
+
+GLuint FrameGraph::Resources::framebuffer(TargetHandle color, TargetHandle depth) const {
+    std::vector<GLuint> colors;
+    if (color != INVALID_TARGET) {
+        colors.push_back(texture(color));
+    }
+    if (depth == INVALID_TARGET) {
+        return graph_.findFramebuffer(colors, 0, GL_NONE);
+    }
+    return graph_.findFramebuffer(colors, texture(depth), desc(depth).format);
+}
+
+FrameGraph::FrameGraph() {
+}
+
+FrameGraph::~FrameGraph() {
+    auto f = QOpenGLContext::currentContext()->extraFunctions();
+    for (const auto& entry : framebuffers_) {
+        f->glDeleteFramebuffers(1, &entry.second);
+    }
+}
+
+void FrameGraph::addPass(const std::string& name, const SetupFunc& setup, const ExecuteFunc& execute) {
+    Pass pass;
+    pass.name = name;
+    pass.execute = execute;
+    passes_.push_back(pass);
+
+    Builder builder(*this, static_cast<int>(passes_.size()) - 1);
+    setup(builder);
+}
+
+TargetHandle FrameGraph::importTarget(GLuint texture, const TargetDesc& desc) {
+    Target target;
+    target.desc = desc;
+    target.texture = texture;
+    target.isTransient = false;
+    target.version = ++version_;
+    targets_.push_back(target);
+    return static_cast<TargetHandle>(targets_.size()) - 1;
+}
+
+void FrameGraph::execute(GLuint defaultFramebuffer, int width, int height) {
+    cull();
+    skip();
+
+    // Lifetimes of the targets over the passes which are run.
+    const int numPasses = static_cast<int>(passes_.size());
+    for (int p = 0; p < numPasses; p++) {
+        PassCounts& counts = passCounts_[passes_[p].name];
+        if (passes_[p].isCulled) {
+            counts.culls++;
+            continue;
+        }
+        if (passes_[p].isSkipped) {
+            counts.skips++;
+            continue;
+        }
+        counts.runs++;
+
+        for (const auto* handles : { &passes_[p].reads, &passes_[p].writes }) {
+            for (TargetHandle t : *handles) {
+                if (targets_[t].firstPass < 0) {
+                    targets_[t].firstPass = p;
+                }
+                targets_[t].lastPass = p;
+            }
+        }
+    }
+
+    auto f = QOpenGLContext::currentContext()->extraFunctions();
+    Resources resources(*this);
+    for (int p = 0; p < numPasses; p++) {
+        const Pass& pass = passes_[p];
+        if (pass.isCulled || pass.isSkipped) {
+            continue;
+        }
+
+        for (Target& target : targets_) {
+            if (target.isTransient && target.firstPass == p) {
+                target.texture = pool_.acquire(target.desc);
+            }
+        }
+
+        if (pass.attachments.empty()) {
+            f->glBindFramebuffer(GL_FRAMEBUFFER, defaultFramebuffer);
+            glViewport(0, 0, width, height);
+        } else {
+            bindFramebuffer(pass);
+        }
+        pass.execute(resources);
+
+        // The textures are handed to the later passes of the same description.
+        for (const Target& target : targets_) {
+            if (target.isTransient && target.lastPass == p) {
+                pool_.release(target.texture);
+            }
+        }
+    }
+
+    f->glBindFramebuffer(GL_FRAMEBUFFER, defaultFramebuffer);
+    glViewport(0, 0, width, height);
+
+    // Persistent targets which were not declared in this frame are freed.
+    for (auto it = persistentTargets_.begin(); it != persistentTargets_.end();) {
+        if (!it->second.isDeclared) {
+            pool_.release(it->second.texture);
+            it = persistentTargets_.erase(it);
+        } else {
+            it->second.isDeclared = false;
+            ++it;
+        }
+    }
+
+    dropFramebuffers(pool_.endFrame());
+    targets_.clear();
+    passes_.clear();
+}
+
+void FrameGraph::cull() {
+    // Walk back from the outputs. A pass is needed if it writes a target
+    // which a later needed pass reads, and the target is no longer needed
+    // before a needed pass which writes it without reading.
+    std::vector<bool> isNeeded(targets_.size(), false);
+    numCulledPasses_ = 0;
+    for (int p = static_cast<int>(passes_.size()) - 1; p >= 0; p--) {
+        Pass& pass = passes_[p];
+        bool isLive = pass.isOutput;
+        for (TargetHandle t : pass.writes) {
+            isLive = isLive || isNeeded[t];
+        }
+
+        pass.isCulled = !isLive;
+        if (pass.isCulled) {
+            numCulledPasses_++;
+            continue;
+        }
+
+        for (TargetHandle t : pass.writes) {
+            isNeeded[t] = false;
+        }
+        for (TargetHandle t : pass.reads) {
+            isNeeded[t] = true;
+        }
+    }
+}
+
+void FrameGraph::skip() {
+    // Last passes reading the targets, whose transient targets must be
+    // written in this frame.
+    std::vector<int> lastReads(targets_.size(), -1);
+    for (int p = 0; p < static_cast<int>(passes_.size()); p++) {
+        if (!passes_[p].isCulled) {
+            for (TargetHandle t : passes_[p].reads) {
+                lastReads[t] = p;
+            }
+        }
+    }
+
+    // The versions are advanced in the order of the passes, so that the
+    // passes reading the targets of a pass which is run are also run.
+    for (int p = 0; p < static_cast<int>(passes_.size()); p++) {
+        Pass& pass = passes_[p];
+        pass.isSkipped = false;
+        if (pass.isCulled) {
+            continue;
+        }
+
+        // Transient targets are new in every frame, so that only the kept
+        // ones are compared among the written targets.
+        std::vector<TargetHandle> keptWrites;
+        for (TargetHandle t : pass.writes) {
+            if (!targets_[t].isTransient) {
+                keptWrites.push_back(t);
+            }
+        }
+
+        const std::vector<unsigned long long> readVersions = versions(pass.reads);
+        if (pass.hasInputs) {
+            const auto it = passRecords_.find(pass.name);
+            bool isSkipped = it != passRecords_.end() &&
+                             it->second.inputs == pass.inputs &&
+                             it->second.readVersions == readVersions &&
+                             it->second.writeVersions == versions(keptWrites);
+            for (TargetHandle t : pass.writes) {
+                isSkipped = isSkipped && !(targets_[t].isTransient && lastReads[t] > p);
+            }
+            pass.isSkipped = isSkipped;
+        }
+        if (pass.isSkipped) {
+            continue;
+        }
+
+        for (TargetHandle t : pass.writes) {
+            targets_[t].version = ++version_;
+            if (!targets_[t].persistentName.empty()) {
+                persistentTargets_[targets_[t].persistentName].version = targets_[t].version;
+            }
+        }
+        if (pass.hasInputs) {
+            PassRecord& record = passRecords_[pass.name];
+            record.inputs = pass.inputs;
+            record.readVersions = readVersions;
+            record.writeVersions = versions(keptWrites);
+        }
+    }
+}
+
+std::vector<unsigned long long> FrameGraph::versions(const std::vector<TargetHandle>& targets) const {
+    std::vector<unsigned long long> result;
+    for (TargetHandle t : targets) {
+        result.push_back(targets_[t].version);
+    }
+    return result;
+}
+
+void FrameGraph::bindFramebuffer(const Pass& pass) {
+    std::vector<GLuint> colors;
+    GLuint depth = 0;
+    GLenum depthFormat = GL_NONE;
+    for (TargetHandle t : pass.attachments) {
+        if (isDepthFormat(targets_[t].desc.format)) {
+            depth = targets_[t].texture;
+            depthFormat = targets_[t].desc.format;
+        } else {
+            colors.push_back(targets_[t].texture);
+        }
+    }
+
+    auto f = QOpenGLContext::currentContext()->extraFunctions();
+    f->glBindFramebuffer(GL_FRAMEBUFFER, findFramebuffer(colors, depth, depthFormat));
+
+    const TargetDesc& desc = targets_[pass.attachments[0]].desc;
+    glViewport(0, 0, desc.width, desc.height);
+}
+
+GLuint FrameGraph::findFramebuffer(const std::vector<GLuint>& colors, GLuint depth, GLenum depthFormat) {
+    std::vector<GLuint> key = colors;
+    key.push_back(depth);
+    const auto it = framebuffers_.find(key);
+    if (it != framebuffers_.end()) {
+        return it->second;
+    }
+
+    // The framebuffer is created without disturbing the bound one, since
+    // the passes may ask for it while rendering.
+    auto f = QOpenGLContext::currentContext()->extraFunctions();
+    GLint bound = 0;
+    glGetIntegerv(GL_FRAMEBUFFER_BINDING, &bound);
+
+    GLuint framebuffer = 0;
+    f->glGenFramebuffers(1, &framebuffer);
+    f->glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+
+    std::vector<GLenum> bufs;
+    for (int i = 0; i < static_cast<int>(colors.size()); i++) {
+        f->glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + i, GL_TEXTURE_2D, colors[i], 0);
+        bufs.push_back(GL_COLOR_ATTACHMENT0 + i);
+    }
+    if (depth != 0) {
+        const GLenum attachment = isStencilFormat(depthFormat) ? GL_DEPTH_STENCIL_ATTACHMENT : GL_DEPTH_ATTACHMENT;
+        f->glFramebufferTexture2D(GL_FRAMEBUFFER, attachment, GL_TEXTURE_2D, depth, 0);
+    }
+
+    if (bufs.empty()) {
+        const GLenum none = GL_NONE;
+        f->glDrawBuffers(1, &none);
+        f->glReadBuffer(GL_NONE);
+    } else {
+        f->glDrawBuffers(static_cast<GLsizei>(bufs.size()), bufs.data());
+        f->glReadBuffer(GL_COLOR_ATTACHMENT0);
+    }
+
+    if (f->glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+        std::cerr << "Frame graph framebuffer is incomplete!!" << std::endl;
+    }
+
+    f->glBindFramebuffer(GL_FRAMEBUFFER, bound);
+    framebuffers_[key] = framebuffer;
+    return framebuffer;
+}
+
+void FrameGraph::dropFramebuffers(const std::vector<GLuint>& textures) {
+    if (textures.empty()) {
+        return;
+    }
+
+    auto f = QOpenGLContext::currentContext()->extraFunctions();
+    for (auto it = framebuffers_.begin(); it != framebuffers_.end();) {
+        const std::vector<GLuint>& key = it->first;
+        const bool isStale = std::any_of(key.begin(), key.end(), [&](GLuint texture) {
+            return texture != 0 && std::find(textures.begin(), textures.end(), texture) != textures.end();
+        });
+        if (isStale) {
+            f->glDeleteFramebuffers(1, &it->second);
+            it = framebuffers_.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
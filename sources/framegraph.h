@@ -0,0 +1,240 @@
+#ifdef _MSC_VER
+#pragma once
+#endif
+
+#ifndef _FRAME_GRAPH_H_
+#define _FRAME_GRAPH_H_
+
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <QtGui/qopengl.h>
+
+// Size and internal format of a render target. Textures of the same
+// description are interchangeable.
+struct TargetDesc {
+    int width = 0;
+    int height = 0;
+    GLenum format = GL_RGBA8;
+};
+
+inline bool operator==(const TargetDesc& a, const TargetDesc& b) {
+    return a.width == b.width && a.height == b.height && a.format == b.format;
+}
+
+// Pool of the textures of transient render targets. A released texture is
+// handed out again for the same description, so that the targets of passes
+// which do not overlap share the memory. The textures are allocated at the
+// sizes rounded up to buckets, so that a window being resized takes the
+// same textures for most of its sizes, and the textures may be larger than
+// the targets. Released textures are kept for "keepFrames" frames, which
+// saves the reallocation when a pass is switched on and off or the window
+// is resized back and forth, but the idle ones are never allowed to take
+// more memory than the ones in use.
+class RenderTargetPool {
+public:
+    explicit RenderTargetPool(int keepFrames = 60);
+    virtual ~RenderTargetPool();
+
+    GLuint acquire(const TargetDesc& desc);
+    void release(GLuint texture);
+
+    // Deletes the textures which have been idle for too long, and returns
+    // their names to drop the framebuffers referring to them.
+    std::vector<GLuint> endFrame();
+    void clear();
+
+    size_t memoryBytes() const;
+
+private:
+    struct Entry {
+        TargetDesc desc;
+        GLuint texture = 0;
+        bool isUsed = false;
+        int idleFrames = 0;
+    };
+
+    int keepFrames_;
+    std::vector<Entry> entries_;
+};
+
+// Inputs of a pass other than its targets, such as matrices and switches.
+// The values are compared as raw bytes, so that they must not contain
+// pointers or padding.
+class PassInputs {
+public:
+    inline PassInputs& addData(const void* data, size_t size) {
+        const char* bytes = reinterpret_cast<const char*>(data);
+        bytes_.insert(bytes_.end(), bytes, bytes + size);
+        return *this;
+    }
+
+    template <class T>
+    inline PassInputs& add(const T& value) {
+        return addData(&value, sizeof(T));
+    }
+
+    inline bool operator==(const PassInputs& other) const { return bytes_ == other.bytes_; }
+
+private:
+    std::vector<char> bytes_;
+};
+
+using TargetHandle = int;
+static constexpr TargetHandle INVALID_TARGET = -1;
+
+// Passes of a frame declared with the targets they read and write. The
+// passes are added in the order of execution, and those whose results are
+// not read by any later pass are culled unless they are marked as outputs,
+// such as the passes drawing to the screen. Transient targets are taken from
+// the pool just before their first use, and given back after their last use.
+// The pool and the framebuffers persist across frames, while the passes are
+// declared again for every frame.
+//
+// The textures of the targets are larger than their descriptions when the
+// pool rounds up the sizes. The passes are drawn at the sizes of the
+// descriptions, and the shaders must take the sizes from uniforms instead of
+// "textureSize()" and read the textures by "texelFetch()".
+//
+// Persistent targets keep their contents across frames under their names.
+// A pass whose inputs are declared is skipped when the inputs, the versions
+// of the targets it reads and those of the targets it writes are the same as
+// when it was last run, so that its results of an earlier frame are used.
+// Such a pass must write its persistent targets as a whole without reading
+// them. It is always run when its transient targets are read later.
+class FrameGraph {
+public:
+    // Declaration of the targets of a pass. Attached targets are bound as
+    // the color or depth attachments of the framebuffer of the pass in the
+    // order of the calls. Targets which are written by other means, such as
+    // images or blits, are declared by "write()".
+    class Builder {
+    public:
+        TargetHandle create(const TargetDesc& desc);
+        TargetHandle createPersistent(const std::string& name, const TargetDesc& desc);
+        void read(TargetHandle target);
+        void write(TargetHandle target);
+        void attach(TargetHandle target);
+        void markOutput();
+        void setInputs(const PassInputs& inputs);
+
+    private:
+        friend class FrameGraph;
+        Builder(FrameGraph& graph, int pass);
+
+        FrameGraph& graph_;
+        int pass_;
+    };
+
+    // Textures of the targets while the passes are executed.
+    class Resources {
+    public:
+        GLuint texture(TargetHandle target) const;
+        const TargetDesc& desc(TargetHandle target) const;
+
+        // Framebuffer with the given targets attached, for the passes which
+        // render into more than one set of targets.
+        GLuint framebuffer(TargetHandle color, TargetHandle depth = INVALID_TARGET) const;
+
+    private:
+        friend class FrameGraph;
+        explicit Resources(FrameGraph& graph);
+
+        FrameGraph& graph_;
+    };
+
+    using SetupFunc   = std::function<void(Builder&)>;
+    using ExecuteFunc = std::function<void(const Resources&)>;
+
+    // Numbers of the frames in which a pass was run, skipped for the
+    // unchanged inputs, and culled.
+    struct PassCounts {
+        long long runs = 0;
+        long long skips = 0;
+        long long culls = 0;
+    };
+
+    FrameGraph();
+    virtual ~FrameGraph();
+
+    // "setup()" is called immediately, and "execute()" in "execute()" of
+    // the graph if the pass is neither culled nor skipped. The name
+    // identifies the pass across frames.
+    void addPass(const std::string& name, const SetupFunc& setup, const ExecuteFunc& execute);
+    TargetHandle importTarget(GLuint texture, const TargetDesc& desc);
+
+    // Runs the passes and clears them. The passes without attachments are
+    // run with the given framebuffer and viewport, which are restored at
+    // the end.
+    void execute(GLuint defaultFramebuffer, int width, int height);
+
+    inline int numCulledPasses() const { return numCulledPasses_; }
+    inline const std::map<std::string, PassCounts>& passCounts() const { return passCounts_; }
+    inline size_t memoryBytes() const { return pool_.memoryBytes(); }
+
+private:
+    // Targets are versioned by a counter, which advances whenever a target
+    // is written or allocated.
+    struct Target {
+        TargetDesc desc;
+        GLuint texture = 0;
+        bool isTransient = true;
+        std::string persistentName;
+        unsigned long long version = 0;
+        int firstPass = -1;
+        int lastPass = -1;
+    };
+
+    struct Pass {
+        std::string name;
+        ExecuteFunc execute;
+        std::vector<TargetHandle> reads;
+        std::vector<TargetHandle> writes;
+        std::vector<TargetHandle> attachments;
+        PassInputs inputs;
+        bool hasInputs = false;
+        bool isOutput = false;
+        bool isCulled = false;
+        bool isSkipped = false;
+    };
+
+    struct PersistentTarget {
+        TargetDesc desc;
+        GLuint texture = 0;
+        unsigned long long version = 0;
+        bool isDeclared = false;
+    };
+
+    // Inputs and target versions of the last run of a pass.
+    struct PassRecord {
+        PassInputs inputs;
+        std::vector<unsigned long long> readVersions;
+        std::vector<unsigned long long> writeVersions;
+    };
+
+    void cull();
+    void skip();
+    std::vector<unsigned long long> versions(const std::vector<TargetHandle>& targets) const;
+    void bindFramebuffer(const Pass& pass);
+    GLuint findFramebuffer(const std::vector<GLuint>& colors, GLuint depth, GLenum depthFormat);
+    void dropFramebuffers(const std::vector<GLuint>& textures);
+
+    RenderTargetPool pool_;
+    std::vector<Target> targets_;
+    std::vector<Pass> passes_;
+    int numCulledPasses_ = 0;
+
+    std::map<std::string, PersistentTarget> persistentTargets_;
+    std::map<std::string, PassRecord> passRecords_;
+    std::map<std::string, PassCounts> passCounts_;
+    unsigned long long version_ = 0;
+
+    // Framebuffers keyed by the names of the attached textures, where the
+    // depth attachment comes last.
+    std::map<std::vector<GLuint>, GLuint> framebuffers_;
+};
+
+#endif  // _FRAME_GRAPH_H_
@@ -0,0 +1,69 @@
+#include "framescheduler.h"
+
+#include <algorithm>
+#include <cmath>
+
+// Interval of the frames which poll the background work in "OnDemand".
+static constexpr double BUSY_POLL_INTERVAL = 16.0;
+
+// Weight of the newest frame in the average frame time.
+static constexpr double FRAME_TIME_WEIGHT = 0.2;
+
+FrameScheduler::FrameScheduler() {
+    clock_.start();
+}
+
+void FrameScheduler::setMode(FrameMode mode) {
+    mode_ = mode;
+}
+
+void FrameScheduler::setTargetRate(double framesPerSecond) {
+    if (framesPerSecond > 0.0) {
+        targetRate_ = framesPerSecond;
+    }
+}
+
+void FrameScheduler::setLoadLimit(double loadLimit) {
+    if (loadLimit > 0.0) {
+        loadLimit_ = std::min(loadLimit, 1.0);
+    }
+}
+
+void FrameScheduler::requestFrame() {
+    isRequested_ = true;
+}
+
+void FrameScheduler::beginFrame() {
+    frameStart_ = clock_.nsecsElapsed();
+}
+
+void FrameScheduler::endFrame(bool isBusy) {
+    const double time = (clock_.nsecsElapsed() - frameStart_) * 1.0e-6;
+    if (isFirstFrame_) {
+        frameTime_ = time;
+        isFirstFrame_ = false;
+    } else {
+        frameTime_ += (time - frameTime_) * FRAME_TIME_WEIGHT;
+    }
+
+    isRequested_ = false;
+    isBusy_ = isBusy;
+}
+
+int FrameScheduler::nextFrameDelay() const {
+    if (mode_ == FrameMode::OnDemand && !isRequested_ && !isBusy_) {
+        return -1;
+    }
+
+    // Shortest interval between the starts of two frames.
+    double interval = 0.0;
+    if (mode_ == FrameMode::FixedRate) {
+        interval = 1000.0 / targetRate_;
+    } else if (mode_ == FrameMode::OnDemand && !isRequested_) {
+        interval = BUSY_POLL_INTERVAL;
+    }
+    interval = std::max(interval, frameTime_ / loadLimit_);
+
+    const double elapsed = (clock_.nsecsElapsed() - frameStart_) * 1.0e-6;
+    return std::max(0, static_cast<int>(std::ceil(interval - elapsed)));
+}
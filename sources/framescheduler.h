@@ -0,0 +1,61 @@
+#ifdef _MSC_VER
+#pragma once
+#endif
+
+#ifndef _FRAME_SCHEDULER_H_
+#define _FRAME_SCHEDULER_H_
+
+#include <QtCore/qelapsedtimer.h>
+
+enum class FrameMode : int {
+    OnDemand = 0,
+    VSync,
+    FixedRate
+};
+
+// Decides when the viewer renders the next frame. In "OnDemand", frames are
+// rendered only for the requested changes, and while the background work
+// polled by the frames, such as readbacks and sample builds, is running.
+// In "VSync", a frame follows every swap of the window, which waits for the
+// vertical sync, and in "FixedRate", frames are rendered at the target rate.
+// In every mode, the frames are spaced so that the time spent in rendering
+// them, which is averaged over the recent frames, is at most "loadLimit" of
+// the whole time. Several viewers on one machine thus leave time to others.
+class FrameScheduler {
+public:
+    FrameScheduler();
+
+    void setMode(FrameMode mode);
+    inline FrameMode mode() const { return mode_; }
+    void setTargetRate(double framesPerSecond);
+    void setLoadLimit(double loadLimit);
+
+    // A frame is rendered for the change as soon as the limits allow.
+    void requestFrame();
+
+    // Brackets the rendering of a frame. "isBusy" tells that the frame has
+    // polled background work which has not finished yet.
+    void beginFrame();
+    void endFrame(bool isBusy);
+
+    // Milliseconds from now to the next frame, or -1 if no frame is due.
+    // In "VSync", zero means that the frame follows the last swap.
+    int nextFrameDelay() const;
+
+    // Average time of rendering a frame in milliseconds.
+    inline double frameTime() const { return frameTime_; }
+
+private:
+    FrameMode mode_ = FrameMode::OnDemand;
+    double targetRate_ = 60.0;
+    double loadLimit_ = 1.0;
+
+    QElapsedTimer clock_;
+    qint64 frameStart_ = 0;
+    double frameTime_ = 0.0;
+    bool isFirstFrame_ = true;
+    bool isRequested_ = true;
+    bool isBusy_ = false;
+};
+
+#endif  // _FRAME_SCHEDULER_H_
@@ -0,0 +1,222 @@
+#include "gbufferreadback.h"
+
+#include <QtGui/qopenglcontext.h>
+
+void ReadbackView::copyToPlanes(float* const* planes) const {
+    copyToPlanes(planes, 0, 0, width, height);
+}
+
+void ReadbackView::copyToPlanes(float* const* planes, int x0, int y0, int x1, int y1) const {
+    for (int y = y0; y < y1; y++) {
+        const float* src = data + static_cast<size_t>(height - y - 1) * width * channels;
+        for (int ch = 0; ch < channels; ch++) {
+            float* dst = planes[ch] + static_cast<size_t>(y) * width;
+            for (int x = x0; x < x1; x++) {
+                dst[x] = src[x * channels + ch];
+            }
+        }
+    }
+}
+
+GBufferReadback::GBufferReadback(int width, int height, int numSlots)
+    : width_{ width }
+    , height_{ height } {
+    for (auto& set : sets_) {
+        set.entries.resize(numSlots);
+        for (auto& slot : set.entries) {
+            slot.buffer = std::make_unique<QOpenGLBuffer>(QOpenGLBuffer::PixelPackBuffer);
+            slot.buffer->create();
+            slot.buffer->setUsagePattern(QOpenGLBuffer::StreamRead);
+        }
+    }
+}
+
+GBufferReadback::~GBufferReadback() {
+    for (auto& set : sets_) {
+        discard(set);
+    }
+}
+
+void GBufferReadback::discard(SlotSet& set) {
+    // Buffers and fences cannot be released without the context.
+    QOpenGLContext* context = QOpenGLContext::currentContext();
+    if (!context) {
+        return;
+    }
+
+    auto f = context->extraFunctions();
+    if (set.state == SetState::Mapped) {
+        for (auto& slot : set.entries) {
+            if (slot.mapped) {
+                slot.buffer->bind();
+                slot.buffer->unmap();
+                slot.buffer->release();
+                slot.mapped = nullptr;
+            }
+        }
+    }
+
+    if (set.fence) {
+        f->glDeleteSync(set.fence);
+        set.fence = 0;
+    }
+    set.state = SetState::Free;
+}
+
+void GBufferReadback::read(QOpenGLFramebufferObject& fbo, int attachmentIndex, int channels, int slot, bool isInteger) {
+    static const GLenum formats[] = { GL_RED, GL_RG, GL_RGB, GL_RGBA };
+    static const GLenum integerFormats[] = { GL_RED_INTEGER, GL_RG_INTEGER, GL_RGB_INTEGER, GL_RGBA_INTEGER };
+
+    if (isInteger) {
+        readPixels(fbo, GL_COLOR_ATTACHMENT0 + attachmentIndex, integerFormats[channels - 1], GL_UNSIGNED_INT,
+                   channels, slot);
+    } else {
+        readPixels(fbo, GL_COLOR_ATTACHMENT0 + attachmentIndex, formats[channels - 1], GL_FLOAT,
+                   channels, slot);
+    }
+}
+
+void GBufferReadback::readDepth(QOpenGLFramebufferObject& fbo, int slot) {
+    readPixels(fbo, GL_NONE, GL_DEPTH_COMPONENT, GL_FLOAT, 1, slot);
+}
+
+void GBufferReadback::readPixels(QOpenGLFramebufferObject& fbo, GLenum readBuffer, GLenum format, GLenum type,
+                                 int channels, int slot) {
+    // The results of the set which has not been taken yet are overwritten.
+    SlotSet& set = sets_[writeSet_];
+    if (set.state != SetState::Free) {
+        if (mappedSet_ == writeSet_) {
+            mappedSet_ = -1;
+        }
+        discard(set);
+    }
+
+    Slot& s = set.entries[slot];
+    s.channels = channels;
+
+    const int bytes = sizeof(float) * width_ * height_ * channels;
+    s.buffer->bind();
+    if (s.buffer->size() != bytes) {
+        s.buffer->allocate(bytes);
+    }
+
+    fbo.bind();
+    glPixelStorei(GL_PACK_ALIGNMENT, 4);
+    glReadBuffer(readBuffer);
+    glReadPixels(0, 0, width_, height_, format, type, 0);
+    fbo.release();
+
+    s.buffer->release();
+}
+
+void GBufferReadback::submit(const QMatrix4x4& mvpMat) {
+    auto f = QOpenGLContext::currentContext()->extraFunctions();
+    SlotSet& set = sets_[writeSet_];
+    set.fence = f->glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    set.mvpMat = mvpMat;
+    set.state = SetState::Pending;
+    set.serial = ++serial_;
+
+    // Make sure that the commands are sent, so that the fence will be signaled.
+    glFlush();
+
+    writeSet_ = 1 - writeSet_;
+}
+
+bool GBufferReadback::isPending() const {
+    return sets_[0].state == SetState::Pending || sets_[1].state == SetState::Pending;
+}
+
+bool GBufferReadback::map(bool isBlocking) {
+    if (mappedSet_ >= 0) {
+        return true;
+    }
+
+    // Take the oldest set in flight.
+    int target = -1;
+    for (int i = 0; i < 2; i++) {
+        if (sets_[i].state == SetState::Pending &&
+            (target < 0 || sets_[i].serial < sets_[target].serial)) {
+            target = i;
+        }
+    }
+    if (target < 0) {
+        return false;
+    }
+
+    auto f = QOpenGLContext::currentContext()->extraFunctions();
+    SlotSet& set = sets_[target];
+    GLenum status = f->glClientWaitSync(set.fence, 0, 0);
+    while (isBlocking && status == GL_TIMEOUT_EXPIRED) {
+        status = f->glClientWaitSync(set.fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000);
+    }
+
+    // A set whose wait has failed is never signaled. It is dropped, so that
+    // the caller sees nothing pending and reads the images again.
+    if (status == GL_WAIT_FAILED) {
+        discard(set);
+        return false;
+    }
+    if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED) {
+        return false;
+    }
+
+    f->glDeleteSync(set.fence);
+    set.fence = 0;
+
+    for (auto& slot : set.entries) {
+        if (slot.channels == 0) {
+            continue;
+        }
+        slot.buffer->bind();
+        slot.mapped = static_cast<const float*>(slot.buffer->mapRange(0, slot.buffer->size(), QOpenGLBuffer::RangeRead));
+        slot.buffer->release();
+    }
+    set.state = SetState::Mapped;
+    mappedSet_ = target;
+    return true;
+}
+
+void GBufferReadback::unmap() {
+    if (mappedSet_ < 0) {
+        return;
+    }
+
+    discard(sets_[mappedSet_]);
+    mappedSet_ = -1;
+}
+
+void GBufferReadback::reset() {
+    for (auto& set : sets_) {
+        discard(set);
+    }
+    mappedSet_ = -1;
+}
+
+size_t GBufferReadback::memoryBytes() const {
+    size_t bytes = 0;
+    for (const auto& set : sets_) {
+        for (const auto& slot : set.entries) {
+            bytes += slot.buffer->size();
+        }
+    }
+    return bytes;
+}
+
+ReadbackView GBufferReadback::view(int slot) const {
+    ReadbackView v;
+    if (mappedSet_ < 0) {
+        return v;
+    }
+
+    const Slot& s = sets_[mappedSet_].entries[slot];
+    v.data     = s.mapped;
+    v.width    = width_;
+    v.height   = height_;
+    v.channels = s.channels;
+    return v;
+}
+
+QMatrix4x4 GBufferReadback::mvpMat() const {
+    return mappedSet_ < 0 ? QMatrix4x4() : sets_[mappedSet_].mvpMat;
+}
@@ -0,0 +1,95 @@
+#ifdef _MSC_VER
+#pragma once
+#endif
+
+#ifndef _GBUFFER_READBACK_H_
+#define _GBUFFER_READBACK_H_
+
+#include <memory>
+#include <vector>
+
+#include <QtGui/qmatrix4x4.h>
+#include <QtGui/qopenglbuffer.h>
+#include <QtGui/qopenglframebufferobject.h>
+#include <QtGui/qopenglextrafunctions.h>
+
+// Read-only view of one read back image. Pixels are interleaved with the
+// given number of channels, and rows are stored bottom-up as in OpenGL.
+// Integer attachments are exposed with the same layout, and the user
+// reinterprets the bits of the values.
+struct ReadbackView {
+    const float* data = nullptr;
+    int width    = 0;
+    int height   = 0;
+    int channels = 0;
+
+    // Deinterleaves the view into separate planes, flipping it vertically.
+    // The rectangle [x0, x1) x [y0, y1) is given in the flipped coordinates.
+    void copyToPlanes(float* const* planes) const;
+    void copyToPlanes(float* const* planes, int x0, int y0, int x1, int y1) const;
+};
+
+// Asynchronous readback of FBO attachments through pixel buffer objects.
+// Each call of "read()" copies the requested channels of an attachment, and
+// "readDepth()" the depth buffer, to a PBO slot of the current set, and
+// "submit()" closes the set with a fence and the matrix by which the images
+// were rendered, which is returned by "mvpMat()" for the mapped set.
+// Two sets are used alternately, so that the next readback can be issued
+// while the previous one is still in flight. "map()" does not wait for the
+// GPU unless requested; it returns false until the fence of the oldest set
+// is signaled.
+class GBufferReadback {
+public:
+    GBufferReadback(int width, int height, int numSlots);
+    virtual ~GBufferReadback();
+
+    void read(QOpenGLFramebufferObject& fbo, int attachmentIndex, int channels, int slot, bool isInteger = false);
+    void readDepth(QOpenGLFramebufferObject& fbo, int slot);
+    void submit(const QMatrix4x4& mvpMat);
+
+    bool map(bool isBlocking = false);
+    void unmap();
+    void reset();
+
+    ReadbackView view(int slot) const;
+    QMatrix4x4 mvpMat() const;
+
+    bool isPending() const;
+    inline int width() const { return width_; }
+    inline int height() const { return height_; }
+    size_t memoryBytes() const;
+
+private:
+    struct Slot {
+        std::unique_ptr<QOpenGLBuffer> buffer = nullptr;
+        int channels = 0;
+        const float* mapped = nullptr;
+    };
+
+    enum class SetState : int {
+        Free,
+        Pending,
+        Mapped
+    };
+
+    struct SlotSet {
+        std::vector<Slot> entries;
+        GLsync fence = 0;
+        QMatrix4x4 mvpMat;
+        SetState state = SetState::Free;
+        unsigned long long serial = 0;
+    };
+
+    void discard(SlotSet& set);
+    void readPixels(QOpenGLFramebufferObject& fbo, GLenum readBuffer, GLenum format, GLenum type,
+                    int channels, int slot);
+
+    int width_;
+    int height_;
+    SlotSet sets_[2];
+    int writeSet_ = 0;
+    int mappedSet_ = -1;
+    unsigned long long serial_ = 0;
+};
+
+#endif  // _GBUFFER_READBACK_H_
@@ -0,0 +1,256 @@
+#ifdef _MSC_VER
+#pragma once
+#endif
+
+#ifndef _IMAGE_PYRAMID_H_
+#define _IMAGE_PYRAMID_H_
+
+#include <vector>
+#include <algorithm>
+#include <utility>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define PYRAMID_USE_SSE 1
+#include <emmintrin.h>
+#endif
+
+#if defined(__AVX2__)
+#define PYRAMID_USE_AVX 1
+#include <immintrin.h>
+#endif
+
+// -----------------------------------------------------------------------------
+// Reducers
+// -----------------------------------------------------------------------------
+// A reducer merges a 2x2 block of the finer level into one texel of the
+// coarser level. Each reducer provides a scalar version and SIMD versions
+// which process four (SSE) or eight (AVX) output texels at once.
+
+struct MinReducer {
+    static inline float apply(float t0, float t1, float t2, float t3) {
+        return std::min(std::min(t0, t1), std::min(t2, t3));
+    }
+
+#if PYRAMID_USE_SSE
+    static inline __m128 apply(__m128 t0, __m128 t1, __m128 t2, __m128 t3) {
+        return _mm_min_ps(_mm_min_ps(t0, t1), _mm_min_ps(t2, t3));
+    }
+#endif
+
+#if PYRAMID_USE_AVX
+    static inline __m256 apply(__m256 t0, __m256 t1, __m256 t2, __m256 t3) {
+        return _mm256_min_ps(_mm256_min_ps(t0, t1), _mm256_min_ps(t2, t3));
+    }
+#endif
+};
+
+struct MaxReducer {
+    static inline float apply(float t0, float t1, float t2, float t3) {
+        return std::max(std::max(t0, t1), std::max(t2, t3));
+    }
+
+#if PYRAMID_USE_SSE
+    static inline __m128 apply(__m128 t0, __m128 t1, __m128 t2, __m128 t3) {
+        return _mm_max_ps(_mm_max_ps(t0, t1), _mm_max_ps(t2, t3));
+    }
+#endif
+
+#if PYRAMID_USE_AVX
+    static inline __m256 apply(__m256 t0, __m256 t1, __m256 t2, __m256 t3) {
+        return _mm256_max_ps(_mm256_max_ps(t0, t1), _mm256_max_ps(t2, t3));
+    }
+#endif
+};
+
+struct AvgReducer {
+    static inline float apply(float t0, float t1, float t2, float t3) {
+        return ((t0 + t1) + (t2 + t3)) * 0.25f;
+    }
+
+#if PYRAMID_USE_SSE
+    static inline __m128 apply(__m128 t0, __m128 t1, __m128 t2, __m128 t3) {
+        return _mm_mul_ps(_mm_add_ps(_mm_add_ps(t0, t1), _mm_add_ps(t2, t3)), _mm_set1_ps(0.25f));
+    }
+#endif
+
+#if PYRAMID_USE_AVX
+    static inline __m256 apply(__m256 t0, __m256 t1, __m256 t2, __m256 t3) {
+        return _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(t0, t1), _mm256_add_ps(t2, t3)), _mm256_set1_ps(0.25f));
+    }
+#endif
+};
+
+// -----------------------------------------------------------------------------
+// Row kernel
+// -----------------------------------------------------------------------------
+// Reduces two consecutive rows of the finer level into one row of the coarser
+// level. "width" is the width of the coarser row.
+
+template <class Reducer>
+inline void reduceRow(const float* row0, const float* row1, float* out, int width) {
+    int x = 0;
+
+#if PYRAMID_USE_AVX
+    for (; x + 8 <= width; x += 8) {
+        const __m256 a0 = _mm256_loadu_ps(row0 + 2 * x);
+        const __m256 a1 = _mm256_loadu_ps(row0 + 2 * x + 8);
+        const __m256 b0 = _mm256_loadu_ps(row1 + 2 * x);
+        const __m256 b1 = _mm256_loadu_ps(row1 + 2 * x + 8);
+
+        // Shuffles work per 128-bit lane, so the result comes out as
+        // [o0 o1 o4 o5 | o2 o3 o6 o7] and is put back in order afterwards.
+        const __m256 t0 = _mm256_shuffle_ps(a0, a1, _MM_SHUFFLE(2, 0, 2, 0));
+        const __m256 t1 = _mm256_shuffle_ps(a0, a1, _MM_SHUFFLE(3, 1, 3, 1));
+        const __m256 t2 = _mm256_shuffle_ps(b0, b1, _MM_SHUFFLE(2, 0, 2, 0));
+        const __m256 t3 = _mm256_shuffle_ps(b0, b1, _MM_SHUFFLE(3, 1, 3, 1));
+
+        const __m256 r = Reducer::apply(t0, t1, t2, t3);
+        const __m256d p = _mm256_permute4x64_pd(_mm256_castps_pd(r), _MM_SHUFFLE(3, 1, 2, 0));
+        _mm256_storeu_ps(out + x, _mm256_castpd_ps(p));
+    }
+#endif
+
+#if PYRAMID_USE_SSE
+    for (; x + 4 <= width; x += 4) {
+        const __m128 a0 = _mm_loadu_ps(row0 + 2 * x);
+        const __m128 a1 = _mm_loadu_ps(row0 + 2 * x + 4);
+        const __m128 b0 = _mm_loadu_ps(row1 + 2 * x);
+        const __m128 b1 = _mm_loadu_ps(row1 + 2 * x + 4);
+
+        const __m128 t0 = _mm_shuffle_ps(a0, a1, _MM_SHUFFLE(2, 0, 2, 0));
+        const __m128 t1 = _mm_shuffle_ps(a0, a1, _MM_SHUFFLE(3, 1, 3, 1));
+        const __m128 t2 = _mm_shuffle_ps(b0, b1, _MM_SHUFFLE(2, 0, 2, 0));
+        const __m128 t3 = _mm_shuffle_ps(b0, b1, _MM_SHUFFLE(3, 1, 3, 1));
+
+        _mm_storeu_ps(out + x, Reducer::apply(t0, t1, t2, t3));
+    }
+#endif
+
+    for (; x < width; x++) {
+        out[x] = Reducer::apply(row0[x * 2], row0[x * 2 + 1], row1[x * 2], row1[x * 2 + 1]);
+    }
+}
+
+// -----------------------------------------------------------------------------
+// ImagePyramid
+// -----------------------------------------------------------------------------
+// Multi-channel image pyramid stored as structure-of-arrays. Every channel is
+// a separate float plane, and the reducer of each plane is given as a template
+// parameter. All planes of a level are reduced in one fused pass over the rows.
+// Level 0 is the coarsest level and "levels() - 1" is the finest one, which is
+// filled by the user before calling "build()". Memory is only allocated when
+// the size changes, so that rebuilding the pyramid is allocation-free.
+
+template <class... Reducers>
+class ImagePyramid {
+public:
+    static constexpr int numPlanes = sizeof...(Reducers);
+
+    ImagePyramid() = default;
+
+    void resize(int width, int height, int levels) {
+        if (width == width_ && height == height_ && levels == levels_) {
+            return;
+        }
+
+        width_  = width;
+        height_ = height;
+        levels_ = levels;
+
+        sizes_.resize(levels);
+        data_.resize(levels);
+        for (int l = levels - 1; l >= 0; l--) {
+            const int shift = levels - 1 - l;
+            sizes_[l] = std::make_pair(width >> shift, height >> shift);
+            data_[l].assign(static_cast<size_t>(sizes_[l].first) * sizes_[l].second * numPlanes, 0.0f);
+        }
+    }
+
+    void build() {
+        build(0, 0, width_, height_);
+    }
+
+    // Rebuilds only the texels covering the rectangle [x0, x1) x [y0, y1) of
+    // the finest level. The corners should be multiples of "1 << (levels() - 1)".
+    void build(int x0, int y0, int x1, int y1) {
+        for (int l = levels_ - 1; l >= 1; l--) {
+            const int shift = levels_ - l;
+            buildLevel(l - 1, x0 >> shift, y0 >> shift,
+                       std::min(x1 >> shift, width(l - 1)), std::min(y1 >> shift, height(l - 1)),
+                       std::make_index_sequence<numPlanes>());
+        }
+    }
+
+    inline int levels() const { return levels_; }
+    inline int width(int level) const { return sizes_[level].first; }
+    inline int height(int level) const { return sizes_[level].second; }
+
+    inline float* plane(int level, int p) {
+        return &data_[level][static_cast<size_t>(width(level)) * height(level) * p];
+    }
+    inline const float* plane(int level, int p) const {
+        return &data_[level][static_cast<size_t>(width(level)) * height(level) * p];
+    }
+
+    inline float at(int level, int p, int x, int y) const {
+        return plane(level, p)[y * width(level) + x];
+    }
+
+    inline size_t memoryBytes() const {
+        size_t bytes = 0;
+        for (const auto& d : data_) {
+            bytes += d.size() * sizeof(float);
+        }
+        return bytes;
+    }
+
+private:
+    template <size_t... Is>
+    void buildLevel(int level, int x0, int y0, int x1, int y1, std::index_sequence<Is...>) {
+        const int upWidth  = width(level);
+        const int lowWidth = width(level + 1);
+
+        for (int y = y0; y < y1; y++) {
+            // Expand the row kernel for every plane with its own reducer.
+            int dummy[] = { 0, (reduceRow<Reducers>(
+                plane(level + 1, Is) + (y * 2) * lowWidth + x0 * 2,
+                plane(level + 1, Is) + (y * 2 + 1) * lowWidth + x0 * 2,
+                plane(level, Is) + y * upWidth + x0, x1 - x0), 0)... };
+            (void)dummy;
+        }
+    }
+
+    int width_  = 0;
+    int height_ = 0;
+    int levels_ = 0;
+    std::vector<std::pair<int, int>> sizes_;
+    std::vector<std::vector<float>> data_;
+};
+
+// -----------------------------------------------------------------------------
+// G-buffer pyramid
+// -----------------------------------------------------------------------------
+
+enum GBufferPlane : int {
+    GBUF_MIN_DEPTH = 0,
+    GBUF_MAX_DEPTH,
+    GBUF_POSITION_X,
+    GBUF_POSITION_Y,
+    GBUF_POSITION_Z,
+    GBUF_NORMAL_X,
+    GBUF_NORMAL_Y,
+    GBUF_NORMAL_Z,
+    GBUF_TEXCOORD_U,
+    GBUF_TEXCOORD_V,
+    GBUF_NUM_PLANES
+};
+
+using GBufferPyramid = ImagePyramid<MinReducer, MaxReducer,
+                                    AvgReducer, AvgReducer, AvgReducer,
+                                    AvgReducer, AvgReducer, AvgReducer,
+                                    AvgReducer, AvgReducer>;
+
+static_assert(GBufferPyramid::numPlanes == GBUF_NUM_PLANES,
+              "Reducers of GBufferPyramid must match GBufferPlane");
+
+#endif  // _IMAGE_PYRAMID_H_
@@ -2,10 +2,10 @@
 
 #include <QtWidgets/qboxlayout.h>
 #include <QtWidgets/qgroupbox.h>
-#include <QtWidgets/qradiobutton.h>
 #include <QtWidgets/qlabel.h>
 #include <QtWidgets/qlineedit.h>
 #include <QtWidgets/qcheckbox.h>
+#include <QtWidgets/qcombobox.h>
 #include <QtCore/qelapsedtimer.h>
 
 class MainGui::Ui : public QWidget {
@@ -21,14 +21,8 @@ public:
 
         groupLayout = new QVBoxLayout(this);
         mtrlGroup->setLayout(groupLayout);
-        milkRadio = new QRadioButton(this);
-        milkRadio->setText("Milk");
-        milkRadio->setChecked(true);
-        skinRadio = new QRadioButton(this);
-        skinRadio->setText("Skin");
-
-        groupLayout->addWidget(milkRadio);
-        groupLayout->addWidget(skinRadio);
+        mtrlCombo = new QComboBox(this);
+        groupLayout->addWidget(mtrlCombo);
         layout->addWidget(mtrlGroup);
 
         scaleLabel = new QLabel("Scale", this);
@@ -43,28 +37,177 @@ public:
         transCheckBox = new QCheckBox("Transmission", this);
         transCheckBox->setChecked(true);
         layout->addWidget(transCheckBox);
+
+        lightCheckBox = new QCheckBox("Dynamic light", this);
+        lightCheckBox->setChecked(false);
+        layout->addWidget(lightCheckBox);
+
+        cutCheckBox = new QCheckBox("View-dependent cut", this);
+        cutCheckBox->setChecked(false);
+        layout->addWidget(cutCheckBox);
+
+        instancedCheckBox = new QCheckBox("Instanced splats", this);
+        instancedCheckBox->setChecked(false);
+        layout->addWidget(instancedCheckBox);
+
+        multiresCheckBox = new QCheckBox("Multiresolution splats", this);
+        multiresCheckBox->setChecked(false);
+        layout->addWidget(multiresCheckBox);
+
+        rejectionCheckBox = new QCheckBox("Early rejection", this);
+        rejectionCheckBox->setChecked(true);
+        layout->addWidget(rejectionCheckBox);
+
+        gatherCheckBox = new QCheckBox("Compute gather", this);
+        gatherCheckBox->setChecked(false);
+        layout->addWidget(gatherCheckBox);
+
+        cullingCheckBox = new QCheckBox("Sample culling", this);
+        cullingCheckBox->setChecked(true);
+        layout->addWidget(cullingCheckBox);
+
+        bufSizeLabel = new QLabel("Light buffer size", this);
+        layout->addWidget(bufSizeLabel);
+        bufSizeCombo = new QComboBox(this);
+        bufSizeCombo->addItem("1024");
+        bufSizeCombo->addItem("2048");
+        bufSizeCombo->addItem("4096");
+        bufSizeCombo->addItem("8192");
+        layout->addWidget(bufSizeCombo);
+
+        budgetLabel = new QLabel("Sample budget (0: thresholds)", this);
+        layout->addWidget(budgetLabel);
+        budgetEdit = new QLineEdit(this);
+        budgetEdit->setText("0");
+        layout->addWidget(budgetEdit);
+
+        epsilonLabel = new QLabel("Splat epsilon", this);
+        layout->addWidget(epsilonLabel);
+        epsilonEdit = new QLineEdit(this);
+        epsilonEdit->setText("1.0e-5");
+        layout->addWidget(epsilonEdit);
+
+        modeLabel = new QLabel("Dipole evaluation", this);
+        layout->addWidget(modeLabel);
+        modeCombo = new QComboBox(this);
+        modeCombo->addItem("Exact");
+        modeCombo->addItem("Table");
+        modeCombo->addItem("Fast");
+        layout->addWidget(modeCombo);
+
+        transScaleLabel = new QLabel("Translucency resolution", this);
+        layout->addWidget(transScaleLabel);
+        transScaleCombo = new QComboBox(this);
+        transScaleCombo->addItem("1/1");
+        transScaleCombo->addItem("1/2");
+        transScaleCombo->addItem("1/4");
+        layout->addWidget(transScaleCombo);
+
+        pacingLabel = new QLabel("Frame pacing", this);
+        layout->addWidget(pacingLabel);
+        pacingCombo = new QComboBox(this);
+        pacingCombo->addItem("On demand");
+        pacingCombo->addItem("VSync");
+        pacingCombo->addItem("Fixed rate");
+        layout->addWidget(pacingCombo);
+
+        rateLabel = new QLabel("Target frame rate", this);
+        layout->addWidget(rateLabel);
+        rateEdit = new QLineEdit(this);
+        rateEdit->setText("60");
+        layout->addWidget(rateEdit);
+
+        loadLabel = new QLabel("Rendering load limit (0, 1]", this);
+        layout->addWidget(loadLabel);
+        loadEdit = new QLineEdit(this);
+        loadEdit->setText("1.0");
+        layout->addWidget(loadEdit);
+
+        fragmentLabel = new QLabel("Dipole fragments", this);
+        layout->addWidget(fragmentLabel);
+
+        memoryLabel = new QLabel("Sample memory", this);
+        layout->addWidget(memoryLabel);
+
+        errorLabel = new QLabel("Dipole profile error", this);
+        layout->addWidget(errorLabel);
+
+        passLabel = new QLabel("Passes", this);
+        layout->addWidget(passLabel);
     }
 
     ~Ui() {
-        delete milkRadio;
-        delete skinRadio;
+        delete mtrlCombo;
         delete groupLayout;
         delete scaleLabel;
         delete scaleEdit;
         delete mtrlGroup;
         delete reflCheckBox;
         delete transCheckBox;
+        delete lightCheckBox;
+        delete cutCheckBox;
+        delete instancedCheckBox;
+        delete multiresCheckBox;
+        delete rejectionCheckBox;
+        delete gatherCheckBox;
+        delete cullingCheckBox;
+        delete bufSizeLabel;
+        delete bufSizeCombo;
+        delete budgetLabel;
+        delete budgetEdit;
+        delete epsilonLabel;
+        delete epsilonEdit;
+        delete modeLabel;
+        delete modeCombo;
+        delete transScaleLabel;
+        delete transScaleCombo;
+        delete pacingLabel;
+        delete pacingCombo;
+        delete rateLabel;
+        delete rateEdit;
+        delete loadLabel;
+        delete loadEdit;
+        delete fragmentLabel;
+        delete memoryLabel;
+        delete errorLabel;
+        delete passLabel;
         delete layout;
     }
 
-    QRadioButton* milkRadio = nullptr;
-    QRadioButton* skinRadio = nullptr;
+    QComboBox*    mtrlCombo = nullptr;
     QGroupBox*    mtrlGroup = nullptr;
     QVBoxLayout*  groupLayout = nullptr;
     QLabel*       scaleLabel = nullptr;
     QLineEdit*    scaleEdit = nullptr;
     QCheckBox*    reflCheckBox  = nullptr;
     QCheckBox*    transCheckBox = nullptr;
+    QCheckBox*    lightCheckBox = nullptr;
+    QCheckBox*    cutCheckBox = nullptr;
+    QCheckBox*    instancedCheckBox = nullptr;
+    QCheckBox*    multiresCheckBox = nullptr;
+    QCheckBox*    rejectionCheckBox = nullptr;
+    QCheckBox*    gatherCheckBox = nullptr;
+    QCheckBox*    cullingCheckBox = nullptr;
+    QLabel*       bufSizeLabel = nullptr;
+    QComboBox*    bufSizeCombo = nullptr;
+    QLabel*       budgetLabel = nullptr;
+    QLineEdit*    budgetEdit = nullptr;
+    QLabel*       epsilonLabel = nullptr;
+    QLineEdit*    epsilonEdit = nullptr;
+    QLabel*       modeLabel = nullptr;
+    QComboBox*    modeCombo = nullptr;
+    QLabel*       transScaleLabel = nullptr;
+    QComboBox*    transScaleCombo = nullptr;
+    QLabel*       pacingLabel = nullptr;
+    QComboBox*    pacingCombo = nullptr;
+    QLabel*       rateLabel = nullptr;
+    QLineEdit*    rateEdit = nullptr;
+    QLabel*       loadLabel = nullptr;
+    QLineEdit*    loadEdit = nullptr;
+    QLabel*       fragmentLabel = nullptr;
+    QLabel*       memoryLabel = nullptr;
+    QLabel*       errorLabel = nullptr;
+    QLabel*       passLabel = nullptr;
     QVBoxLayout*  layout = nullptr;
 };
 
@@ -89,12 +232,32 @@ MainGui::MainGui(QWidget* parent)
     ui->setSizePolicy(uiPolicy);
     mainLayout->addWidget(ui);
 
-    connect(ui->milkRadio, SIGNAL(toggled(bool)), this, SLOT(OnRadioToggled(bool)));
-    connect(ui->skinRadio, SIGNAL(toggled(bool)), this, SLOT(OnRadioToggled(bool)));
+    // Materials are listed from the library of the viewer.
+    const MaterialLibrary& materials = viewer->materialLibrary();
+    for (int i = 0; i < materials.size(); i++) {
+        ui->mtrlCombo->addItem(QString::fromStdString(materials[i].name));
+    }
+    ui->mtrlCombo->setCurrentIndex(std::max(0, materials.find("Milk")));
+    connect(ui->mtrlCombo, SIGNAL(currentIndexChanged(int)), this, SLOT(OnMaterialChanged(int)));
     connect(ui->scaleEdit, SIGNAL(editingFinished()), this, SLOT(OnScaleChanged()));
 
     connect(ui->reflCheckBox, SIGNAL(stateChanged(int)), this, SLOT(OnCheckStateChanged(int)));
     connect(ui->transCheckBox, SIGNAL(stateChanged(int)), this, SLOT(OnCheckStateChanged(int)));
+    connect(ui->lightCheckBox, SIGNAL(stateChanged(int)), this, SLOT(OnLightStateChanged(int)));
+    connect(ui->cutCheckBox, SIGNAL(stateChanged(int)), this, SLOT(OnCutStateChanged(int)));
+    connect(ui->instancedCheckBox, SIGNAL(stateChanged(int)), this, SLOT(OnInstancedStateChanged(int)));
+    connect(ui->multiresCheckBox, SIGNAL(stateChanged(int)), this, SLOT(OnMultiresStateChanged(int)));
+    connect(ui->rejectionCheckBox, SIGNAL(stateChanged(int)), this, SLOT(OnRejectionStateChanged(int)));
+    connect(ui->gatherCheckBox, SIGNAL(stateChanged(int)), this, SLOT(OnGatherStateChanged(int)));
+    connect(ui->cullingCheckBox, SIGNAL(stateChanged(int)), this, SLOT(OnCullingStateChanged(int)));
+    connect(ui->bufSizeCombo, SIGNAL(currentIndexChanged(int)), this, SLOT(OnBufSizeChanged(int)));
+    connect(ui->budgetEdit, SIGNAL(editingFinished()), this, SLOT(OnBudgetChanged()));
+    connect(ui->epsilonEdit, SIGNAL(editingFinished()), this, SLOT(OnEpsilonChanged()));
+    connect(ui->modeCombo, SIGNAL(currentIndexChanged(int)), this, SLOT(OnModeChanged(int)));
+    connect(ui->transScaleCombo, SIGNAL(currentIndexChanged(int)), this, SLOT(OnTransScaleChanged(int)));
+    connect(ui->pacingCombo, SIGNAL(currentIndexChanged(int)), this, SLOT(OnPacingChanged(int)));
+    connect(ui->rateEdit, SIGNAL(editingFinished()), this, SLOT(OnFrameRateChanged()));
+    connect(ui->loadEdit, SIGNAL(editingFinished()), this, SLOT(OnLoadLimitChanged()));
     connect(viewer, SIGNAL(frameSwapped()), this, SLOT(OnFrameSwapped()));
 }
 
@@ -105,12 +268,8 @@ MainGui::~MainGui() {
     delete mainWidget;
 }
 
-void MainGui::OnRadioToggled(bool state) {
-    if (ui->milkRadio->isChecked()) {
-        viewer->setMaterial("Milk");
-    } else if (ui->skinRadio->isChecked()) {
-        viewer->setMaterial("Skin");
-    }
+void MainGui::OnMaterialChanged(int index) {
+    viewer->setMaterial(ui->mtrlCombo->currentText().toStdString());
 }
 
 void MainGui::OnScaleChanged() {
@@ -123,6 +282,66 @@ void MainGui::OnCheckStateChanged(int state) {
     viewer->setRenderComponents(isRefl, isTrans);
 }
 
+void MainGui::OnLightStateChanged(int state) {
+    viewer->setDynamicLight(ui->lightCheckBox->isChecked());
+}
+
+void MainGui::OnCutStateChanged(int state) {
+    viewer->setViewDependentCut(ui->cutCheckBox->isChecked());
+}
+
+void MainGui::OnInstancedStateChanged(int state) {
+    viewer->setInstancedSplats(ui->instancedCheckBox->isChecked());
+}
+
+void MainGui::OnMultiresStateChanged(int state) {
+    viewer->setMultiresSplats(ui->multiresCheckBox->isChecked());
+}
+
+void MainGui::OnRejectionStateChanged(int state) {
+    viewer->setEarlyRejection(ui->rejectionCheckBox->isChecked());
+}
+
+void MainGui::OnGatherStateChanged(int state) {
+    viewer->setComputeGather(ui->gatherCheckBox->isChecked());
+}
+
+void MainGui::OnCullingStateChanged(int state) {
+    viewer->setSampleCulling(ui->cullingCheckBox->isChecked());
+}
+
+void MainGui::OnBufSizeChanged(int index) {
+    viewer->setLightBufferSize(ui->bufSizeCombo->currentText().toInt());
+}
+
+void MainGui::OnBudgetChanged() {
+    viewer->setSampleBudget(ui->budgetEdit->text().toInt());
+}
+
+void MainGui::OnEpsilonChanged() {
+    viewer->setSplatEpsilon(ui->epsilonEdit->text().toDouble());
+}
+
+void MainGui::OnModeChanged(int index) {
+    viewer->setDipoleMode(static_cast<DipoleMode>(index));
+}
+
+void MainGui::OnTransScaleChanged(int index) {
+    viewer->setTranslucencyScale(1 << index);
+}
+
+void MainGui::OnPacingChanged(int index) {
+    viewer->setFrameMode(static_cast<FrameMode>(index));
+}
+
+void MainGui::OnFrameRateChanged() {
+    viewer->setTargetFrameRate(ui->rateEdit->text().toDouble());
+}
+
+void MainGui::OnLoadLimitChanged() {
+    viewer->setLoadLimit(ui->loadEdit->text().toDouble());
+}
+
 void MainGui::OnFrameSwapped() {
     static bool isStarted = false;
     static QElapsedTimer timer;
@@ -137,4 +356,40 @@ void MainGui::OnFrameSwapped() {
         setWindowTitle(QString("FPS: %1").arg(QString::number(fps, 'f', 2)));
         lastTime = currentTime;
     }
+
+    // Fragments of the splats with and without the early rejection.
+    auto countText = [this](bool isRejection) {
+        const long long count = viewer->fragmentCount(isRejection);
+        return count >= 0 ? QString::number(count) : QString("-");
+    };
+    ui->fragmentLabel->setText(QString("Dipole fragments\n%1 without / %2 with rejection")
+                               .arg(countText(false)).arg(countText(true)));
+
+    // Memory of the sample builder and the readback in MB.
+    auto mbText = [](size_t bytes) {
+        return QString::number(bytes / (1024.0 * 1024.0), 'f', 1);
+    };
+    ui->memoryLabel->setText(QString("Sample memory (MB)\n%1 (peak %2) + readback %3")
+                             .arg(mbText(viewer->builderMemory(false)))
+                             .arg(mbText(viewer->builderMemory(true)))
+                             .arg(mbText(viewer->readbackMemory())));
+
+    // Relative L2 errors of the evaluation modes for the current material.
+    auto errorText = [this](DipoleMode mode) {
+        const double error = viewer->profileError(mode);
+        return error >= 0.0 ? QString::number(error, 'e', 2) : QString("-");
+    };
+    ui->errorLabel->setText(QString("Dipole profile error\nexact %1 / table %2 / fast %3")
+                            .arg(errorText(DipoleMode::Exact))
+                            .arg(errorText(DipoleMode::Table))
+                            .arg(errorText(DipoleMode::Fast)));
+
+    // Frames in which the passes were run, skipped and culled.
+    QString passText("Passes (run / skip / cull)");
+    for (const auto& entry : viewer->passCounts()) {
+        const FrameGraph::PassCounts& counts = entry.second;
+        passText += QString("\n%1: %2 / %3 / %4").arg(QString::fromStdString(entry.first))
+                    .arg(counts.runs).arg(counts.skips).arg(counts.culls);
+    }
+    ui->passLabel->setText(passText);
 }
\ No newline at end of file
@@ -18,9 +18,24 @@ public:
     virtual ~MainGui();
 
 private slots:
-    void OnRadioToggled(bool);
+    void OnMaterialChanged(int);
     void OnScaleChanged();
     void OnCheckStateChanged(int);
+    void OnLightStateChanged(int);
+    void OnCutStateChanged(int);
+    void OnInstancedStateChanged(int);
+    void OnMultiresStateChanged(int);
+    void OnRejectionStateChanged(int);
+    void OnGatherStateChanged(int);
+    void OnCullingStateChanged(int);
+    void OnBufSizeChanged(int);
+    void OnBudgetChanged();
+    void OnEpsilonChanged();
+    void OnModeChanged(int);
+    void OnTransScaleChanged(int);
+    void OnPacingChanged(int);
+    void OnFrameRateChanged();
+    void OnLoadLimitChanged();
     void OnFrameSwapped();
 
 private:
@@ -0,0 +1,87 @@
+#include "materiallibrary.h"
+
+#include <cstring>
+#include <iterator>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+
+namespace {
+
+// Materials used when the library file is not available.
+const MaterialEntry DEFAULT_MATERIALS[] = {
+    { "Milk", { QVector3D(0.0015333, 0.0046, 0.019933), QVector3D(4.5513, 5.8294, 7.136), 1.3f } },
+    { "Skin", { QVector3D(0.061, 0.97, 1.45),           QVector3D(0.18, 0.07, 0.03),      1.3f } }
+};
+
+}  // anonymous namespace
+
+MaterialLibrary::MaterialLibrary()
+    : entries_{ std::begin(DEFAULT_MATERIALS), std::end(DEFAULT_MATERIALS) } {
+}
+
+bool MaterialLibrary::load(const std::string& filename) {
+    std::ifstream reader(filename.c_str(), std::ios::in);
+    if (reader.fail()) {
+        std::cerr << "Failed to open material file: " << filename << std::endl;
+        return false;
+    }
+
+    std::vector<MaterialEntry> entries;
+    std::string line;
+    for (int lineNo = 1; std::getline(reader, line); lineNo++) {
+        std::istringstream iss(line);
+        std::string name;
+        if (!(iss >> name) || name[0] == '#') {
+            continue;
+        }
+
+        float values[7];
+        for (int i = 0; i < 7; i++) {
+            iss >> values[i];
+        }
+        if (iss.fail()) {
+            std::cerr << "Ignore broken material at line " << lineNo << ": " << filename << std::endl;
+            continue;
+        }
+
+        MaterialEntry entry;
+        entry.name = name;
+        entry.mtrl.sigma_a  = QVector3D(values[0], values[1], values[2]);
+        entry.mtrl.sigmap_s = QVector3D(values[3], values[4], values[5]);
+        entry.mtrl.eta      = values[6];
+        entries.push_back(entry);
+    }
+
+    if (entries.empty()) {
+        return false;
+    }
+    entries_ = std::move(entries);
+    return true;
+}
+
+int MaterialLibrary::find(const std::string& name) const {
+    for (int i = 0; i < size(); i++) {
+        if (entries_[i].name == name) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+std::vector<unsigned char> MaterialLibrary::uniformBlocks(int stride) const {
+    std::vector<unsigned char> data(static_cast<size_t>(stride) * entries_.size(), 0);
+    for (int i = 0; i < size(); i++) {
+        const DipoleCoefficients coeffs = dipoleCoefficients(entries_[i].mtrl);
+        const float block[5][4] = {
+            { coeffs.sigma_tr.x(), coeffs.sigma_tr.y(), coeffs.sigma_tr.z(), 0.0f },
+            { coeffs.alphap.x(),   coeffs.alphap.y(),   coeffs.alphap.z(),   0.0f },
+            { coeffs.zpos.x(),     coeffs.zpos.y(),     coeffs.zpos.z(),     0.0f },
+            { coeffs.zneg.x(),     coeffs.zneg.y(),     coeffs.zneg.z(),     0.0f },
+            { entries_[i].mtrl.eta, coeffs.A, 0.0f, 0.0f }
+        };
+        static_assert(sizeof(block) == blockSize, "Layout of the material block is broken");
+        std::memcpy(&data[static_cast<size_t>(stride) * i], block, sizeof(block));
+    }
+    return data;
+}
@@ -0,0 +1,46 @@
+#ifdef _MSC_VER
+#pragma once
+#endif
+
+#ifndef _MATERIAL_LIBRARY_H_
+#define _MATERIAL_LIBRARY_H_
+
+#include <string>
+#include <vector>
+
+#include "dipoleprofile.h"
+
+// Scattering coefficients of a named material at the unit scale.
+struct MaterialEntry {
+    std::string name;
+    DipoleMaterial mtrl;
+};
+
+// Library of the materials read from a text file. Every line of the file
+// gives a material as
+//
+//   name  sigma_a(R G B)  sigmap_s(R G B)  eta
+//
+// and lines starting with '#' are comments. The constants of the dipole are
+// packed for every material as the "Material" uniform block of "dipole.fs",
+// so that a material is selected by binding the range of its block.
+class MaterialLibrary {
+public:
+    // Size of the "Material" block in the std140 layout.
+    static constexpr int blockSize = 5 * 4 * sizeof(float);
+
+    MaterialLibrary();
+
+    bool load(const std::string& filename);
+
+    int find(const std::string& name) const;
+    std::vector<unsigned char> uniformBlocks(int stride) const;
+
+    inline int size() const { return static_cast<int>(entries_.size()); }
+    inline const MaterialEntry& operator[](int index) const { return entries_[index]; }
+
+private:
+    std::vector<MaterialEntry> entries_;
+};
+
+#endif  // _MATERIAL_LIBRARY_H_
@@ -1,10 +1,12 @@
 #include "openglviewer.h"
 
+#include <cmath>
+#include <algorithm>
 #include <ctime>
 #include <iostream>
 #include <fstream>
-#include <functional>
 
+#include <QtCore/qcryptographichash.h>
 #include <QtGui/qevent.h>
 #include <QtGui/qpainter.h>
 #include <QtGui/qopenglcontext.h>
@@ -15,6 +17,8 @@
 #define TINYOBJLOADER_IMPLEMENTATION
 #include "tiny_obj_loader.h"
 
+#include "dipoleprofile.h"
+#include "shadersource.h"
 #include "settings.h"
 
 // Please activate folloring line to save intermediate results.
@@ -28,44 +32,48 @@ static constexpr int SAMPLE_POSITION_LOC = 0;
 static constexpr int SAMPLE_NORMAL_LOC   = 1;
 static constexpr int SAMPLE_TEXCOORD_LOC = 2;
 static constexpr int SAMPLE_RADIUS_LOC   = 3;
+static constexpr int SAMPLE_CORNER_LOC   = 4;
 
-static const QVector3D lightPos = QVector3D(-3.0f, 4.0f, 5.0f);
+// Light buffers larger than this size are processed tile by tile.
+static constexpr int GBUF_TILE_SIZE = 1024;
 
-static QVector3D sigma_a   = QVector3D(0.0015333, 0.0046, 0.019933);
-static QVector3D sigmap_s  = QVector3D(4.5513   , 5.8294, 7.136   );
-static float     eta       = 1.3f;
-static float     mtrlScale = 50.0f;
-static bool      isRenderRefl = true;
-static bool      isRenderTrans = true;
+// Cosine of the angle (15 degrees) by which the moving light leaves the
+// position the light buffers are rendered from before they are rendered
+// from it again.
+static constexpr float LIGHT_ANCHOR_COS = 0.9659f;
 
-struct Sample {
-    QVector3D position;
-    QVector3D normal;
-    QVector2D texcoord;
-    float radius;
-};
+// Splats of the view-dependent cut are refined up to this size in pixels.
+static constexpr float CUT_TARGET_PIXELS = 8.0f;
 
-namespace {
+// Splat sizes are tabulated for the sample radii 2^(l - 2), l = 0, 1, ...
+// The number of levels must match "SUPPORT_LEVELS" of "shaders/common.glsl".
+static constexpr int SUPPORT_LEVELS = 14;
+static constexpr float SUPPORT_MAX_DIST = 2.0f;
 
-void takeFloatImage(QOpenGLFramebufferObject& fbo, cv::Mat* image, int channels, int attachmentIndex) {
-    const int width  = fbo.width();
-    const int height = fbo.height();
+// Number of texels of the tabulated diffusion profile.
+static constexpr int PROFILE_TABLE_SIZE = 1024;
 
-    fbo.bind();
-    std::vector<float> pixels(width * height * 4);
-    glReadBuffer(GL_COLOR_ATTACHMENT0 + attachmentIndex);
-    glReadPixels(0, 0, width, height, GL_RGBA, GL_FLOAT, &pixels[0]);
+// Number of the screen buffers for the multiresolution splatting. Samples of
+// the level l (radius 2^(l - 2)) are splatted into the buffer at 1 / 2^l of
+// the resolution, and the coarsest buffer takes all the coarser samples.
+static constexpr int MULTIRES_LEVELS = 4;
+static_assert(MULTIRES_LEVELS == SampleCuller::numSegments,
+              "Samples must be culled per multiresolution level");
+static_assert(MULTIRES_LEVELS == SAMPLE_SEGMENTS,
+              "Samples must be packed per multiresolution level");
 
-    *image = cv::Mat(width, height, CV_MAKETYPE(CV_32F, channels));
-    for (int y = 0; y < height; y++) {
-        for (int x = 0; x < width; x++) {
-            for (int ch = 0; ch < channels; ch++) {
-                image->at<float>(height - y - 1, x * channels + ch) = pixels[(y * width + x) * 4 + ch];
-            }
-        }
-    }
-    fbo.release();
-}
+// Depth range of the camera.
+static constexpr float CAMERA_NEAR = 1.0f;
+static constexpr float CAMERA_FAR  = 1000.0f;
+
+// Binding point of the "Material" uniform block.
+static constexpr int MATERIAL_BLOCK_BINDING = 0;
+
+static float     mtrlScale = 50.0f;
+static bool      isRenderRefl = true;
+static bool      isRenderTrans = true;
+
+namespace {
 
 void saveFloatImage(const std::string& filename, cv::InputArray image) {
     cv::Mat img = image.getMat();    
@@ -74,26 +82,58 @@ void saveFloatImage(const std::string& filename, cv::InputArray image) {
     cv::imwrite(filename, img8u);
 }
 
-template <class T>
-void pyrDown(cv::InputArray lower, cv::OutputArray upper, const std::function<T(T, T, T, T)>& f) {
-    cv::Mat  low = lower.getMat();
-    cv::Mat& up  = upper.getMatRef();
-    
-    const int width  = low.cols;
-    const int height = low.rows;
-    up = cv::Mat(height / 2, width / 2, CV_MAKETYPE(low.depth(), low.channels()));
-
-    for (int y = 0; y < height / 2; y++) {
-        for (int x = 0; x < width / 2; x++) {
-            T& t0 = low.at<T>(y * 2, x * 2);
-            T& t1 = low.at<T>(y * 2, x * 2 + 1);
-            T& t2 = low.at<T>(y * 2 + 1, x * 2);
-            T& t3 = low.at<T>(y * 2 + 1, x * 2 + 1);
-            up.at<T>(y, x) = f(t0, t1, t2, t3);
-        }
+// Saves the first three channels of a texture, which is flipped vertically.
+void saveTexture(const std::string& filename, GLuint texture, int width, int height) {
+    // Textures of the frame graph may be larger than the targets, whose
+    // region is cropped.
+    GLint texWidth = 0, texHeight = 0;
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &texWidth);
+    glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT, &texHeight);
+    cv::Mat image(texHeight, texWidth, CV_32FC3);
+    glGetTexImage(GL_TEXTURE_2D, 0, GL_BGR, GL_FLOAT, image.data);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    image = image(cv::Rect(0, 0, width, height)).clone();
+    cv::flip(image, image, 0);
+    saveFloatImage(filename, image);
+}
+
+// Attributes of "PackedSample", which are read once per instance for the
+// instanced splats. The vertex buffer must be bound.
+void setSampleAttributes(QOpenGLExtraFunctions* f, bool isInstanced) {
+    f->glEnableVertexAttribArray(SAMPLE_POSITION_LOC);
+    f->glEnableVertexAttribArray(SAMPLE_NORMAL_LOC);
+    f->glEnableVertexAttribArray(SAMPLE_TEXCOORD_LOC);
+    f->glEnableVertexAttribArray(SAMPLE_RADIUS_LOC);
+    f->glVertexAttribPointer(SAMPLE_POSITION_LOC, 3, GL_UNSIGNED_SHORT, GL_TRUE,  sizeof(PackedSample), (void*)0);
+    f->glVertexAttribPointer(SAMPLE_RADIUS_LOC,   1, GL_HALF_FLOAT,     GL_FALSE, sizeof(PackedSample), (void*)6);
+    f->glVertexAttribPointer(SAMPLE_NORMAL_LOC,   2, GL_SHORT,          GL_TRUE,  sizeof(PackedSample), (void*)8);
+    f->glVertexAttribPointer(SAMPLE_TEXCOORD_LOC, 2, GL_HALF_FLOAT,     GL_FALSE, sizeof(PackedSample), (void*)12);
+    if (isInstanced) {
+        f->glVertexAttribDivisor(SAMPLE_POSITION_LOC, 1);
+        f->glVertexAttribDivisor(SAMPLE_NORMAL_LOC,   1);
+        f->glVertexAttribDivisor(SAMPLE_TEXCOORD_LOC, 1);
+        f->glVertexAttribDivisor(SAMPLE_RADIUS_LOC,   1);
     }
 }
 
+// Depth buffer which is also sampled by the shaders. The stencil is added
+// for the buffers whose stencil is copied to the splat buffers.
+std::unique_ptr<QOpenGLTexture> createDepthTexture(int width, int height, bool isStencil) {
+    auto texture = std::make_unique<QOpenGLTexture>(QOpenGLTexture::Target2D);
+    texture->setFormat(isStencil ? QOpenGLTexture::D24S8 : QOpenGLTexture::D32F);
+    texture->setSize(width, height);
+    texture->setMinificationFilter(QOpenGLTexture::Filter::Nearest);
+    texture->setMagnificationFilter(QOpenGLTexture::Filter::Nearest);
+    texture->setWrapMode(QOpenGLTexture::WrapMode::ClampToEdge);
+    if (isStencil) {
+        texture->allocateStorage(QOpenGLTexture::DepthStencil, QOpenGLTexture::UInt32_D24S8);
+    } else {
+        texture->allocateStorage(QOpenGLTexture::Depth, QOpenGLTexture::Float32);
+    }
+    return texture;
+}
+
 }  // anonymous namespace
 
 OpenGLViewer::OpenGLViewer(QWidget* parent)
@@ -105,34 +145,154 @@ OpenGLViewer::OpenGLViewer(QWidget* parent)
     vMat.lookAt(QVector3D(0.0f, 0.0f, 3.0f), QVector3D(0.0f, 0.0f, 0.0f), QVector3D(0.0f, 0.1f, 0.0f));
     arcball->initModelView(mMat,vMat);
 
+    // Frames are rendered when the scheduler asks for them, rather than
+    // continuously. The first one follows the widget being shown.
     timer = std::make_unique<QTimer>(this);
+    timer->setSingleShot(true);
+    timer->setTimerType(Qt::PreciseTimer);
     connect(timer.get(), SIGNAL(timeout()), this, SLOT(OnAnimate()));
+    connect(this, SIGNAL(frameSwapped()), this, SLOT(OnFrameSwapped()));
 
-    timer->start(0);
+    mtrlLibrary.load(std::string(DATA_DIRECTORY) + "materials.txt");
+    materialIndex = std::max(0, mtrlLibrary.find("Milk"));
 }
 
 OpenGLViewer::~OpenGLViewer() {
+    makeCurrent();
+    auto f = QOpenGLContext::currentContext()->extraFunctions();
+    if (materialUBO != 0) {
+        f->glDeleteBuffers(1, &materialUBO);
+    }
+    if (fragmentQuery != 0) {
+        f->glDeleteQueries(1, &fragmentQuery);
+    }
+    computeGather.reset();
+    sampleCuller.reset();
+    frameGraph.reset();
+    gbufReadback.reset();
+    doneCurrent();
 }
 
 void OpenGLViewer::setMaterial(const std::string& mtrlName) {
-    if (mtrlName == "Milk") {
-        sigma_a  = QVector3D(0.0015333, 0.0046, 0.019933);
-        sigmap_s = QVector3D(4.5513   , 5.8294, 7.136   );
-        eta      = 1.3f;            
-    } else if (mtrlName == "Skin") {
-        sigma_a  = QVector3D(0.061, 0.97, 1.45);
-        sigmap_s = QVector3D(0.18, 0.07, 0.03);
-        eta      = 1.3f;
+    const int index = mtrlLibrary.find(mtrlName);
+    if (index >= 0 && index != materialIndex) {
+        materialIndex = index;
+        requestFrame();
     }
 }
 
 void OpenGLViewer::setMaterialScale(double scale) {
     mtrlScale = static_cast<float>(scale);
+    isProfileDirty = true;
+    requestFrame();
 }
 
 void OpenGLViewer::setRenderComponents(bool isRef, bool isTrans) {
     isRenderRefl = isRef;
     isRenderTrans = isTrans;
+    requestFrame();
+}
+
+void OpenGLViewer::setDynamicLight(bool isDynamic) {
+    isDynamicLight = isDynamic;
+    isLightDragging = false;
+}
+
+void OpenGLViewer::setLightBufferSize(int size) {
+    if (size > GBUF_TILE_SIZE) {
+        size = (size + GBUF_TILE_SIZE - 1) / GBUF_TILE_SIZE * GBUF_TILE_SIZE;
+    }
+
+    // The tiles of the larger buffers zoom into the light view, so that the
+    // samples are made finer instead of more at the same size.
+    if (size != gbufSize) {
+        gbufSize = size;
+        hierarchyParams.texelScale = static_cast<double>(GBUF_TILE_SIZE) / gbufSize;
+        isGBufferDirty = true;
+        requestFrame();
+    }
+}
+
+void OpenGLViewer::setSampleBudget(int budget) {
+    budget = std::max(0, budget);
+    if (budget != hierarchyParams.budget) {
+        hierarchyParams.budget = budget;
+        isGBufferDirty = true;
+        requestFrame();
+    }
+}
+
+void OpenGLViewer::setViewDependentCut(bool isEnabled) {
+    if (isEnabled == isViewCut) {
+        return;
+    }
+
+    // The samples are built again, with or without the tree.
+    isViewCut = isEnabled;
+    sampleTree.reset();
+    if (sampleBuilder) {
+        sampleBuilder->setTreeEnabled(isEnabled);
+    }
+    isGBufferDirty = true;
+    requestFrame();
+}
+
+void OpenGLViewer::setInstancedSplats(bool isEnabled) {
+    isInstancedSplat = isEnabled;
+    requestFrame();
+}
+
+void OpenGLViewer::setSplatEpsilon(double epsilon) {
+    if (epsilon > 0.0) {
+        splatEpsilon = static_cast<float>(epsilon);
+        isProfileDirty = true;
+        requestFrame();
+    }
+}
+
+void OpenGLViewer::setEarlyRejection(bool isEnabled) {
+    isEarlyRejection = isEnabled;
+    requestFrame();
+}
+
+void OpenGLViewer::setMultiresSplats(bool isEnabled) {
+    isMultiresSplat = isEnabled;
+    requestFrame();
+}
+
+void OpenGLViewer::setTranslucencyScale(int scale) {
+    transScale = std::max(1, scale);
+    requestFrame();
+}
+
+void OpenGLViewer::setDipoleMode(DipoleMode mode) {
+    dipoleMode = mode;
+    requestFrame();
+}
+
+void OpenGLViewer::setComputeGather(bool isEnabled) {
+    isComputeGather = isEnabled;
+    requestFrame();
+}
+
+void OpenGLViewer::setSampleCulling(bool isEnabled) {
+    isSampleCulling = isEnabled;
+    requestFrame();
+}
+
+void OpenGLViewer::setFrameMode(FrameMode mode) {
+    frameScheduler.setMode(mode);
+    requestFrame();
+}
+
+void OpenGLViewer::setTargetFrameRate(double framesPerSecond) {
+    frameScheduler.setTargetRate(framesPerSecond);
+    requestFrame();
+}
+
+void OpenGLViewer::setLoadLimit(double loadLimit) {
+    frameScheduler.setLoadLimit(loadLimit);
+    requestFrame();
 }
 
 void OpenGLViewer::initializeGL() {
@@ -153,6 +313,15 @@ void OpenGLViewer::initializeGL() {
     }
     const int nVerts = shapes[0].mesh.positions.size() / 3;
 
+    // The mesh is a part of the key of the sample cache.
+    const tinyobj::mesh_t& mesh = shapes[0].mesh;
+    QCryptographicHash meshHasher(QCryptographicHash::Sha1);
+    meshHasher.addData(reinterpret_cast<const char*>(&mesh.positions[0]), sizeof(float) * mesh.positions.size());
+    meshHasher.addData(reinterpret_cast<const char*>(&mesh.normals[0]), sizeof(float) * mesh.normals.size());
+    meshHasher.addData(reinterpret_cast<const char*>(&mesh.texcoords[0]), sizeof(float) * mesh.texcoords.size());
+    meshHasher.addData(reinterpret_cast<const char*>(&mesh.indices[0]), sizeof(unsigned int) * mesh.indices.size());
+    meshHash = meshHasher.result();
+
     // Initialize VAO.
     vao = std::make_unique<QOpenGLVertexArrayObject>(this);
     vao->create();
@@ -183,6 +352,18 @@ void OpenGLViewer::initializeGL() {
 
     vao->release();
 
+    // Samples lie on the mesh, so that their positions are quantized to its bounds.
+    QVector3D boundsMin( 1.0e20f,  1.0e20f,  1.0e20f);
+    QVector3D boundsMax(-1.0e20f, -1.0e20f, -1.0e20f);
+    for (int i = 0; i < nVerts; i++) {
+        for (int k = 0; k < 3; k++) {
+            boundsMin[k] = std::min(boundsMin[k], shapes[0].mesh.positions[i * 3 + k]);
+            boundsMax[k] = std::max(boundsMax[k], shapes[0].mesh.positions[i * 3 + k]);
+        }
+    }
+    sampleBounds.origin = boundsMin;
+    sampleBounds.extent = boundsMax - boundsMin;
+
     // Initialize texture.
     QImage texImage;
     texImage.load(QString(DATA_DIRECTORY) + "wood.jpg");
@@ -194,8 +375,8 @@ void OpenGLViewer::initializeGL() {
 
     // Initialize shaders.
     shader = std::make_unique<QOpenGLShaderProgram>(this);
-    shader->addShaderFromSourceFile(QOpenGLShader::Vertex, QString(SHADER_DIRECTORY) + "render.vs");
-    shader->addShaderFromSourceFile(QOpenGLShader::Fragment, QString(SHADER_DIRECTORY) + "render.fs");
+    addShaderFromFile(*shader, QOpenGLShader::Vertex, QString(SHADER_DIRECTORY) + "fullscreen.vs");
+    addShaderFromFile(*shader, QOpenGLShader::Fragment, QString(SHADER_DIRECTORY) + "render.fs");
     shader->link();
     if (!shader->isLinked()) {
         std::cerr << "Failed to link shader files!!" << std::endl;
@@ -203,153 +384,726 @@ void OpenGLViewer::initializeGL() {
     }
 
     dipoleShader = std::make_unique<QOpenGLShaderProgram>(this);
-    dipoleShader->addShaderFromSourceFile(QOpenGLShader::Vertex, QString(SHADER_DIRECTORY) + "dipole.vs");
-    dipoleShader->addShaderFromSourceFile(QOpenGLShader::Geometry, QString(SHADER_DIRECTORY) + "dipole.gs");
-    dipoleShader->addShaderFromSourceFile(QOpenGLShader::Fragment, QString(SHADER_DIRECTORY) + "dipole.fs");
+    addShaderFromFile(*dipoleShader, QOpenGLShader::Vertex, QString(SHADER_DIRECTORY) + "dipole.vs");
+    addShaderFromFile(*dipoleShader, QOpenGLShader::Geometry, QString(SHADER_DIRECTORY) + "dipole.gs");
+    addShaderFromFile(*dipoleShader, QOpenGLShader::Fragment, QString(SHADER_DIRECTORY) + "dipole.fs");
     dipoleShader->link();
     if (!dipoleShader->isLinked()) {
         std::cerr << "Failed to link shader files!!" << std::endl;
         std::exit(1);
     }
 
+    dipoleInstancedShader = std::make_unique<QOpenGLShaderProgram>(this);
+    addShaderFromFile(*dipoleInstancedShader, QOpenGLShader::Vertex, QString(SHADER_DIRECTORY) + "dipole_instanced.vs");
+    addShaderFromFile(*dipoleInstancedShader, QOpenGLShader::Fragment, QString(SHADER_DIRECTORY) + "dipole.fs");
+    dipoleInstancedShader->link();
+    if (!dipoleInstancedShader->isLinked()) {
+        std::cerr << "Failed to link shader files!!" << std::endl;
+        std::exit(1);
+    }
+
+    multiresShader = std::make_unique<QOpenGLShaderProgram>(this);
+    addShaderFromFile(*multiresShader, QOpenGLShader::Vertex, QString(SHADER_DIRECTORY) + "fullscreen.vs");
+    addShaderFromFile(*multiresShader, QOpenGLShader::Fragment, QString(SHADER_DIRECTORY) + "multires.fs");
+    multiresShader->link();
+    if (!multiresShader->isLinked()) {
+        std::cerr << "Failed to link shader files!!" << std::endl;
+        std::exit(1);
+    }
+
+    // Full-screen passes have no vertex attributes.
+    screenVAO = std::make_unique<QOpenGLVertexArrayObject>(this);
+    screenVAO->create();
+
+    // Passes of every frame, whose screen buffers are pooled.
+    frameGraph = std::make_unique<FrameGraph>();
+
     gbufShader = std::make_unique<QOpenGLShaderProgram>(this);
-    gbufShader->addShaderFromSourceFile(QOpenGLShader::Vertex, QString(SHADER_DIRECTORY) + "gbuffers.vs");
-    gbufShader->addShaderFromSourceFile(QOpenGLShader::Fragment, QString(SHADER_DIRECTORY) + "gbuffers.fs");
+    addShaderFromFile(*gbufShader, QOpenGLShader::Vertex, QString(SHADER_DIRECTORY) + "gbuffers.vs");
+    addShaderFromFile(*gbufShader, QOpenGLShader::Fragment, QString(SHADER_DIRECTORY) + "gbuffers.fs");
     gbufShader->link();
     if (!gbufShader->isLinked()) {
         std::cerr << "Failed to link shader files!!" << std::endl;
         std::exit(1);
     }
 
+    // Constants of all the materials in one buffer, where each material is
+    // selected by binding its range to the "Material" block.
+    GLint alignment = 0;
+    glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+    alignment = std::max(alignment, 1);
+    materialStride = (MaterialLibrary::blockSize + alignment - 1) / alignment * alignment;
+
+    const std::vector<unsigned char> blocks = mtrlLibrary.uniformBlocks(materialStride);
+    f->glGenBuffers(1, &materialUBO);
+    f->glBindBuffer(GL_UNIFORM_BUFFER, materialUBO);
+    f->glBufferData(GL_UNIFORM_BUFFER, blocks.size(), blocks.data(), GL_STATIC_DRAW);
+    f->glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+    for (QOpenGLShaderProgram* program : { dipoleShader.get(), dipoleInstancedShader.get() }) {
+        const GLuint blockIndex = f->glGetUniformBlockIndex(program->programId(), "Material");
+        f->glUniformBlockBinding(program->programId(), blockIndex, MATERIAL_BLOCK_BINDING);
+    }
+
+    sampleBuilder = std::make_unique<SampleBuilder>(sampleBounds, CACHE_DIRECTORY);
+    sampleCache = std::make_unique<SampleCache>(CACHE_DIRECTORY);
+
+    // Min/max depth can be taken in a single pass when image atomics are available.
+    QOpenGLContext* context = QOpenGLContext::currentContext();
+    if (context->format().version() >= qMakePair(4, 2) ||
+        context->hasExtension("GL_ARB_shader_image_load_store")) {
+        gbufRangeShader = std::make_unique<QOpenGLShaderProgram>(this);
+        addShaderFromFile(*gbufRangeShader, QOpenGLShader::Vertex, QString(SHADER_DIRECTORY) + "gbuffers.vs");
+        addShaderFromFile(*gbufRangeShader, QOpenGLShader::Fragment, QString(SHADER_DIRECTORY) + "gbuffers_range.fs");
+        gbufRangeShader->link();
+        if (!gbufRangeShader->isLinked()) {
+            std::cerr << "Failed to link shader files, use two passes for min/max depth." << std::endl;
+            gbufRangeShader.reset();
+        }
+    }
+
+    // The translucency can be gathered by compute shaders on OpenGL 4.3.
+    if (ComputeGather::isSupported()) {
+        computeGather = std::make_unique<ComputeGather>(QString(SHADER_DIRECTORY), MATERIAL_BLOCK_BINDING);
+        if (!computeGather->isValid()) {
+            std::cerr << "Failed to link compute shaders, the gather path is disabled." << std::endl;
+            computeGather.reset();
+        }
+    }
+
+    // Samples are culled on the GPU and drawn indirectly on OpenGL 4.3.
+    if (SampleCuller::isSupported()) {
+        sampleCuller = std::make_unique<SampleCuller>(QString(SHADER_DIRECTORY));
+        if (!sampleCuller->isValid()) {
+            std::cerr << "Failed to link compute shaders, the samples are not culled." << std::endl;
+            sampleCuller.reset();
+        }
+    }
+
     // Compute hierarchical irradiance samples.
     calcGBuffers();
 }
 
 void OpenGLViewer::resizeGL(int width, int height) {
+    // The screen buffers are taken from the pool of the frame graph at the
+    // size of the next frame, so that nothing is allocated on every event.
     glViewport(0, 0, this->width(), this->height());
-
-    // FBOs for G-buffers.
-    deferFbo = std::make_unique<QOpenGLFramebufferObject>(this->width(), this->height(),
-        QOpenGLFramebufferObject::Attachment::Depth, GL_TEXTURE_2D, GL_RGBA32F);
-    deferFbo->addColorAttachment(this->width(), this->height(), GL_RGBA32F);
-    deferFbo->addColorAttachment(this->width(), this->height(), GL_RGBA32F);
-    deferFbo->addColorAttachment(this->width(), this->height(), GL_RGBA32F);
-
-    // FBO for translucent component.
-    dipoleFbo = std::make_unique<QOpenGLFramebufferObject>(this->width(), this->height(),
-        QOpenGLFramebufferObject::Attachment::Depth, GL_TEXTURE_2D, GL_RGBA32F);
 }
 
 void OpenGLViewer::paintGL() {
+    frameScheduler.beginFrame();
+
+    // Render the G-buffers again for the moved light or the new buffer size.
+    if (isGBufferDirty) {
+        isGBufferDirty = false;
+        calcGBuffers();
+    }
+
+    // Take the irradiance samples built in the background, if any.
+    updateSamples();
+
     QMatrix4x4 mMat, vMat, pMat;
     mMat = arcball->modelMat();
     vMat = arcball->viewMat();
-    pMat.perspective(45.0f, (float)width() / height(), 1.0f, 1000.0f);
+    pMat.perspective(45.0f, (float)width() / height(), CAMERA_NEAR, CAMERA_FAR);
     QMatrix4x4 mvMat = vMat * mMat;
     QMatrix4x4 mvpMat = pMat * mvMat;
 
-    // Compute deferred shading buffers.
+    // The splat sizes are updated before the cut, which is refined by them.
+    if (isProfileDirty) {
+        updateProfiles();
+    }
+
+    // Select the samples for the current camera.
+    if (isViewCut && sampleTree) {
+        updateCut(mvpMat, mvMat, pMat);
+    }
+
+    // The gather whose list of the tile samples has overflowed is redone
+    // by the changed capacity in the inputs of its pass.
+    if (computeGather) {
+        computeGather->pollTileSamples();
+    }
+
+    // Passes of the frame with the targets they read and write. The passes
+    // whose results are not shown, such as the translucency switched off,
+    // are culled by the frame graph, and those whose inputs have not changed
+    // are skipped, so that the results of an earlier frame are shown.
+    ScreenTargets& targets = screenTargets;
+    targets = ScreenTargets();
+
+    // Deferred shading buffers. The texcoords of the shader are only needed
+    // for the light buffers, and are dropped without a second attachment.
+    frameGraph->addPass("gbuffers", [&](FrameGraph::Builder& builder) {
+        targets.normal = builder.createPersistent("normal", { width(), height(), GL_RG16 });
+        builder.attach(targets.normal);
+        targets.depth = builder.createPersistent("depth", { width(), height(), GL_DEPTH24_STENCIL8 });
+        builder.attach(targets.depth);
+        builder.setInputs(PassInputs().addData(mvpMat.constData(), sizeof(float) * 16));
+    }, [this, mvpMat](const FrameGraph::Resources& res) {
+        renderScreenGBuffers(res, mvpMat);
+    });
+
+    // Translucent part, which may be rendered at a reduced resolution. It
+    // depends on the camera, the light, the material and the samples besides
+    // the G-buffers, but not on the reflection and the switches of the
+    // final composition.
+    const int transWidth  = std::max(1, width() / transScale);
+    const int transHeight = std::max(1, height() / transScale);
+    PassInputs transInputs;
+    transInputs.addData(mvpMat.constData(), sizeof(float) * 16)
+               .addData(mvMat.constData(), sizeof(float) * 16)
+               .add(lightPos)
+               .add(materialIndex)
+               .add(mtrlScale)
+               .add(splatEpsilon)
+               .add(dipoleMode)
+               .add(sampleSetVersion)
+               .add(isInstancedSplat)
+               .add(isMultiresSplat)
+               .add(isEarlyRejection)
+               .add(isSampleCulling)
+               .add(computeGather ? computeGather->capacityVersion() : 0);
+
+    if (isComputeGather && computeGather) {
+        // The compute gather replaces the splatting as a whole.
+        frameGraph->addPass("gather", [&](FrameGraph::Builder& builder) {
+            targets.trans = builder.createPersistent("trans", { transWidth, transHeight, GL_RGBA32F });
+            builder.read(targets.depth);
+            builder.write(targets.trans);
+            builder.setInputs(transInputs);
+        }, [this, mvpMat](const FrameGraph::Resources& res) {
+            gatherTranslucency(res, mvpMat);
+        });
+    } else {
+        // Splats are expanded either by the geometry shader or by instancing
+        // a quad. The coarser levels of the multiresolution splatting are
+        // splatted into their own buffers, and the coverage is copied to the
+        // stencil of every buffer for the early rejection. The levels are
+        // combined in the same pass, so that the pass writes the translucency
+        // as a whole when it is run.
+        frameGraph->addPass("splat", [&](FrameGraph::Builder& builder) {
+            targets.trans = builder.createPersistent("trans", { transWidth, transHeight, GL_RGBA32F });
+            builder.read(targets.depth);
+            builder.attach(targets.trans);
+            builder.setInputs(transInputs);
+            if (isEarlyRejection) {
+                targets.transStencil = builder.create({ transWidth, transHeight, GL_DEPTH24_STENCIL8 });
+                builder.attach(targets.transStencil);
+            }
+
+            if (isMultiresSplat) {
+                builder.read(targets.normal);
+                for (int s = 1; s < MULTIRES_LEVELS; s++) {
+                    const int levelWidth  = std::max(1, transWidth >> s);
+                    const int levelHeight = std::max(1, transHeight >> s);
+                    targets.levels.push_back(builder.create({ levelWidth, levelHeight, GL_RGBA32F }));
+                    builder.write(targets.levels.back());
+
+                    targets.levelStencils.push_back(INVALID_TARGET);
+                    if (isEarlyRejection) {
+                        targets.levelStencils.back() = builder.create({ levelWidth, levelHeight, GL_DEPTH24_STENCIL8 });
+                        builder.write(targets.levelStencils.back());
+                    }
+                }
+            }
+        }, [this, mvpMat, mvMat](const FrameGraph::Resources& res) {
+            splatTranslucency(res, mvpMat, mvMat);
+        });
+    }
+
+    // Main rendering to the screen.
+    frameGraph->addPass("shade", [&](FrameGraph::Builder& builder) {
+        if (isRenderTrans) {
+            builder.read(targets.trans);
+        }
+        builder.read(targets.depth);
+        builder.read(targets.normal);
+        builder.markOutput();
+    }, [this, mvpMat, mvMat](const FrameGraph::Resources& res) {
+        shadeGBuffers(res, mvpMat, mvMat);
+    });
+
+    frameGraph->execute(defaultFramebufferObject(), width(), height());
+
+    readFragmentQuery();
+
+    // Frames keep polling the G-buffers being read back, the samples being
+    // built in the background, the fragment count and the count of the
+    // gather.
+    const bool isBusy = (gbufReadback && gbufReadback->isPending()) || gbufTile >= 0 ||
+                        (sampleBuilder && sampleBuilder->isBusy()) ||
+                        (computeGather && computeGather->isPending()) ||
+                        isQueryPending;
+    frameScheduler.endFrame(isBusy);
+    if (frameScheduler.mode() != FrameMode::VSync) {
+        scheduleFrame();
+    }
+}
+
+void OpenGLViewer::requestFrame() {
+    frameScheduler.requestFrame();
+    scheduleFrame();
+}
+
+void OpenGLViewer::scheduleFrame() {
+    const int delay = frameScheduler.nextFrameDelay();
+    if (delay < 0) {
+        timer->stop();
+        return;
+    }
+
+    // An earlier frame already scheduled is kept.
+    if (!timer->isActive() || timer->remainingTime() > delay) {
+        timer->start(delay);
+    }
+}
+
+void OpenGLViewer::renderScreenGBuffers(const FrameGraph::Resources& res, const QMatrix4x4& mvpMat) {
     gbufShader->bind();
-    deferFbo->bind();
     vao->bind();
 
     gbufShader->setUniformValue("uMVPMat", mvpMat);
-    gbufShader->setUniformValue("isMaxDepth", 0);
 
-    auto f = QOpenGLContext::currentContext()->extraFunctions();
-    GLenum bufs[] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1, GL_COLOR_ATTACHMENT2, GL_COLOR_ATTACHMENT3 };
-    f->glDrawBuffers(4, bufs);
-
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    // Pixels covered by the mesh are marked in the stencil, and by the
+    // depth less than the cleared one for the other passes.
+    glEnable(GL_STENCIL_TEST);
+    glStencilFunc(GL_ALWAYS, 1, 0xff);
+    glStencilOp(GL_KEEP, GL_KEEP, GL_REPLACE);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
 
     glDrawElements(GL_TRIANGLES, iBuffer->size() / sizeof(unsigned int), GL_UNSIGNED_INT, 0);
 
+    glDisable(GL_STENCIL_TEST);
     gbufShader->release();
-    deferFbo->release();
     vao->release();
 
     #if DEBUG_MODE
-    deferFbo->toImage(true, 1).save(QString(OUTPUT_DIRECTORY) + "position.png");
-    deferFbo->toImage(true, 2).save(QString(OUTPUT_DIRECTORY) + "normal.png");
-    deferFbo->toImage(true, 3).save(QString(OUTPUT_DIRECTORY) + "texcoord.png");
+    saveTexture(std::string(OUTPUT_DIRECTORY) + "normal.png", res.texture(screenTargets.normal), width(), height());
     #endif
+}
+
+void OpenGLViewer::shadeGBuffers(const FrameGraph::Resources& res, const QMatrix4x4& mvpMat, const QMatrix4x4& mvMat) {
+    // The translucency is not rendered when it is switched off, and the
+    // result of an earlier frame is not bound then.
+    const GLuint transMap = isRenderTrans ? res.texture(screenTargets.trans) : 0;
 
-    // Translucent part.
-    dipoleShader->bind();
-    dipoleFbo->bind();
-    sampleVAO->bind();
+    #if DEBUG_MODE
+    if (transMap != 0) {
+        const TargetDesc& desc = res.desc(screenTargets.trans);
+        saveTexture(std::string(OUTPUT_DIRECTORY) + "dipole.png", transMap, desc.width, desc.height);
+    }
+    #endif
 
+    // The G-buffers of the mesh are shaded instead of rasterizing the mesh
+    // again.
+    shader->bind();
+
+    auto f = QOpenGLContext::currentContext()->extraFunctions();
     f->glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, deferFbo->textures()[1]);
+    glBindTexture(GL_TEXTURE_2D, transMap);
     f->glActiveTexture(GL_TEXTURE1);
-    glBindTexture(GL_TEXTURE_2D, deferFbo->textures()[2]);
+    glBindTexture(GL_TEXTURE_2D, res.texture(screenTargets.depth));
     f->glActiveTexture(GL_TEXTURE2);
-    glBindTexture(GL_TEXTURE_2D, deferFbo->textures()[3]);
+    glBindTexture(GL_TEXTURE_2D, res.texture(screenTargets.normal));
+    shader->setUniformValue("uTransMap", 0);
+    shader->setUniformValue("uDepthMap", 1);
+    shader->setUniformValue("uNormalMap", 2);
+    shader->setUniformValue("uTransScale", transScale);
+    shader->setUniformValue("uDepthRange", QVector2D(CAMERA_NEAR, CAMERA_FAR));
+
+    // Sizes of the targets, whose textures may be larger.
+    const TargetDesc& depthDesc = res.desc(screenTargets.depth);
+    const TargetDesc& transDesc = transMap != 0 ? res.desc(screenTargets.trans) : depthDesc;
+    f->glUniform2i(shader->uniformLocation("uScreenSize"), depthDesc.width, depthDesc.height);
+    f->glUniform2i(shader->uniformLocation("uTransSize"), transDesc.width, transDesc.height);
+
+    shader->setUniformValue("uInvMVPMat", mvpMat.inverted());
+    shader->setUniformValue("uMVMat", mvMat);
+    shader->setUniformValue("uNormalMat", mvMat.normalMatrix());
+    shader->setUniformValue("uLightPos", mvMat.map(lightPos));
 
-    dipoleShader->setUniformValue("uPositionMap", 0);
-    dipoleShader->setUniformValue("uNormalMap",   1);
-    dipoleShader->setUniformValue("uTexCoordMap", 2);
+    shader->setUniformValue("refFactor", isRenderRefl ? 1.0f : 0.0f);
+    shader->setUniformValue("transFactor", isRenderTrans ? 1.0f : 0.0f);
 
-    dipoleShader->setUniformValue("uMVPMat", mvpMat);
-    dipoleShader->setUniformValue("uMVMat", mvMat);
-    dipoleShader->setUniformValue("uLightPos", lightPos);
+    glDisable(GL_DEPTH_TEST);
+    screenVAO->bind();
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+    screenVAO->release();
+    glEnable(GL_DEPTH_TEST);
 
-    dipoleShader->setUniformValue("sigma_a", sigma_a * mtrlScale);
-    dipoleShader->setUniformValue("sigmap_s", sigmap_s * mtrlScale);
-    dipoleShader->setUniformValue("eta", eta);
+    shader->release();
+}
 
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+void OpenGLViewer::gatherTranslucency(const FrameGraph::Resources& res, const QMatrix4x4& mvpMat) {
+    auto f = QOpenGLContext::currentContext()->extraFunctions();
+    f->glBindBufferRange(GL_UNIFORM_BUFFER, MATERIAL_BLOCK_BINDING, materialUBO,
+                         materialIndex * materialStride, MaterialLibrary::blockSize);
+
+    const MaterialProfile& profile = mtrlProfiles[materialIndex];
+    GatherParams params;
+    params.mvpMat = mvpMat;
+    params.lightPos = lightPos;
+    params.sampleBuffer = sampleVAO ? sampleVBuf->bufferId() : 0;
+    params.numSamples = sampleVAO ? numPackedSamples : 0;
+    params.bounds = sampleBounds;
+    params.depthMap = res.texture(screenTargets.depth);
+    params.depthWidth = res.desc(screenTargets.depth).width;
+    params.depthHeight = res.desc(screenTargets.depth).height;
+    params.profileMap = profile.texture->textureId();
+    params.profileMaxDist = profile.profile->maxDist();
+    params.dipoleMode = static_cast<int>(dipoleMode);
+    params.mtrlScale = mtrlScale;
+    params.supports = profile.supports.data();
+    params.numSupports = SUPPORT_LEVELS;
+    params.target = res.texture(screenTargets.trans);
+    params.width = res.desc(screenTargets.trans).width;
+    params.height = res.desc(screenTargets.trans).height;
+    computeGather->gather(params);
+}
 
-    glDisable(GL_DEPTH_TEST);
-    glEnable(GL_BLEND);
-    glBlendFunc(GL_ONE, GL_ONE);
-    glDrawElements(GL_POINTS, sampleIBuf->size() / sizeof(unsigned int), GL_UNSIGNED_INT, 0);
-    glDisable(GL_BLEND);
-    glBlendFunc(GL_ONE, GL_ZERO);
-    glEnable(GL_DEPTH_TEST);
+void OpenGLViewer::splatTranslucency(const FrameGraph::Resources& res, const QMatrix4x4& mvpMat, const QMatrix4x4& mvMat) {
+    // The multiresolution splatting draws the ranges of the sample levels
+    // through the index buffer, so that it always uses the geometry shader.
+    const bool isInstanced = isInstancedSplat && !isMultiresSplat;
+    QOpenGLShaderProgram* splatShader = isInstanced ? dipoleInstancedShader.get() : dipoleShader.get();
 
-    dipoleShader->release();
-    dipoleFbo->release();
-    sampleVAO->release();
+    // The survivors of the culling are drawn by the commands on the GPU.
+    const bool isCulled = isSampleCulling && sampleCuller && culledSampleVAO;
+    if (isCulled) {
+        cullSamples(res, mvpMat);
+    }
 
-    #if DEBUG_MODE
-    dipoleFbo->toImage().save(QString(OUTPUT_DIRECTORY) + "dipole.png");
-    #endif
+    // The coverage is copied to the stencil of the splat buffers, where the
+    // nearest texel is the one whose position the dipole pass reads. The
+    // finest buffer is bound by the frame graph, and bound again after it.
+    const ScreenTargets& targets = screenTargets;
+    auto f = QOpenGLContext::currentContext()->extraFunctions();
+    if (isEarlyRejection) {
+        const TargetDesc& src = res.desc(targets.depth);
+        f->glBindFramebuffer(GL_READ_FRAMEBUFFER, res.framebuffer(INVALID_TARGET, targets.depth));
+        auto copyStencil = [&](TargetHandle color, TargetHandle stencil) {
+            const TargetDesc& dst = res.desc(stencil);
+            f->glBindFramebuffer(GL_DRAW_FRAMEBUFFER, res.framebuffer(color, stencil));
+            f->glBlitFramebuffer(0, 0, src.width, src.height, 0, 0, dst.width, dst.height,
+                                 GL_STENCIL_BUFFER_BIT, GL_NEAREST);
+        };
+        copyStencil(targets.trans, targets.transStencil);
+        for (size_t i = 0; i < targets.levels.size(); i++) {
+            copyStencil(targets.levels[i], targets.levelStencils[i]);
+        }
+        f->glBindFramebuffer(GL_FRAMEBUFFER, res.framebuffer(targets.trans, targets.transStencil));
+    }
 
-    // Main rendering.
-    shader->bind();
-    vao->bind();
+    splatShader->bind();
 
     f->glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, dipoleFbo->texture());
-    shader->setUniformValue("uTransMap", 0);
+    glBindTexture(GL_TEXTURE_2D, res.texture(targets.depth));
+    splatShader->setUniformValue("uDepthMap", 0);
+    f->glUniform2i(splatShader->uniformLocation("uScreenSize"), res.desc(targets.depth).width, res.desc(targets.depth).height);
+    splatShader->setUniformValue("uInvMVPMat", mvpMat.inverted());
+
+    splatShader->setUniformValue("uMVPMat", mvpMat);
+    splatShader->setUniformValue("uMVMat", mvMat);
+    splatShader->setUniformValue("uLightPos", lightPos);
+    splatShader->setUniformValue("uSampleOrigin", sampleBounds.origin);
+    splatShader->setUniformValue("uSampleExtent", sampleBounds.extent);
+
+    const MaterialProfile& profile = mtrlProfiles[materialIndex];
+    f->glBindBufferRange(GL_UNIFORM_BUFFER, MATERIAL_BLOCK_BINDING, materialUBO,
+                         materialIndex * materialStride, MaterialLibrary::blockSize);
+    splatShader->setUniformValue("uMtrlScale", mtrlScale);
+    splatShader->setUniformValueArray("uSupport", profile.supports.data(), SUPPORT_LEVELS, 1);
+
+    f->glActiveTexture(GL_TEXTURE3);
+    profile.texture->bind();
+    splatShader->setUniformValue("uProfileMap", 3);
+    splatShader->setUniformValue("uProfileMaxDist", profile.profile->maxDist());
+    splatShader->setUniformValue("uDipoleMode", static_cast<int>(dipoleMode));
+    splatShader->setUniformValue("uSupportCull", isEarlyRejection ? 1 : 0);
 
-    shader->setUniformValue("uMVPMat", mvpMat);
-    shader->setUniformValue("uMVMat", mvMat);
-    shader->setUniformValue("uLightPos", lightPos);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-    shader->setUniformValue("refFactor", isRenderRefl ? 1.0f : 0.0f);
-    shader->setUniformValue("transFactor", isRenderTrans ? 1.0f : 0.0f);
+    // Samples are not available until the first readback finishes.
+    if (sampleVAO) {
+        glDisable(GL_DEPTH_TEST);
+        glEnable(GL_BLEND);
+        glBlendFunc(GL_ONE, GL_ONE);
+        if (isEarlyRejection) {
+            glEnable(GL_STENCIL_TEST);
+            glStencilFunc(GL_EQUAL, 1, 0xff);
+            glStencilOp(GL_KEEP, GL_KEEP, GL_KEEP);
+        }
 
-    glDrawElements(GL_TRIANGLES, iBuffer->size() / sizeof(unsigned int), GL_UNSIGNED_INT, 0);
+        // Count the fragments of the splats, which are taken by
+        // "readFragmentQuery()" once the result is available.
+        if (!fragmentQuery) {
+            f->glGenQueries(1, &fragmentQuery);
+        }
+        const bool isCounting = !isQueryPending;
+        if (isCounting) {
+            f->glBeginQuery(GL_SAMPLES_PASSED, fragmentQuery);
+        }
 
-    shader->release();
-    vao->release();
+        if (isMultiresSplat) {
+            renderMultiresLevels(res, isCulled);
+        } else if (isCulled) {
+            f->glBindBuffer(GL_DRAW_INDIRECT_BUFFER, sampleCuller->commandBuffer());
+            if (isInstanced) {
+                culledSplatVAO->bind();
+                for (int s = 0; s < MULTIRES_LEVELS; s++) {
+                    f->glDrawArraysIndirect(GL_TRIANGLE_STRIP,
+                                            reinterpret_cast<void*>(SampleCuller::quadsCommandOffset(s)));
+                }
+                culledSplatVAO->release();
+            } else {
+                culledSampleVAO->bind();
+                for (int s = 0; s < MULTIRES_LEVELS; s++) {
+                    f->glDrawArraysIndirect(GL_POINTS,
+                                            reinterpret_cast<void*>(SampleCuller::pointsCommandOffset(s)));
+                }
+                culledSampleVAO->release();
+            }
+            f->glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+        } else if (isInstanced) {
+            splatVAO->bind();
+            f->glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, numPackedSamples);
+            splatVAO->release();
+        } else {
+            sampleVAO->bind();
+            glDrawArrays(GL_POINTS, 0, numPackedSamples);
+            sampleVAO->release();
+        }
+
+        if (isCounting) {
+            f->glEndQuery(GL_SAMPLES_PASSED);
+            isQueryPending = true;
+            queryRejection = isEarlyRejection;
+        }
+        glDisable(GL_STENCIL_TEST);
+
+        if (isMultiresSplat) {
+            combineMultiresLevels(res);
+        }
+        glDisable(GL_BLEND);
+        glBlendFunc(GL_ONE, GL_ZERO);
+        glEnable(GL_DEPTH_TEST);
+    }
+
+    splatShader->release();
+}
+
+void OpenGLViewer::readFragmentQuery() {
+    if (!isQueryPending) {
+        return;
+    }
+
+    // The result of an earlier frame is taken without waiting for the GPU.
+    auto f = QOpenGLContext::currentContext()->extraFunctions();
+    GLuint isAvailable = 0;
+    f->glGetQueryObjectuiv(fragmentQuery, GL_QUERY_RESULT_AVAILABLE, &isAvailable);
+    if (!isAvailable) {
+        return;
+    }
+
+    GLuint count = 0;
+    f->glGetQueryObjectuiv(fragmentQuery, GL_QUERY_RESULT, &count);
+    isQueryPending = false;
+    fragmentCounts[queryRejection ? 1 : 0] = count;
 }
 
 void OpenGLViewer::calcGBuffers() {
-    static const int bufSize = 1024;
-    if (!gbufFbo) {
-        gbufFbo = std::make_unique<QOpenGLFramebufferObject>(bufSize, bufSize,
-            QOpenGLFramebufferObject::Attachment::Depth, GL_TEXTURE_2D, GL_RGBA32F);
-        gbufFbo->addColorAttachment(bufSize, bufSize, GL_RGBA32F);
-        gbufFbo->addColorAttachment(bufSize, bufSize, GL_RGBA32F);
-        gbufFbo->addColorAttachment(bufSize, bufSize, GL_RGBA32F);
+    // Samples for the same mesh, light and parameters are mapped from the cache.
+    // The cache is not used while the light is moved. The tiles of an
+    // earlier pass are not streamed any more.
+    gbufTile = -1;
+
+    // The moving light keeps the light buffers of the anchor as long as it
+    // stays near, so that the buffers do not change, and only the tiles
+    // whose selection depends on the move are updated by the worker. The
+    // selection and the irradiance use the actual position.
+    const float anchorCos = QVector3D::dotProduct(gbufLightPos.normalized(), lightPos.normalized());
+    if (!isDynamicLight || anchorCos < LIGHT_ANCHOR_COS) {
+        gbufLightPos = lightPos;
+    }
+
+    gbufCacheKey = isDynamicLight || isViewCut ? std::string() : sampleCacheKey();
+    if (!gbufCacheKey.empty() && sampleCache->load(gbufCacheKey)) {
+        // The readback and the builds of the earlier requests in flight
+        // would replace the samples of the cache.
+        if (gbufReadback) {
+            gbufReadback->reset();
+        }
+        sampleBuilder->cancel();
+        allocateSamples(sampleCache->samples(), sampleCache->numSamples());
+        sampleCache->release();
+        return;
+    }
+
+    // The FBO holds one tile of the light buffers larger than a tile.
+    const int fboSize = std::min(gbufSize, GBUF_TILE_SIZE);
+    if (!gbufFbo || gbufReadback->width() != fboSize) {
+        gbufFbo = std::make_unique<QOpenGLFramebufferObject>(fboSize, fboSize,
+            QOpenGLFramebufferObject::Attachment::NoAttachment, GL_TEXTURE_2D, GL_RG16);
+        gbufFbo->addColorAttachment(fboSize, fboSize, GL_RG16F);
+        maxDepthTexture.reset();
+
+        // The minimum depth is read back from the depth buffer.
+        gbufDepthTexture = createDepthTexture(fboSize, fboSize, false);
+        auto f = QOpenGLContext::currentContext()->extraFunctions();
+        gbufFbo->bind();
+        f->glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D,
+                                  gbufDepthTexture->textureId(), 0);
+        gbufFbo->release();
+
+        gbufReadback = std::make_unique<GBufferReadback>(fboSize, fboSize, GBUF_NUM_IMAGES);
+    }
+
+    if (gbufSize > GBUF_TILE_SIZE) {
+        calcGBuffersTiled();
+    } else {
+        const QMatrix4x4 mvpMat = lightMVPMatrix();
+        renderGBuffers(gbufSize, mvpMat);
+
+        // The readback is completed asynchronously. "updateSamples()" passes the
+        // data to the worker thread once it arrives.
+        gbufReadback->submit(mvpMat);
+    }
+
+    // Revert viewport.
+    glViewport(0, 0, width(), height());
+}
+
+void OpenGLViewer::calcGBuffersTiled() {
+    // Drop the readbacks of the whole buffer or of an earlier pass in
+    // flight, if any. The tiles are rendered one per frame from here on by
+    // "streamGBufferTiles()".
+    gbufReadback->reset();
+    gbufTile = 0;
+    renderGBufferTile(gbufTile);
+}
+
+void OpenGLViewer::renderGBufferTile(int tile) {
+    // The tile is rendered with the projection zoomed into it.
+    const int tilesPerSide = gbufSize / GBUF_TILE_SIZE;
+    const float n  = static_cast<float>(tilesPerSide);
+    const float cx = -1.0f + (2 * (tile % tilesPerSide) + 1) / n;
+    const float cy = -1.0f + (2 * (tile / tilesPerSide) + 1) / n;
+    QMatrix4x4 tileMat;
+    tileMat.scale(n, n, 1.0f);
+    tileMat.translate(-cx, -cy, 0.0f);
+
+    const QMatrix4x4 mvpMat = tileMat * lightMVPMatrix();
+    renderGBuffers(GBUF_TILE_SIZE, mvpMat);
+    gbufReadback->submit(mvpMat);
+}
+
+void OpenGLViewer::streamGBufferTiles() {
+    // The tile read back is handed over once the worker has taken the
+    // previous one, so that no tile replaces another before it is processed,
+    // and the next tile is rendered while the worker processes it. The
+    // readback which is not finished yet is polled again by the next frame,
+    // and the tile whose readback has failed is rendered again.
+    const int tilesPerSide = gbufSize / GBUF_TILE_SIZE;
+    const int numTiles = tilesPerSide * tilesPerSide;
+    if (gbufReadback->isPending()) {
+        if (sampleBuilder->isPending() || !gbufReadback->map()) {
+            return;
+        }
+
+        ReadbackView views[GBUF_NUM_IMAGES];
+        for (int i = 0; i < GBUF_NUM_IMAGES; i++) {
+            views[i] = gbufReadback->view(i);
+        }
+        sampleBuilder->submitTile(views, gbufReadback->mvpMat(), gbufTile, numTiles,
+                                  lightPos, hierarchyParams, gbufCacheKey);
+        gbufReadback->unmap();
+        gbufTile++;
+    }
+
+    if (gbufTile == numTiles) {
+        gbufTile = -1;
+        return;
     }
 
+    renderGBufferTile(gbufTile);
+    glViewport(0, 0, width(), height());
+}
+
+void OpenGLViewer::renderGBuffers(int bufSize, const QMatrix4x4& mvpMat) {
+    if (gbufRangeShader) {
+        renderGBuffersSinglePass(bufSize, mvpMat);
+    } else {
+        renderGBuffersTwoPass(bufSize, mvpMat);
+    }
+}
+
+QMatrix4x4 OpenGLViewer::lightMVPMatrix() const {
+    QMatrix4x4 pMat, vMat, mMat;
+    pMat.perspective(45.0f, 1.0f, 0.1f, 100.0f);
+    vMat.lookAt(gbufLightPos, QVector3D(0.0f, 0.0f, 0.0f), QVector3D(0.0f, 1.0f, 0.0f));
+    mMat.scale(7.0f);
+    return pMat * vMat * mMat;
+}
+
+void OpenGLViewer::renderGBuffersSinglePass(int bufSize, const QMatrix4x4& mvpMat) {
+    auto f = QOpenGLContext::currentContext()->extraFunctions();
+
+    // The maximum depth is stored in a dedicated integer attachment.
+    if (!maxDepthTexture) {
+        maxDepthTexture = std::make_unique<QOpenGLTexture>(QOpenGLTexture::Target2D);
+        maxDepthTexture->setFormat(QOpenGLTexture::R32U);
+        maxDepthTexture->setSize(bufSize, bufSize);
+        maxDepthTexture->setMinificationFilter(QOpenGLTexture::Filter::Nearest);
+        maxDepthTexture->setMagnificationFilter(QOpenGLTexture::Filter::Nearest);
+        maxDepthTexture->allocateStorage(QOpenGLTexture::Red_Integer, QOpenGLTexture::UInt32);
+
+        gbufFbo->bind();
+        f->glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT2, GL_TEXTURE_2D,
+                                  maxDepthTexture->textureId(), 0);
+        gbufFbo->release();
+    }
+
+    glViewport(0, 0, bufSize, bufSize);
+
+    gbufRangeShader->bind();
+    gbufFbo->bind();
+    vao->bind();
+
+    gbufRangeShader->setUniformValue("uMVPMat", mvpMat);
+    gbufRangeShader->setUniformValue("uMaxDepthImage", 0);
+
+    // Integer attachments cannot be cleared by "glClear".
+    GLenum clearBufs[] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1, GL_COLOR_ATTACHMENT2 };
+    f->glDrawBuffers(3, clearBufs);
+
+    float black[] = { 0.0f, 0.0f, 0.0f, 1.0f };
+    GLuint zero[] = { 0, 0, 0, 0 };
+    f->glClearBufferfv(GL_COLOR, 0, black);
+    f->glClearBufferfv(GL_COLOR, 1, black);
+    f->glClearBufferuiv(GL_COLOR, 2, zero);
+    glClear(GL_DEPTH_BUFFER_BIT);
+
+    f->glDrawBuffers(2, clearBufs);
+    f->glBindImageTexture(0, maxDepthTexture->textureId(), 0, GL_FALSE, 0, GL_READ_WRITE, GL_R32UI);
+
+    glDrawElements(GL_TRIANGLES, iBuffer->size() / sizeof(unsigned int), GL_UNSIGNED_INT, 0);
+
+    f->glMemoryBarrier(GL_FRAMEBUFFER_BARRIER_BIT);
+
+    gbufRangeShader->release();
+    gbufFbo->release();
+    vao->release();
+
+    gbufReadback->readDepth(*gbufFbo.get(), GBUF_IMAGE_MIN_DEPTH);
+    gbufReadback->read(*gbufFbo.get(), 0, 2, GBUF_IMAGE_NORMAL);
+    gbufReadback->read(*gbufFbo.get(), 1, 2, GBUF_IMAGE_TEXCOORD);
+    gbufReadback->read(*gbufFbo.get(), 2, 1, GBUF_IMAGE_MAX_DEPTH, true);
+}
+
+void OpenGLViewer::renderGBuffersTwoPass(int bufSize, const QMatrix4x4& mvpMat) {
     // Compute G-buffers from the light source. In the following part, 
     // G-buffers except for "Maximum depth" are computed.
-    cv::Mat minDepthImage, posImage, normalImage, texcoordImage;
     {
         glViewport(0, 0, bufSize, bufSize);
 
@@ -357,222 +1111,422 @@ void OpenGLViewer::calcGBuffers() {
         gbufFbo->bind();
         vao->bind();
 
-        QMatrix4x4 pMat, vMat, mMat;
-        pMat.perspective(45.0f, 1.0f, 0.1f, 100.0f);
-        vMat.lookAt(lightPos, QVector3D(0.0f, 0.0f, 0.0f), QVector3D(0.0f, 1.0f, 0.0f));
-        mMat.scale(7.0f);
-
-        QMatrix4x4 mvpMat = pMat * vMat * mMat;
         gbufShader->setUniformValue("uMVPMat", mvpMat);
-        gbufShader->setUniformValue("isMaxDepth", 0);
 
         auto f = QOpenGLContext::currentContext()->extraFunctions();
-        GLenum bufs[] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1,
-                          GL_COLOR_ATTACHMENT2, GL_COLOR_ATTACHMENT3 };
-        f->glDrawBuffers(4, bufs);
+        GLenum bufs[] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
+        f->glDrawBuffers(2, bufs);
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-        float white[] = { 1.0f, 1.0f, 1.0f, 1.0f };
-        f->glClearBufferfv(GL_COLOR, 0, white);
-
         glDrawElements(GL_TRIANGLES, iBuffer->size() / sizeof(unsigned int), GL_UNSIGNED_INT, 0);
 
         gbufShader->release();
         gbufFbo->release();
         vao->release();
 
-        takeFloatImage(*gbufFbo.get(), &minDepthImage, 1, 0);
-        takeFloatImage(*gbufFbo.get(), &posImage, 3, 1);
-        takeFloatImage(*gbufFbo.get(), &normalImage, 3, 2);
-        takeFloatImage(*gbufFbo.get(), &texcoordImage, 3, 3);
+        gbufReadback->readDepth(*gbufFbo.get(), GBUF_IMAGE_MIN_DEPTH);
+        gbufReadback->read(*gbufFbo.get(), 0, 2, GBUF_IMAGE_NORMAL);
+        gbufReadback->read(*gbufFbo.get(), 1, 2, GBUF_IMAGE_TEXCOORD);
     }
 
-    // Compute the maximum depth image from the light source.
-    cv::Mat maxDepthImage;
+    // Compute the maximum depth image from the light source. The farthest
+    // fragments pass the reversed depth test, and the texels without them
+    // keep zero as the image atomics do.
     {
         gbufShader->bind();
         gbufFbo->bind();
         vao->bind();
 
-        gbufShader->setUniformValue("isMaxDepth", 1);
-
         auto f = QOpenGLContext::currentContext()->extraFunctions();
-        GLenum bufs[] = { GL_COLOR_ATTACHMENT0 };
-
+        GLenum bufs[] = { GL_NONE };
         f->glDrawBuffers(1, bufs);
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-        float white[] = { 1.0f, 1.0f, 1.0f, 1.0f };
-        f->glClearBufferfv(GL_COLOR, 0, white);
+        glClearDepth(0.0);
+        glClear(GL_DEPTH_BUFFER_BIT);
+        glDepthFunc(GL_GREATER);
 
         glDrawElements(GL_TRIANGLES, iBuffer->size() / sizeof(unsigned int), GL_UNSIGNED_INT, 0);
 
+        glDepthFunc(GL_LESS);
+        glClearDepth(1.0);
+
         gbufShader->release();
         gbufFbo->release();
         vao->release();
 
-        takeFloatImage(*gbufFbo.get(), &maxDepthImage, 1, 0);
+        gbufReadback->readDepth(*gbufFbo.get(), GBUF_IMAGE_MAX_DEPTH);
     }
+}
 
-    // Revert viewport.
-     glViewport(0, 0, width(), height());
+bool OpenGLViewer::updateSamples() {
+    // Hand the finished readback over to the worker thread.
+    if (gbufTile >= 0) {
+        streamGBufferTiles();
+    } else if (gbufReadback && gbufReadback->isPending() && gbufReadback->map()) {
+        ReadbackView views[GBUF_NUM_IMAGES];
+        for (int i = 0; i < GBUF_NUM_IMAGES; i++) {
+            views[i] = gbufReadback->view(i);
+        }
+        sampleBuilder->submit(views, gbufReadback->mvpMat(), isDynamicLight, lightPos, hierarchyParams, gbufCacheKey);
+        gbufReadback->unmap();
+    }
 
-    #if DEBUG_MODE
-    saveFloatImage(std::string(OUTPUT_DIRECTORY) + "gbuf_mindepth.png", depthImage);
-    saveFloatImage(std::string(OUTPUT_DIRECTORY) + "gbuf_maxdepth.png", maxDepthImage);
-    saveFloatImage(std::string(OUTPUT_DIRECTORY) + "gbuf_position.png", posImage);
-    saveFloatImage(std::string(OUTPUT_DIRECTORY) + "gbuf_normal.png", normalImage);
-    saveFloatImage(std::string(OUTPUT_DIRECTORY) + "gbuf_texcoord.png", texcoordImage);
-    #endif
-    
-    // Compute sample point hierarchy.
-    static const int maxPyrLevels = 3;
-
-    std::vector<cv::Mat> minDepthPyr(maxPyrLevels);
-    std::vector<cv::Mat> maxDepthPyr(maxPyrLevels);
-    std::vector<cv::Mat> positionPyr(maxPyrLevels);
-    std::vector<cv::Mat> normalPyr(maxPyrLevels);
-    std::vector<cv::Mat> texCoordPyr(maxPyrLevels);
-
-    minDepthPyr[maxPyrLevels - 1] = minDepthImage;
-    maxDepthPyr[maxPyrLevels - 1] = maxDepthImage;
-    positionPyr[maxPyrLevels - 1] = posImage;
-    normalPyr[maxPyrLevels - 1] = normalImage;
-    texCoordPyr[maxPyrLevels - 1] = texcoordImage;
-
-    std::function<float(float,float,float,float)> fTakeMin = 
-        [&](float f1, float f2, float f3, float f4) {
-            return std::min(std::min(f1, f2), std::min(f3, f4));
-        };
-    std::function<float(float,float,float,float)> fTakeMax =
-        [&](float f1, float f2, float f3, float f4) {
-            return std::max(std::max(f1, f2), std::max(f3, f4));
-        };
-    std::function<cv::Vec3f(cv::Vec3f,cv::Vec3f,cv::Vec3f,cv::Vec3f)> fTakeAvg =
-        [&](cv::Vec3f v1, cv::Vec3f v2, cv::Vec3f v3, cv::Vec3f v4) {
-            return (v1 + v2 + v3 + v4) / 4.0f;
-        };
+    // Take the newest sample set if the worker has finished one.
+    if (!sampleBuilder->fetch()) {
+        return false;
+    }
 
-    for (int i = maxPyrLevels - 1; i >= 1; i--) {
-        pyrDown(minDepthPyr[i], minDepthPyr[i - 1], fTakeMin);
-        pyrDown(maxDepthPyr[i], maxDepthPyr[i - 1], fTakeMax);
-        pyrDown(positionPyr[i], positionPyr[i - 1], fTakeAvg);
-        pyrDown(normalPyr[i],   normalPyr[i - 1],   fTakeAvg);
-        pyrDown(texCoordPyr[i], texCoordPyr[i - 1], fTakeAvg);
-    }
-
-    static const double alpha = 30.0;
-    static const double Rw = 1.0;
-    static const double RPx = 0.1;
-    static const double z0 = 0.03;
-    double T = 256.0;
-
-    std::vector<cv::Mat> samplePyr(maxPyrLevels);
-    for (int l = 0; l < maxPyrLevels; l++) {
-        const int subRows = minDepthPyr[l].rows;
-        const int subCols = minDepthPyr[l].cols;
-        samplePyr[l] = cv::Mat(subRows, subCols, CV_8UC1, cv::Scalar(0, 0, 0));
-        for (int i = 0; i < subRows; i++) {
-            for (int j = 0; j < subCols; j++) {
-                float depthGap = (maxDepthPyr[l].at<float>(i, j) - minDepthPyr[l].at<float>(i, j)) * 10.0f;
-
-                cv::Vec3f pos = positionPyr[l].at<cv::Vec3f>(i, j);
-                QVector3D L = QVector3D(lightPos.x() - pos[0], lightPos.y() - pos[1], lightPos.z() - pos[2]).normalized();
-                cv::Vec3f nrm = normalPyr[l].at<cv::Vec3f>(i, j);
-                QVector3D N = QVector3D(nrm[0], nrm[1], nrm[2]);
-
-                double Mx = alpha * Rw / (RPx * std::abs(QVector3D::dotProduct(N, L)));    
-
-                if (depthGap < z0 && T > Mx) {
-                    samplePyr[l].at<uchar>(i, j) = 255;
-                } else {
-                    samplePyr[l].at<uchar>(i, j) = 0;                                        
-                }
-            }
-        }
-        T *= 2.0;
+    const SampleSet& sampleSet = sampleBuilder->sampleSet();
+    builderBytes = sampleSet.workingBytes;
+    peakBuilderBytes = std::max(peakBuilderBytes, builderBytes);
+    if (sampleSet.samples.empty()) {
+        return false;
     }
 
-    for (int l = maxPyrLevels - 1; l >= 1; l--) {
-        for (int y = 0; y < samplePyr[l].rows; y++) {
-            for (int x = 0; x < samplePyr[l].cols; x++) {
-                if (samplePyr[l - 1].at<uchar>(y / 2, x / 2) != 0) {
-                    samplePyr[l].at<uchar>(y, x) = 0;
-                }
-            }
-        }    
+    // The tree is cut in "paintGL()" instead of uploading the samples.
+    if (isViewCut && sampleSet.tree) {
+        sampleTree = sampleSet.tree;
+        isCutDirty = true;
+        return true;
     }
 
     #if DEBUG_MODE
-    cv::imwrite(std::string(OUTPUT_DIRECTORY) + "sample0.png", samplePyr[0]);
-    cv::imwrite(std::string(OUTPUT_DIRECTORY) + "sample1.png", samplePyr[1]);
-    cv::imwrite(std::string(OUTPUT_DIRECTORY) + "sample2.png", samplePyr[2]); 
+    // With the light buffers of the same anchor, a small move of the light
+    // should update only some of the tiles.
+    if (!sampleSet.blockVersions.empty() && sampleSet.layoutVersion == sampleLayoutVersion &&
+        sampleSet.numUpdatedTiles >= sampleSet.numTiles) {
+        std::cerr << "All the " << sampleSet.numUpdatedTiles << " tiles were updated for the light." << std::endl;
+    }
     #endif
-    
-    std::vector<Sample> samples;
-    std::vector<unsigned int> sampleIds;
-    for (int l = 0; l < maxPyrLevels; l++) {
-        for (int y = 0; y < samplePyr[l].rows; y++) {
-            for (int x = 0; x < samplePyr[l].cols; x++) {
-                if (samplePyr[l].at<uchar>(y, x) != 0) {
-                    Sample samp;
-
-                    cv::Vec3f pos = positionPyr[l].at<cv::Vec3f>(y, x);
-                    samp.position = QVector3D(pos[0], pos[1], pos[2]);
-                    cv::Vec3f nrm = normalPyr[l].at<cv::Vec3f>(y, x);
-                    samp.normal   = QVector3D(nrm[0], nrm[1], nrm[2]);
-                    cv::Vec3f crd = texCoordPyr[l].at<cv::Vec3f>(y, x);
-                    samp.texcoord = QVector2D(crd[0], crd[1]);
-                    samp.radius = std::pow(0.5, l);
-                    samples.push_back(samp);
-                    sampleIds.push_back(sampleIds.size());
-                }
-            }        
+
+    uploadSamples(sampleSet);
+    return true;
+}
+
+void OpenGLViewer::updateCut(const QMatrix4x4& mvpMat, const QMatrix4x4& mvMat, const QMatrix4x4& pMat) {
+    // The cut also depends on the splat sizes of the material.
+    const std::vector<float>& supports = mtrlProfiles[materialIndex].supports;
+    if (!isCutDirty && mvpMat == cutMVPMat && supports == cutSupports) {
+        return;
+    }
+
+    // The model-view matrix scales uniformly.
+    const float scale = QVector3D(mvMat(0, 0), mvMat(1, 0), mvMat(2, 0)).length();
+
+    CutParams params;
+    params.mvpMat = mvpMat;
+    params.pixelsPerUnit = pMat(1, 1) * height() * 0.5f * scale;
+    params.targetPixels = CUT_TARGET_PIXELS;
+    params.depthGap = static_cast<float>(hierarchyParams.z0);
+    params.supports = supports.data();
+    params.numSupports = SUPPORT_LEVELS;
+    sampleTree->cut(params, cutSamples);
+
+    // The cut follows the tree, whose roots are in row-scan order, so that
+    // the samples are only split into the segments without the Morton sort.
+    // They are written over the start of the buffer.
+    std::vector<int> offsets;
+    packSamples(cutSamples.data(), static_cast<int>(cutSamples.size()), sampleBounds, SAMPLE_SEGMENTS,
+                packedSamples, offsets, false);
+    writeSamples(packedSamples.data(), static_cast<int>(packedSamples.size()), offsets);
+
+    cutMVPMat = mvpMat;
+    cutSupports = supports;
+    isCutDirty = false;
+}
+
+void OpenGLViewer::uploadSamples(const SampleSet& sampleSet) {
+    // The samples are packed by the worker. While the tiles keep their
+    // layout, only the blocks written since the last upload are written
+    // again, in runs of consecutive blocks, and the other samples stay in
+    // the buffer.
+    const std::vector<PackedSample>& samples = sampleSet.samples;
+    const bool isPatch = sampleVAO && !sampleSet.blockVersions.empty() &&
+                         sampleSet.layoutVersion == sampleLayoutVersion &&
+                         sampleSet.blockVersions.size() == sampleBlockVersions.size();
+    if (!isPatch) {
+        writeSamples(samples.data(), static_cast<int>(samples.size()), sampleSet.segmentOffsets);
+        sampleLayoutVersion = sampleSet.layoutVersion;
+        sampleBlockVersions = sampleSet.blockVersions;
+        return;
+    }
+
+    const int numBlocks = static_cast<int>(sampleBlockVersions.size());
+    sampleVBuf->bind();
+    for (int b = 0; b < numBlocks; ) {
+        if (sampleSet.blockVersions[b] == sampleBlockVersions[b]) {
+            b++;
+            continue;
         }
+
+        int e = b;
+        while (e < numBlocks && sampleSet.blockVersions[e] != sampleBlockVersions[e]) {
+            sampleBlockVersions[e] = sampleSet.blockVersions[e];
+            e++;
+        }
+        const int first = b * SAMPLE_BLOCK_SIZE;
+        const int last  = std::min(e * SAMPLE_BLOCK_SIZE, static_cast<int>(samples.size()));
+        sampleVBuf->write(sizeof(PackedSample) * first, &samples[first], sizeof(PackedSample) * (last - first));
+        b = e;
     }
+    sampleVBuf->release();
+    sampleSetVersion++;
+}
 
+void OpenGLViewer::allocateSamples(const Sample* samples, int numSamples) {
     #if DEBUG_MODE
     std::ofstream ofs((std::string(SLF_OUTPUT_DIRECTORY) + "samples.obj").c_str(), std::ios::out);
-    for (const auto& s : samples) {
+    for (int i = 0; i < numSamples; i++) {
         ofs << "v ";
-        ofs << s.position.x() << " ";
-        ofs << s.position.y() << " ";
-        ofs << s.position.z() << std::endl;
+        ofs << samples[i].position.x() << " ";
+        ofs << samples[i].position.y() << " ";
+        ofs << samples[i].position.z() << std::endl;
     }
     ofs.close();
     #endif
 
-    // Prepare sample VAO.
-    sampleVAO = std::make_unique<QOpenGLVertexArrayObject>(this);
-    sampleVAO->create();
-    sampleVAO->bind();
+    // Samples are ordered by the segment and then along the Morton curve, so
+    // that every segment is a contiguous range of the vertex buffer.
+    std::vector<int> offsets;
+    packSamples(samples, numSamples, sampleBounds, SAMPLE_SEGMENTS, packedSamples, offsets);
+    writeSamples(packedSamples.data(), static_cast<int>(packedSamples.size()), offsets);
+}
+
+void OpenGLViewer::writeSamples(const PackedSample* samples, int numSamples, const std::vector<int>& offsets) {
+    sampleSetVersion++;
+
+    // Prepare sample VAO. The buffers are created once and refilled afterwards.
+    if (!sampleVAO) {
+        sampleVAO = std::make_unique<QOpenGLVertexArrayObject>(this);
+        sampleVAO->create();
+        sampleVAO->bind();
+
+        sampleVBuf = std::make_unique<QOpenGLBuffer>(QOpenGLBuffer::VertexBuffer);
+        sampleVBuf->create();
+        sampleVBuf->setUsagePattern(QOpenGLBuffer::DynamicDraw);
+        sampleVBuf->bind();
+
+        auto f = QOpenGLContext::currentContext()->extraFunctions();
+        setSampleAttributes(f, false);
+        sampleVAO->release();
+
+        // The instanced path reads the same samples once per instance, and
+        // the corners of a unit quad per vertex.
+        splatVAO = std::make_unique<QOpenGLVertexArrayObject>(this);
+        splatVAO->create();
+        splatVAO->bind();
+
+        sampleVBuf->bind();
+        setSampleAttributes(f, true);
+
+        // Same corner order as the triangle strip of "dipole.gs".
+        static const float corners[] = { -1.0f, -1.0f, -1.0f, 1.0f, 1.0f, -1.0f, 1.0f, 1.0f };
+        quadVBuf = std::make_unique<QOpenGLBuffer>(QOpenGLBuffer::VertexBuffer);
+        quadVBuf->create();
+        quadVBuf->setUsagePattern(QOpenGLBuffer::StaticDraw);
+        quadVBuf->bind();
+        quadVBuf->allocate(corners, sizeof(corners));
+        f->glEnableVertexAttribArray(SAMPLE_CORNER_LOC);
+        f->glVertexAttribPointer(SAMPLE_CORNER_LOC, 2, GL_FLOAT, GL_FALSE, 0, (void*)0);
+        splatVAO->release();
+
+        if (sampleCuller) {
+            createCulledVAOs();
+        }
+    }
 
-    sampleVBuf = std::make_unique<QOpenGLBuffer>(QOpenGLBuffer::VertexBuffer);
-    sampleVBuf->create();
-    sampleVBuf->setUsagePattern(QOpenGLBuffer::StaticDraw);
+    // The buffer is reallocated only when the samples outgrow it, and it is
+    // given some room for the growth of the tiles.
     sampleVBuf->bind();
-    sampleVBuf->allocate(&samples[0], sizeof(Sample) * samples.size());
+    if (numSamples > sampleCapacity) {
+        sampleCapacity = numSamples + numSamples / 4;
+        sampleVBuf->allocate(sizeof(PackedSample) * sampleCapacity);
+    }
+    if (numSamples > 0) {
+        sampleVBuf->write(0, samples, sizeof(PackedSample) * numSamples);
+    }
+    sampleVBuf->release();
 
+    numPackedSamples = numSamples;
+    segmentOffsets = offsets;
+    sampleLayoutVersion = 0;
+    sampleBlockVersions.clear();
+}
+
+void OpenGLViewer::createCulledVAOs() {
     auto f = QOpenGLContext::currentContext()->extraFunctions();
-    f->glEnableVertexAttribArray(SAMPLE_POSITION_LOC);
-    f->glEnableVertexAttribArray(SAMPLE_NORMAL_LOC);
-    f->glEnableVertexAttribArray(SAMPLE_TEXCOORD_LOC);
-    f->glEnableVertexAttribArray(SAMPLE_RADIUS_LOC);
-    f->glVertexAttribPointer(SAMPLE_POSITION_LOC, 3, GL_FLOAT, GL_FALSE, sizeof(Sample), (void*)0);
-    f->glVertexAttribPointer(SAMPLE_NORMAL_LOC,   3, GL_FLOAT, GL_FALSE, sizeof(Sample), (void*)(sizeof(float) * 3));
-    f->glVertexAttribPointer(SAMPLE_TEXCOORD_LOC, 2, GL_FLOAT, GL_FALSE, sizeof(Sample), (void*)(sizeof(float) * 6));
-    f->glVertexAttribPointer(SAMPLE_RADIUS_LOC,   1, GL_FLOAT, GL_FALSE, sizeof(Sample), (void*)(sizeof(float) * 8));
 
-    sampleIBuf = std::make_unique<QOpenGLBuffer>(QOpenGLBuffer::IndexBuffer);
-    sampleIBuf->create();
-    sampleIBuf->setUsagePattern(QOpenGLBuffer::StaticDraw);
-    sampleIBuf->bind();
-    sampleIBuf->allocate(&sampleIds[0], sampleIds.size() * sizeof(unsigned int));
+    // Survivors of the culling, which are drawn as points or as the
+    // instances of the quad.
+    culledSampleVAO = std::make_unique<QOpenGLVertexArrayObject>(this);
+    culledSampleVAO->create();
+    culledSampleVAO->bind();
+    f->glBindBuffer(GL_ARRAY_BUFFER, sampleCuller->sampleBuffer());
+    setSampleAttributes(f, false);
+    culledSampleVAO->release();
+
+    culledSplatVAO = std::make_unique<QOpenGLVertexArrayObject>(this);
+    culledSplatVAO->create();
+    culledSplatVAO->bind();
+    f->glBindBuffer(GL_ARRAY_BUFFER, sampleCuller->sampleBuffer());
+    setSampleAttributes(f, true);
+    quadVBuf->bind();
+    f->glEnableVertexAttribArray(SAMPLE_CORNER_LOC);
+    f->glVertexAttribPointer(SAMPLE_CORNER_LOC, 2, GL_FLOAT, GL_FALSE, 0, (void*)0);
+    culledSplatVAO->release();
+}
+
+void OpenGLViewer::cullSamples(const FrameGraph::Resources& res, const QMatrix4x4& mvpMat) {
+    CullParams params;
+    params.mvpMat = mvpMat;
+    params.sampleBuffer = sampleVBuf->bufferId();
+    params.numSamples = numPackedSamples;
+    params.segmentOffsets = segmentOffsets.data();
+    params.bounds = sampleBounds;
+    params.depthMap = res.texture(screenTargets.depth);
+    params.width = res.desc(screenTargets.depth).width;
+    params.height = res.desc(screenTargets.depth).height;
+    params.supports = mtrlProfiles[materialIndex].supports.data();
+    params.numSupports = SUPPORT_LEVELS;
+    sampleCuller->cull(params);
+}
 
-    sampleVAO->release();
+void OpenGLViewer::renderMultiresLevels(const FrameGraph::Resources& res, bool isCulled) {
+    // Splat every level into its own buffer. The finest one is bound and cleared.
+    auto f = QOpenGLContext::currentContext()->extraFunctions();
+    if (isCulled) {
+        culledSampleVAO->bind();
+        f->glBindBuffer(GL_DRAW_INDIRECT_BUFFER, sampleCuller->commandBuffer());
+    } else {
+        sampleVAO->bind();
+    }
+    for (int s = 0; s < MULTIRES_LEVELS; s++) {
+        if (s > 0) {
+            const TargetHandle level = screenTargets.levels[s - 1];
+            f->glBindFramebuffer(GL_FRAMEBUFFER, res.framebuffer(level, screenTargets.levelStencils[s - 1]));
+            glViewport(0, 0, res.desc(level).width, res.desc(level).height);
+            glClear(GL_COLOR_BUFFER_BIT);
+        }
+
+        if (isCulled) {
+            f->glDrawArraysIndirect(GL_POINTS, reinterpret_cast<void*>(SampleCuller::pointsCommandOffset(s)));
+            continue;
+        }
+
+        const int first = segmentOffsets[s];
+        const int last  = segmentOffsets[s + 1];
+        if (last > first) {
+            glDrawArrays(GL_POINTS, first, last - first);
+        }
+    }
+
+    if (isCulled) {
+        f->glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+        culledSampleVAO->release();
+    } else {
+        sampleVAO->release();
+    }
+}
+
+void OpenGLViewer::combineMultiresLevels(const FrameGraph::Resources& res) {
+    auto f = QOpenGLContext::currentContext()->extraFunctions();
+
+    // Upsample the coarser levels and add them to the finest one.
+    const TargetDesc& desc = res.desc(screenTargets.trans);
+    f->glBindFramebuffer(GL_FRAMEBUFFER, res.framebuffer(screenTargets.trans, screenTargets.transStencil));
+    glViewport(0, 0, desc.width, desc.height);
+
+    multiresShader->bind();
+    for (int s = 1; s < MULTIRES_LEVELS; s++) {
+        f->glActiveTexture(GL_TEXTURE0 + s - 1);
+        glBindTexture(GL_TEXTURE_2D, res.texture(screenTargets.levels[s - 1]));
+        multiresShader->setUniformValue(("uLevelMap" + std::to_string(s)).c_str(), s - 1);
+
+        const TargetDesc& levelDesc = res.desc(screenTargets.levels[s - 1]);
+        f->glUniform2i(multiresShader->uniformLocation(("uLevelSize" + std::to_string(s)).c_str()),
+                       levelDesc.width, levelDesc.height);
+    }
+    f->glActiveTexture(GL_TEXTURE0 + MULTIRES_LEVELS - 1);
+    glBindTexture(GL_TEXTURE_2D, res.texture(screenTargets.depth));
+    f->glActiveTexture(GL_TEXTURE0 + MULTIRES_LEVELS);
+    glBindTexture(GL_TEXTURE_2D, res.texture(screenTargets.normal));
+    multiresShader->setUniformValue("uDepthMap", MULTIRES_LEVELS - 1);
+    multiresShader->setUniformValue("uNormalMap", MULTIRES_LEVELS);
+    f->glUniform2i(multiresShader->uniformLocation("uScreenSize"),
+                   res.desc(screenTargets.depth).width, res.desc(screenTargets.depth).height);
+    multiresShader->setUniformValue("uDepthRange", QVector2D(CAMERA_NEAR, CAMERA_FAR));
+
+    screenVAO->bind();
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+    screenVAO->release();
+    multiresShader->release();
+}
+
+std::string OpenGLViewer::sampleCacheKey() const {
+    // Samples depend on the mesh, the light, the buffer size and the parameters.
+    const QMatrix4x4 mvpMat = lightMVPMatrix();
+    const HierarchyParams& params = hierarchyParams;
+
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+    hash.addData(meshHash);
+    hash.addData(reinterpret_cast<const char*>(mvpMat.constData()), sizeof(float) * 16);
+    hash.addData(reinterpret_cast<const char*>(&lightPos), sizeof(QVector3D));
+    hash.addData(reinterpret_cast<const char*>(&gbufSize), sizeof(int));
+    hash.addData(reinterpret_cast<const char*>(&params.alpha), sizeof(double));
+    hash.addData(reinterpret_cast<const char*>(&params.Rw), sizeof(double));
+    hash.addData(reinterpret_cast<const char*>(&params.RPx), sizeof(double));
+    hash.addData(reinterpret_cast<const char*>(&params.z0), sizeof(double));
+    hash.addData(reinterpret_cast<const char*>(&params.T), sizeof(double));
+    hash.addData(reinterpret_cast<const char*>(&params.budget), sizeof(int));
+    return hash.result().toHex().toStdString();
+}
+
+void OpenGLViewer::updateProfiles() {
+    // Only the material scale and the epsilon change the profiles, while
+    // the material is switched between the prepared ones.
+    mtrlProfiles.resize(mtrlLibrary.size());
+    for (int i = 0; i < mtrlLibrary.size(); i++) {
+        // The irradiance in "dipole.fs" is at most one, so that the area of
+        // the splat is the only weight of the reflectance.
+        const DipoleMaterial& base = mtrlLibrary[i].mtrl;
+        const DipoleMaterial mtrl = { base.sigma_a * mtrlScale, base.sigmap_s * mtrlScale, base.eta };
+        MaterialProfile& profile = mtrlProfiles[i];
+        profile.supports.resize(SUPPORT_LEVELS);
+        for (int l = 0; l < SUPPORT_LEVELS; l++) {
+            const float radius = std::ldexp(1.0f, l - 2);
+            profile.supports[l] = supportRadius(mtrl, splatArea(radius), splatEpsilon, SUPPORT_MAX_DIST);
+        }
+
+        // The profile is only evaluated within the largest splat.
+        const float maxDist = *std::max_element(profile.supports.begin(), profile.supports.end());
+        profile.profile = std::make_unique<DipoleProfile>(mtrl, maxDist, PROFILE_TABLE_SIZE);
+        for (DipoleMode mode : { DipoleMode::Exact, DipoleMode::Table, DipoleMode::Fast }) {
+            profile.errors[static_cast<int>(mode)] = profile.profile->error(mode);
+        }
+
+        if (!profile.texture) {
+            profile.texture = std::make_unique<QOpenGLTexture>(QOpenGLTexture::Target1D);
+            profile.texture->setFormat(QOpenGLTexture::RGB32F);
+            profile.texture->setSize(PROFILE_TABLE_SIZE);
+            profile.texture->setMinificationFilter(QOpenGLTexture::Filter::Linear);
+            profile.texture->setMagnificationFilter(QOpenGLTexture::Filter::Linear);
+            profile.texture->setWrapMode(QOpenGLTexture::WrapMode::ClampToEdge);
+            profile.texture->allocateStorage(QOpenGLTexture::RGB, QOpenGLTexture::Float32);
+        }
+        profile.texture->setData(QOpenGLTexture::RGB, QOpenGLTexture::Float32, profile.profile->table());
+    }
+
+    isProfileDirty = false;
 }
 
 void OpenGLViewer::mousePressEvent(QMouseEvent* ev) {
+    // Light
+    if (isDynamicLight && ev->button() == Qt::LeftButton && (ev->modifiers() & Qt::ShiftModifier)) {
+        isLightDragging = true;
+        lightDragPoint = ev->pos();
+        return;
+    }
+
     // Arcball
     arcball->setOldPoint(ev->pos());
     arcball->setNewPoint(ev->pos());
@@ -586,13 +1540,35 @@ void OpenGLViewer::mousePressEvent(QMouseEvent* ev) {
 }
 
 void OpenGLViewer::mouseMoveEvent(QMouseEvent* ev) {
+    // Light orbits around the origin.
+    if (isLightDragging) {
+        const QPoint delta = ev->pos() - lightDragPoint;
+        QMatrix4x4 yawMat, pitchMat;
+        yawMat.rotate(delta.x() * 0.5f, QVector3D(0.0f, 1.0f, 0.0f));
+        pitchMat.rotate(delta.y() * 0.5f, QVector3D::crossProduct(QVector3D(0.0f, 1.0f, 0.0f), lightPos).normalized());
+        lightPos = yawMat.map(lightPos);
+
+        // Stop at the poles, where "lookAt()" for the light degenerates.
+        const QVector3D pitched = pitchMat.map(lightPos);
+        if (std::abs(pitched.normalized().y()) < 0.95f) {
+            lightPos = pitched;
+        }
+        lightDragPoint = ev->pos();
+        isGBufferDirty = true;
+        requestFrame();
+        return;
+    }
+
     // Arcball
     arcball->setNewPoint(ev->pos());
     arcball->update();
     arcball->setOldPoint(ev->pos());    
+    requestFrame();
 }
 
 void OpenGLViewer::mouseReleaseEvent(QMouseEvent* ev) {
+    isLightDragging = false;
+
     // Arcball
     arcball->setMode(ArcballMode::None);
 }
@@ -601,8 +1577,16 @@ void OpenGLViewer::mouseReleaseEvent(QMouseEvent* ev) {
 void OpenGLViewer::wheelEvent(QWheelEvent* ev) {
     arcball->setScroll(arcball->scroll() + ev->delta() / 1000.0);
     arcball->update();
+    requestFrame();
 }
 
 void OpenGLViewer::OnAnimate() {
     update();
 }
+
+void OpenGLViewer::OnFrameSwapped() {
+    // The swap waits for the vertical sync, which paces the frames.
+    if (frameScheduler.mode() == FrameMode::VSync) {
+        scheduleFrame();
+    }
+}
@@ -5,7 +5,10 @@
 #ifndef _OPENGL_VIEWER_H_
 #define _OPENGL_VIEWER_H_
 
+#include <map>
 #include <memory>
+#include <string>
+#include <vector>
 
 #include <QtCore/qtimer.h>
 
@@ -21,6 +24,16 @@
 #include <QtGui/qopenglframebufferobject.h>
 
 #include "arcballcontroller.h"
+#include "computegather.h"
+#include "dipoleprofile.h"
+#include "framegraph.h"
+#include "framescheduler.h"
+#include "materiallibrary.h"
+#include "packedsample.h"
+#include "sampleculler.h"
+#include "gbufferreadback.h"
+#include "samplebuilder.h"
+#include "samplecache.h"
 
 class OpenGLViewer : public QOpenGLWidget {
     Q_OBJECT
@@ -29,8 +42,47 @@ public:
     virtual ~OpenGLViewer();
 
     void setMaterial(const std::string& mtrlName);
+    inline const MaterialLibrary& materialLibrary() const { return mtrlLibrary; }
     void setMaterialScale(double scale);
     void setRenderComponents(bool isRefl, bool isTrans);
+    void setDynamicLight(bool isDynamic);
+    void setLightBufferSize(int size);
+    void setSampleBudget(int budget);
+    void setViewDependentCut(bool isEnabled);
+    void setInstancedSplats(bool isEnabled);
+    void setSplatEpsilon(double epsilon);
+    void setDipoleMode(DipoleMode mode);
+    void setTranslucencyScale(int scale);
+    void setMultiresSplats(bool isEnabled);
+    void setEarlyRejection(bool isEnabled);
+    void setComputeGather(bool isEnabled);
+    void setSampleCulling(bool isEnabled);
+
+    // Fragments of the last counted splat pass with or without the early
+    // rejection, or -1 if not counted yet.
+    inline long long fragmentCount(bool isRejection) const { return fragmentCounts[isRejection ? 1 : 0]; }
+
+    // Memory held by the sample builder for the last sample set or at its
+    // peak, and that of the readback buffers of the light buffers.
+    inline size_t builderMemory(bool isPeak) const { return isPeak ? peakBuilderBytes : builderBytes; }
+    inline size_t readbackMemory() const { return gbufReadback ? gbufReadback->memoryBytes() : 0; }
+
+    // Numbers of the frames in which every pass of the frame graph was run,
+    // skipped for its unchanged inputs, and culled.
+    inline std::map<std::string, FrameGraph::PassCounts> passCounts() const {
+        return frameGraph ? frameGraph->passCounts() : std::map<std::string, FrameGraph::PassCounts>();
+    }
+
+    // Relative L2 error of the evaluation mode for the current material, or
+    // -1 if the profiles have not been prepared yet.
+    inline double profileError(DipoleMode mode) const {
+        return materialIndex < static_cast<int>(mtrlProfiles.size())
+            ? mtrlProfiles[materialIndex].errors[static_cast<int>(mode)] : -1.0;
+    }
+
+    void setFrameMode(FrameMode mode);
+    void setTargetFrameRate(double framesPerSecond);
+    void setLoadLimit(double loadLimit);
 
 protected:
     void initializeGL() override;
@@ -44,13 +96,42 @@ protected:
 
 private slots:
     void OnAnimate();
+    void OnFrameSwapped();
 
 private:
+    void requestFrame();
+    void scheduleFrame();
+    void renderScreenGBuffers(const FrameGraph::Resources& res, const QMatrix4x4& mvpMat);
+    void shadeGBuffers(const FrameGraph::Resources& res, const QMatrix4x4& mvpMat, const QMatrix4x4& mvMat);
     void calcGBuffers();
+    void calcGBuffersTiled();
+    void renderGBufferTile(int tile);
+    void streamGBufferTiles();
+    void renderGBuffers(int bufSize, const QMatrix4x4& mvpMat);
+    void renderGBuffersSinglePass(int bufSize, const QMatrix4x4& mvpMat);
+    void renderGBuffersTwoPass(int bufSize, const QMatrix4x4& mvpMat);
+    QMatrix4x4 lightMVPMatrix() const;
+    bool updateSamples();
+    void uploadSamples(const SampleSet& sampleSet);
+    void allocateSamples(const Sample* samples, int numSamples);
+    void writeSamples(const PackedSample* samples, int numSamples, const std::vector<int>& offsets);
+    void createCulledVAOs();
+    void cullSamples(const FrameGraph::Resources& res, const QMatrix4x4& mvpMat);
+    void renderMultiresLevels(const FrameGraph::Resources& res, bool isCulled);
+    void combineMultiresLevels(const FrameGraph::Resources& res);
+    void gatherTranslucency(const FrameGraph::Resources& res, const QMatrix4x4& mvpMat);
+    void splatTranslucency(const FrameGraph::Resources& res, const QMatrix4x4& mvpMat, const QMatrix4x4& mvMat);
+    void readFragmentQuery();
+    void updateCut(const QMatrix4x4& mvpMat, const QMatrix4x4& mvMat, const QMatrix4x4& pMat);
+    std::string sampleCacheKey() const;
+    void updateProfiles();
 
     std::unique_ptr<QOpenGLShaderProgram> shader       = nullptr;
     std::unique_ptr<QOpenGLShaderProgram> dipoleShader = nullptr; 
+    std::unique_ptr<QOpenGLShaderProgram> dipoleInstancedShader = nullptr;
+    std::unique_ptr<QOpenGLShaderProgram> multiresShader = nullptr;
     std::unique_ptr<QOpenGLShaderProgram> gbufShader   = nullptr;
+    std::unique_ptr<QOpenGLShaderProgram> gbufRangeShader = nullptr;
 
     std::unique_ptr<QOpenGLVertexArrayObject> vao = nullptr;
     std::unique_ptr<QOpenGLBuffer> vBuffer = nullptr;
@@ -58,16 +139,148 @@ private:
 
     std::unique_ptr<QOpenGLVertexArrayObject> sampleVAO = nullptr;
     std::unique_ptr<QOpenGLBuffer> sampleVBuf = nullptr;
-    std::unique_ptr<QOpenGLBuffer> sampleIBuf = nullptr;
 
-    std::unique_ptr<QOpenGLFramebufferObject> dipoleFbo = nullptr;
-    std::unique_ptr<QOpenGLFramebufferObject> deferFbo = nullptr;
+    std::unique_ptr<QOpenGLVertexArrayObject> splatVAO = nullptr;
+    std::unique_ptr<QOpenGLBuffer> quadVBuf = nullptr;
+    bool isInstancedSplat = false;
+
+    // Ranges of the sample segments in "sampleVBuf" for the multiresolution
+    // splatting and the culling.
+    std::vector<int> segmentOffsets;
+    bool isMultiresSplat = false;
+
+    std::unique_ptr<QOpenGLVertexArrayObject> screenVAO = nullptr;
+
+    // Culling of the samples by the frustum and the receiver depth, whose
+    // survivors are drawn indirectly through the culled VAOs.
+    std::unique_ptr<SampleCuller> sampleCuller = nullptr;
+    std::unique_ptr<QOpenGLVertexArrayObject> culledSampleVAO = nullptr;
+    std::unique_ptr<QOpenGLVertexArrayObject> culledSplatVAO = nullptr;
+    bool isSampleCulling = true;
+
+    // Early rejection of the splat fragments by the coverage stencil and the
+    // support radius. The fragments are counted by an occlusion query for
+    // the splats with and without the rejection.
+    bool isEarlyRejection = true;
+    GLuint fragmentQuery = 0;
+    bool isQueryPending = false;
+    bool queryRejection = false;
+    long long fragmentCounts[2] = { -1, -1 };
+
+    // Translucency gathered by compute shaders, which is only created when
+    // the context supports them.
+    std::unique_ptr<ComputeGather> computeGather = nullptr;
+    bool isComputeGather = false;
+
+    // Passes of every frame, whose screen buffers are taken from the pool of
+    // the frame graph. The targets are declared again in every "paintGL()".
+    struct ScreenTargets {
+        // G-buffers, where the stencil marks the pixels covered by the mesh.
+        TargetHandle depth = INVALID_TARGET;
+        TargetHandle normal = INVALID_TARGET;
+
+        // Translucency and the stencil for the early rejection, and those
+        // of the coarser levels of the multiresolution splatting.
+        TargetHandle trans = INVALID_TARGET;
+        TargetHandle transStencil = INVALID_TARGET;
+        std::vector<TargetHandle> levels;
+        std::vector<TargetHandle> levelStencils;
+    };
+
+    std::unique_ptr<FrameGraph> frameGraph = nullptr;
+    ScreenTargets screenTargets;
+
     std::unique_ptr<QOpenGLFramebufferObject> gbufFbo = nullptr;
 
+    // Ratio of the window size to the size of the translucency.
+    int transScale = 1;
+
     std::unique_ptr<QOpenGLTexture> texture = nullptr;
+    std::unique_ptr<QOpenGLTexture> maxDepthTexture = nullptr;
+
+    // Depth buffer of "gbufFbo", from which the positions are reconstructed.
+    std::unique_ptr<QOpenGLTexture> gbufDepthTexture = nullptr;
+
+    std::unique_ptr<GBufferReadback> gbufReadback = nullptr;
+    std::unique_ptr<SampleBuilder> sampleBuilder = nullptr;
+    std::unique_ptr<SampleCache> sampleCache = nullptr;
+    size_t builderBytes = 0;
+    size_t peakBuilderBytes = 0;
+
+    // Hash of the mesh, and the cache key of the G-buffers being processed.
+    QByteArray meshHash;
+    std::string gbufCacheKey;
 
+    // Single-shot timer of the next frame, which is set by the scheduler.
     std::unique_ptr<QTimer> timer = nullptr;
+    FrameScheduler frameScheduler;
     std::unique_ptr<ArcballController> arcball = nullptr;
+
+    // Light position, which can be dragged with Shift + left button, and
+    // the one from which the light buffers are rendered.
+    QVector3D lightPos = QVector3D(-3.0f, 4.0f, 5.0f);
+    QVector3D gbufLightPos = lightPos;
+    bool isDynamicLight = false;
+    bool isGBufferDirty = false;
+    bool isLightDragging = false;
+    QPoint lightDragPoint;
+
+    // Size of the light buffers, which is a multiple of the tile size if
+    // it is larger than a tile, and the next tile to read back while the
+    // tiles are streamed, or -1.
+    int gbufSize = 1024;
+    int gbufTile = -1;
+
+    // Parameters of the sample selection.
+    HierarchyParams hierarchyParams;
+
+    // Tree of the samples, which is cut for the camera of every frame.
+    bool isViewCut = false;
+    bool isCutDirty = false;
+    std::shared_ptr<const SampleTree> sampleTree = nullptr;
+    std::vector<Sample> cutSamples;
+    QMatrix4x4 cutMVPMat;
+    std::vector<float> cutSupports;
+
+    // Samples packed for "sampleVBuf", whose positions are quantized to the
+    // bounds of the mesh.
+    SampleBounds sampleBounds;
+    std::vector<PackedSample> packedSamples;
+    int numPackedSamples = 0;
+    int sampleCapacity = 0;
+
+    // Layout and versions of the blocks of the samples in "sampleVBuf", by
+    // which only the updated blocks are written.
+    unsigned long long sampleLayoutVersion = 0;
+    std::vector<unsigned long long> sampleBlockVersions;
+
+    // Incremented whenever "sampleVBuf" is filled, so that the splats of the
+    // last frame are reused only for the same samples.
+    int sampleSetVersion = 0;
+
+    // Library of the materials, whose constants are stored in "materialUBO"
+    // with the given stride.
+    MaterialLibrary mtrlLibrary;
+    int materialIndex = 0;
+    GLuint materialUBO = 0;
+    int materialStride = 0;
+
+    // Splat sizes for every sample level, at which the contribution of the
+    // dipole falls below "splatEpsilon", and the profile over the largest
+    // splat. They are prepared for all the materials of the library, so that
+    // switching the material only selects them and the range of the block.
+    // The errors of the evaluation modes are measured with the profile.
+    struct MaterialProfile {
+        std::vector<float> supports;
+        std::unique_ptr<DipoleProfile> profile = nullptr;
+        std::unique_ptr<QOpenGLTexture> texture = nullptr;
+        double errors[3] = { 0.0, 0.0, 0.0 };
+    };
+
+    float splatEpsilon = 1.0e-5f;
+    bool isProfileDirty = true;
+    std::vector<MaterialProfile> mtrlProfiles;
+    DipoleMode dipoleMode = DipoleMode::Exact;
 };
 
 #endif  // _OPENGL_VIEWER_H_
@@ -0,0 +1,187 @@
+#include "packedsample.h"
+
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+
+// Bits of every axis in the Morton code, and the bits of the level above it.
+static constexpr int MORTON_BITS = 9;
+static constexpr int MORTON_LEVEL_SHIFT = 3 * MORTON_BITS;
+
+// Bits sorted by one pass of the radix sort.
+static constexpr int RADIX_BITS = 8;
+
+namespace {
+
+uint16_t toUnorm16(float v) {
+    const float c = std::max(0.0f, std::min(v, 1.0f));
+    return static_cast<uint16_t>(std::lround(c * 65535.0f));
+}
+
+uint16_t toSnorm16(float v) {
+    const float c = std::max(-1.0f, std::min(v, 1.0f));
+    return static_cast<uint16_t>(static_cast<int16_t>(std::lround(c * 32767.0f)));
+}
+
+// Rounds to the nearest half. Values out of the range become infinity, and
+// denormals are flushed to zero, which is enough for the radii and texcoords.
+uint16_t toHalf(float v) {
+    uint32_t bits;
+    std::memcpy(&bits, &v, sizeof(float));
+    const uint32_t sign = (bits >> 16) & 0x8000;
+    const int exponent = static_cast<int>((bits >> 23) & 0xff) - 127 + 15;
+    uint32_t mantissa = bits & 0x7fffff;
+    if (exponent <= 0) {
+        return static_cast<uint16_t>(sign);
+    }
+    if (exponent >= 31) {
+        return static_cast<uint16_t>(sign | 0x7c00);
+    }
+
+    uint32_t half = sign | (static_cast<uint32_t>(exponent) << 10) | (mantissa >> 13);
+    if ((mantissa & 0x1fff) > 0x1000 || ((mantissa & 0x1fff) == 0x1000 && (half & 1))) {
+        half++;
+    }
+    return static_cast<uint16_t>(half);
+}
+
+float fromHalf(uint16_t half) {
+    const uint32_t sign = static_cast<uint32_t>(half & 0x8000) << 16;
+    const uint32_t exponent = (half >> 10) & 0x1f;
+    const uint32_t mantissa = half & 0x3ff;
+    uint32_t bits = sign;
+    if (exponent == 31) {
+        bits |= 0x7f800000 | (mantissa << 13);
+    } else if (exponent != 0) {
+        bits |= ((exponent - 15 + 127) << 23) | (mantissa << 13);
+    }
+
+    float v;
+    std::memcpy(&v, &bits, sizeof(float));
+    return v;
+}
+
+// Octahedral mapping of the unit normal to [-1, 1]^2.
+void encodeOctahedral(const QVector3D& n, float* u, float* v) {
+    const float l1 = std::abs(n.x()) + std::abs(n.y()) + std::abs(n.z());
+    if (l1 == 0.0f) {
+        *u = 0.0f;
+        *v = 0.0f;
+        return;
+    }
+
+    float x = n.x() / l1;
+    float y = n.y() / l1;
+    if (n.z() < 0.0f) {
+        const float fx = (1.0f - std::abs(y)) * (x >= 0.0f ? 1.0f : -1.0f);
+        const float fy = (1.0f - std::abs(x)) * (y >= 0.0f ? 1.0f : -1.0f);
+        x = fx;
+        y = fy;
+    }
+    *u = x;
+    *v = y;
+}
+
+// Spreads 9 bits so that there are two zero bits between them.
+uint32_t spreadBits3(uint32_t x) {
+    x &= 0x3ff;
+    x = (x | (x << 16)) & 0x030000ff;
+    x = (x | (x <<  8)) & 0x0300f00f;
+    x = (x | (x <<  4)) & 0x030c30c3;
+    x = (x | (x <<  2)) & 0x09249249;
+    return x;
+}
+
+}  // anonymous namespace
+
+int sampleLevel(float radius, int numLevels) {
+    const int level = static_cast<int>(std::lround(std::log2(radius))) + 2;
+    return std::max(0, std::min(level, numLevels - 1));
+}
+
+void packSamples(const Sample* samples, int numSamples, const SampleBounds& bounds, int numLevels,
+                 std::vector<PackedSample>& packed, std::vector<int>& levelOffsets,
+                 bool isMortonOrder) {
+    const QVector3D invExtent(bounds.extent.x() > 0.0f ? 1.0f / bounds.extent.x() : 0.0f,
+                              bounds.extent.y() > 0.0f ? 1.0f / bounds.extent.y() : 0.0f,
+                              bounds.extent.z() > 0.0f ? 1.0f / bounds.extent.z() : 0.0f);
+
+    // Quantize the samples, and key them by the level and the Morton code.
+    std::vector<PackedSample> quantized;
+    std::vector<uint32_t> keys;
+    quantized.reserve(numSamples);
+    keys.reserve(numSamples);
+    levelOffsets.assign(numLevels + 1, 0);
+    for (int i = 0; i < numSamples; i++) {
+        const Sample& s = samples[i];
+        if (s.radius <= 0.0f) {
+            continue;
+        }
+
+        const QVector3D p = (s.position - bounds.origin) * invExtent;
+        const uint16_t px = toUnorm16(p.x());
+        const uint16_t py = toUnorm16(p.y());
+        const uint16_t pz = toUnorm16(p.z());
+
+        float u, v;
+        encodeOctahedral(s.normal, &u, &v);
+
+        // The level follows from the rounded radius as on the GPU, which may
+        // move the samples near the boundary of the levels.
+        const uint16_t radius = toHalf(s.radius);
+        const int level = sampleLevel(fromHalf(radius), numLevels);
+
+        PackedSample ps;
+        ps.words[0] = px | (static_cast<uint32_t>(py) << 16);
+        ps.words[1] = pz | (static_cast<uint32_t>(radius) << 16);
+        ps.words[2] = toSnorm16(u) | (static_cast<uint32_t>(toSnorm16(v)) << 16);
+        ps.words[3] = toHalf(s.texcoord.x()) | (static_cast<uint32_t>(toHalf(s.texcoord.y())) << 16);
+        quantized.push_back(ps);
+
+        // Without the Morton code, the keys are sorted by a single pass.
+        if (isMortonOrder) {
+            const uint32_t morton = spreadBits3(px >> (16 - MORTON_BITS)) |
+                                    (spreadBits3(py >> (16 - MORTON_BITS)) << 1) |
+                                    (spreadBits3(pz >> (16 - MORTON_BITS)) << 2);
+            keys.push_back((static_cast<uint32_t>(level) << MORTON_LEVEL_SHIFT) | morton);
+        } else {
+            keys.push_back(static_cast<uint32_t>(level));
+        }
+        levelOffsets[level + 1]++;
+    }
+    for (int l = 0; l < numLevels; l++) {
+        levelOffsets[l + 1] += levelOffsets[l];
+    }
+
+    // LSD radix sort of the sample indices by the keys, which is stable and
+    // linear in the number of samples.
+    const int count = static_cast<int>(keys.size());
+    std::vector<uint32_t> order(count), swap(count);
+    for (int i = 0; i < count; i++) {
+        order[i] = static_cast<uint32_t>(i);
+    }
+
+    uint32_t maxKey = 0;
+    for (uint32_t key : keys) {
+        maxKey = std::max(maxKey, key);
+    }
+    for (int shift = 0; shift < 32 && (maxKey >> shift) != 0; shift += RADIX_BITS) {
+        int histogram[(1 << RADIX_BITS) + 1] = { 0 };
+        for (uint32_t key : keys) {
+            histogram[((key >> shift) & ((1 << RADIX_BITS) - 1)) + 1]++;
+        }
+        for (int b = 0; b < (1 << RADIX_BITS); b++) {
+            histogram[b + 1] += histogram[b];
+        }
+        for (int i = 0; i < count; i++) {
+            const uint32_t key = keys[order[i]];
+            swap[histogram[(key >> shift) & ((1 << RADIX_BITS) - 1)]++] = order[i];
+        }
+        order.swap(swap);
+    }
+
+    packed.resize(count);
+    for (int i = 0; i < count; i++) {
+        packed[i] = quantized[order[i]];
+    }
+}
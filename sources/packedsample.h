@@ -0,0 +1,53 @@
+#ifdef _MSC_VER
+#pragma once
+#endif
+
+#ifndef _PACKED_SAMPLE_H_
+#define _PACKED_SAMPLE_H_
+
+#include <cstdint>
+#include <vector>
+
+#include <QtGui/qvector3d.h>
+
+#include "samplehierarchy.h"
+
+// Sample in 16 bytes for the GPU. The words hold
+//   0: position x and y, 1: position z and radius,
+//   2: octahedral normal, 3: texcoord,
+// where the position is a 16-bit unorm relative to the bounds of the mesh,
+// the normal is a pair of 16-bit snorms, and the radius and the texcoord
+// are halfs. The level of the sample follows from the radius. The shaders
+// decode the samples by the functions of "shaders/common.glsl".
+struct PackedSample {
+    uint32_t words[4];
+};
+
+static_assert(sizeof(PackedSample) == 16, "PackedSample must be 16 bytes");
+
+// Box to which the positions are quantized.
+struct SampleBounds {
+    QVector3D origin;
+    QVector3D extent;
+};
+
+// Segments of the sample buffers, which are drawn into the levels of the
+// multiresolution splatting. The segment s holds the samples of the level
+// s, and the last one those of all the coarser levels.
+static constexpr int SAMPLE_SEGMENTS = 4;
+
+// Level of the sample in the table of the splat sizes, whose radius is
+// 2^(level - 2).
+int sampleLevel(float radius, int numLevels);
+
+// Packs the samples ordered by the level and then along the Morton curve
+// of their positions, or in the given order within every level when
+// "isMortonOrder" is false. Samples of zero radius are dropped. The samples of
+// the level l occupy [levelOffsets[l], levelOffsets[l + 1]). Levels from
+// "numLevels - 1" on are packed together, so that "SAMPLE_SEGMENTS" gives
+// the offsets of the segments.
+void packSamples(const Sample* samples, int numSamples, const SampleBounds& bounds, int numLevels,
+                 std::vector<PackedSample>& packed, std::vector<int>& levelOffsets,
+                 bool isMortonOrder = true);
+
+#endif  // _PACKED_SAMPLE_H_
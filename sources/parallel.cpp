@@ -0,0 +1,98 @@
+#include "parallel.h"
+
+ThreadPool& ThreadPool::instance() {
+    static ThreadPool pool;
+    return pool;
+}
+
+ThreadPool::ThreadPool() {
+    // The calling thread takes the place of one worker.
+    const int nWorkers = numWorkerThreads() - 1;
+    workers_.reserve(nWorkers);
+    for (int t = 0; t < nWorkers; t++) {
+        workers_.emplace_back(&ThreadPool::work, this);
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        isQuit_ = true;
+    }
+    wake_.notify_all();
+    for (auto& w : workers_) {
+        w.join();
+    }
+}
+
+void ThreadPool::run(int begin, int end, int grain, const std::function<void(int, int)>& func) {
+    if (begin >= end) {
+        return;
+    }
+
+    if (workers_.empty() || end - begin <= grain) {
+        func(begin, end);
+        return;
+    }
+
+    Job job;
+    job.func = &func;
+    job.end = end;
+    job.grain = grain;
+    job.next = begin;
+    job.numWorkers = 0;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        jobs_.push_back(&job);
+    }
+    wake_.notify_all();
+
+    runChunks(job);
+
+    // All the chunks are claimed here. The job is withdrawn so that no more
+    // workers join it, and those still running their chunks are waited for.
+    std::unique_lock<std::mutex> lock(mutex_);
+    jobs_.erase(std::find(jobs_.begin(), jobs_.end(), &job));
+    done_.wait(lock, [&job]() { return job.numWorkers == 0; });
+}
+
+void ThreadPool::work() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    for (;;) {
+        Job* job = nullptr;
+        wake_.wait(lock, [this, &job]() {
+            job = findJob();
+            return isQuit_ || job != nullptr;
+        });
+        if (isQuit_) {
+            return;
+        }
+
+        job->numWorkers++;
+        lock.unlock();
+        runChunks(*job);
+        lock.lock();
+        if (--job->numWorkers == 0) {
+            done_.notify_all();
+        }
+    }
+}
+
+ThreadPool::Job* ThreadPool::findJob() const {
+    for (Job* job : jobs_) {
+        if (job->next.load() < job->end) {
+            return job;
+        }
+    }
+    return nullptr;
+}
+
+void ThreadPool::runChunks(Job& job) {
+    for (;;) {
+        const int first = job.next.fetch_add(job.grain);
+        if (first >= job.end) {
+            return;
+        }
+        (*job.func)(first, std::min(job.end, first + job.grain));
+    }
+}
@@ -0,0 +1,80 @@
+#ifdef _MSC_VER
+#pragma once
+#endif
+
+#ifndef _PARALLEL_H_
+#define _PARALLEL_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <algorithm>
+
+inline int numWorkerThreads() {
+    const int n = static_cast<int>(std::thread::hardware_concurrency());
+    return std::max(1, n);
+}
+
+// Persistent worker threads shared by all the parallel loops. The thread
+// calling "run()" works on its own loop too, so that loops submitted from
+// several threads at once (the sample builder and the per-frame cut) make
+// progress even when the workers are busy with the other one.
+class ThreadPool {
+public:
+    static ThreadPool& instance();
+
+    // Calls "func(first, last)" for chunks of "grain" indices covering
+    // [begin, end). Chunks are claimed from an atomic counter, so they are
+    // balanced over the threads however their costs differ.
+    void run(int begin, int end, int grain, const std::function<void(int, int)>& func);
+
+private:
+    struct Job {
+        const std::function<void(int, int)>* func;
+        int end;
+        int grain;
+        std::atomic<int> next;
+        int numWorkers;  // Guarded by "mutex_"
+    };
+
+    ThreadPool();
+    ~ThreadPool();
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    void work();
+    Job* findJob() const;
+    static void runChunks(Job& job);
+
+    std::vector<std::thread> workers_;
+    std::vector<Job*> jobs_;
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    std::condition_variable done_;
+    bool isQuit_ = false;
+};
+
+// Calls "func(i)" for every i in [begin, end) on the thread pool. Indices
+// are processed in any order and by any thread, so "func" must write its
+// result to a place determined by i alone (its own slot or its prefix-sum
+// offset) to keep the result independent of the scheduling.
+template <class Func>
+void parallelFor(int begin, int end, const Func& func) {
+    const int count = end - begin;
+    if (count <= 0) {
+        return;
+    }
+
+    // Several chunks per thread leave room for the balancing.
+    const int grain = std::max(1, count / (numWorkerThreads() * 8));
+    ThreadPool::instance().run(begin, end, grain, [&func](int first, int last) {
+        for (int i = first; i < last; i++) {
+            func(i);
+        }
+    });
+}
+
+#endif  // _PARALLEL_H_
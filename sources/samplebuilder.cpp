@@ -0,0 +1,578 @@
+#include "samplebuilder.h"
+
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <algorithm>
+
+#include "parallel.h"
+
+namespace {
+
+// Size of the tiles on the finest level, which must be a multiple of the
+// footprint of a coarsest texel.
+static const int tileSize = 64;
+static const int maxPyrLevels = 3;
+
+bool isSameParams(const HierarchyParams& p1, const HierarchyParams& p2) {
+    return p1.alpha == p2.alpha && p1.Rw == p2.Rw && p1.RPx == p2.RPx &&
+           p1.z0 == p2.z0 && p1.T == p2.T && p1.budget == p2.budget && p1.texelScale == p2.texelScale;
+}
+
+// The budgeted selection starts from the level of a few texels.
+int budgetPyrLevels(int width, int height) {
+    int levels = maxPyrLevels;
+    while ((std::min(width, height) >> levels) >= 4) {
+        levels++;
+    }
+    return levels;
+}
+
+}  // anonymous namespace
+
+SampleBuilder::SampleBuilder(const SampleBounds& bounds, const std::string& cacheDirectory)
+    : bounds_{ bounds } {
+    if (!cacheDirectory.empty()) {
+        cache_ = std::make_unique<SampleCache>(cacheDirectory);
+    }
+    worker_ = std::thread([this]() { run(); });
+}
+
+SampleBuilder::~SampleBuilder() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        isStopped_ = true;
+    }
+    cond_.notify_one();
+    worker_.join();
+}
+
+void SampleBuilder::submit(const ReadbackView* views, const QMatrix4x4& mvpMat, bool isIncremental,
+                           const QVector3D& lightPos, const HierarchyParams& params,
+                           const std::string& cacheKey) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        copyViews(views);
+        pending_.mvpMat = mvpMat;
+        pending_.isIncremental = isIncremental;
+        pending_.lightPos = lightPos;
+        pending_.params   = params;
+        pending_.cacheKey = cacheKey;
+        pending_.tile = -1;
+        pending_.numTiles = 0;
+        pending_.generation = generation_;
+        hasPending_ = true;
+        isBusy_ = true;
+    }
+    cond_.notify_one();
+}
+
+void SampleBuilder::submitTile(const ReadbackView* views, const QMatrix4x4& mvpMat, int tile, int numTiles,
+                               const QVector3D& lightPos, const HierarchyParams& params,
+                               const std::string& cacheKey) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        copyViews(views);
+        pending_.mvpMat = mvpMat;
+        pending_.isIncremental = false;
+        pending_.lightPos = lightPos;
+        pending_.params   = params;
+        pending_.cacheKey = cacheKey;
+        pending_.tile = tile;
+        pending_.numTiles = numTiles;
+        pending_.generation = generation_;
+        hasPending_ = true;
+        isBusy_ = true;
+    }
+    cond_.notify_one();
+}
+
+void SampleBuilder::cancel() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    generation_++;
+}
+
+bool SampleBuilder::isPending() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return hasPending_;
+}
+
+void SampleBuilder::copyViews(const ReadbackView* views) {
+    pending_.width  = views[0].width;
+    pending_.height = views[0].height;
+    for (int i = 0; i < GBUF_NUM_IMAGES; i++) {
+        const size_t count = static_cast<size_t>(views[i].width) * views[i].height * views[i].channels;
+        pending_.images[i].resize(count);
+        std::memcpy(pending_.images[i].data(), views[i].data, sizeof(float) * count);
+        pending_.channels[i] = views[i].channels;
+    }
+}
+
+bool SampleBuilder::fetch() {
+    // The generation is only changed by this thread.
+    return results_.update() && results_.front().generation == generation_;
+}
+
+void SampleBuilder::run() {
+    for (;;) {
+        bool isCanceled = false;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            cond_.wait(lock, [this]() { return hasPending_ || isStopped_; });
+            if (isStopped_) {
+                return;
+            }
+
+            // Take the newest snapshot. Buffers are swapped to avoid copies.
+            std::swap(working_, pending_);
+            hasPending_ = false;
+            isCanceled = working_.generation != generation_;
+        }
+
+        // A canceled snapshot is dropped, and the previous one is kept.
+        if (!isCanceled) {
+            // The budget is shared by the whole buffer, so it cannot be updated per tile.
+            if (working_.tile >= 0) {
+                buildTile(working_);
+            } else if (working_.isIncremental && working_.params.budget <= 0 && !isTreeEnabled_) {
+                buildIncremental(working_);
+            } else {
+                build(working_);
+            }
+
+            // Keep the snapshot to find the changes of the next one. The tiles
+            // of a larger buffer are not compared with the whole buffer.
+            std::swap(previous_, working_);
+            hasPrevious_ = previous_.tile < 0;
+        }
+
+        // The results are published before, so that they are fresh when the
+        // builder stops being busy.
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (!hasPending_) {
+                isBusy_ = false;
+            }
+        }
+    }
+}
+
+void SampleBuilder::build(const GBufferSnapshot& snapshot) {
+    // The finest level of the pyramid receives the G-buffers.
+    const bool isBudget = snapshot.params.budget > 0;
+    const int levels = isBudget ? budgetPyrLevels(snapshot.width, snapshot.height) : maxPyrLevels;
+    pyramid_.resize(snapshot.width, snapshot.height, levels);
+    copyTile(snapshot, 0, 0, snapshot.width, snapshot.height);
+
+    // Build all the pyramids (min/max depth, position, normal, texcoord) in one pass.
+    pyramid_.build();
+
+    // Select the irradiance samples, and publish them.
+    if (isBudget) {
+        hierarchy_.buildBudget(pyramid_, snapshot.lightPos, snapshot.params);
+    } else {
+        hierarchy_.build(pyramid_, snapshot.lightPos, snapshot.params);
+    }
+
+    SampleSet& result = results_.back();
+    const std::vector<Sample>& samples = hierarchy_.samples();
+    packSamples(samples.data(), static_cast<int>(samples.size()), bounds_, SAMPLE_SEGMENTS,
+                result.samples, result.segmentOffsets);
+    if (isTreeEnabled_) {
+        auto tree = std::make_shared<SampleTree>();
+        tree->build(pyramid_, snapshot.params.texelScale);
+        result.tree = tree;
+    } else {
+        result.tree.reset();
+    }
+    result.blockVersions.clear();
+    result.layoutVersion = 0;
+    result.version = ++version_;
+    result.numTiles = 0;
+    result.numUpdatedTiles = 0;
+    result.workingBytes = workingBytes(snapshot);
+    result.generation = snapshot.generation;
+    results_.publish();
+
+    // Writing the cache is left to the worker, since it may take a while.
+    if (cache_ && !snapshot.cacheKey.empty()) {
+        if (!cache_->save(snapshot.cacheKey, hierarchy_.samples())) {
+            std::cerr << "Failed to save the sample cache." << std::endl;
+        }
+    }
+
+    // The next incremental build starts from scratch.
+    rangeBegins_.clear();
+}
+
+void SampleBuilder::buildTile(const GBufferSnapshot& snapshot) {
+    if (!tiledGenerator_ || tiledGenerator_->tileSize() != snapshot.width) {
+        tiledGenerator_ = std::make_unique<TiledSampleGenerator>(snapshot.width);
+    }
+    if (snapshot.tile == 0) {
+        tiledGenerator_->begin();
+    }
+
+    ReadbackView views[GBUF_NUM_IMAGES];
+    for (int i = 0; i < GBUF_NUM_IMAGES; i++) {
+        views[i].data     = snapshot.images[i].data();
+        views[i].width    = snapshot.width;
+        views[i].height   = snapshot.height;
+        views[i].channels = snapshot.channels[i];
+    }
+    tiledGenerator_->addTile(views, snapshot.mvpMat, snapshot.lightPos, snapshot.params);
+    if (snapshot.tile < snapshot.numTiles - 1) {
+        return;
+    }
+
+    // All the tiles have been added.
+    SampleSet& result = results_.back();
+    const std::vector<Sample>& samples = tiledGenerator_->samples();
+    packSamples(samples.data(), static_cast<int>(samples.size()), bounds_, SAMPLE_SEGMENTS,
+                result.samples, result.segmentOffsets);
+    result.tree.reset();
+    result.blockVersions.clear();
+    result.layoutVersion = 0;
+    result.version = ++version_;
+    result.numTiles = 0;
+    result.numUpdatedTiles = 0;
+    result.workingBytes = workingBytes(snapshot);
+    result.generation = snapshot.generation;
+    results_.publish();
+
+    if (cache_ && !snapshot.cacheKey.empty()) {
+        if (!cache_->save(snapshot.cacheKey, samples)) {
+            std::cerr << "Failed to save the sample cache." << std::endl;
+        }
+    }
+    rangeBegins_.clear();
+}
+
+void SampleBuilder::buildIncremental(const GBufferSnapshot& snapshot) {
+    const bool isResized = pyramid_.levels() != maxPyrLevels ||
+                           pyramid_.width(maxPyrLevels - 1) != snapshot.width ||
+                           pyramid_.height(maxPyrLevels - 1) != snapshot.height;
+    pyramid_.resize(snapshot.width, snapshot.height, maxPyrLevels);
+    if (isResized || hierarchy_.tileSize() != tileSize) {
+        hierarchy_.resizeTiles(pyramid_, tileSize);
+    }
+
+    const int tilesX = hierarchy_.numTilesX();
+    const int numTiles = hierarchy_.numTiles();
+    const bool isFull = !hasPrevious_ || isResized || rangeBegins_.empty();
+    if (isFull) {
+        tileCovered_.assign(numTiles, 0);
+        tilePacked_.assign(numTiles, std::vector<PackedSample>());
+        tileSegments_.assign(numTiles, std::vector<int>(SAMPLE_SEGMENTS + 1, 0));
+    }
+
+    // Find the tiles whose G-buffers have changed, and update their pyramids.
+    std::vector<char> isDataDirty(numTiles, 0);
+    parallelFor(0, numTiles, [&](int t) {
+        const int x0 = (t % tilesX) * tileSize;
+        const int y0 = (t / tilesX) * tileSize;
+        const int x1 = std::min(x0 + tileSize, snapshot.width);
+        const int y1 = std::min(y0 + tileSize, snapshot.height);
+        if (!isFull && !isTileChanged(snapshot, x0, y0, x1, y1)) {
+            return;
+        }
+
+        isDataDirty[t] = 1;
+        copyTile(snapshot, x0, y0, x1, y1);
+        pyramid_.build(x0, y0, x1, y1);
+
+        // The clear value of the minimum depth remains where the mesh is missing.
+        bool isCovered = false;
+        const float* minDepth = pyramid_.plane(maxPyrLevels - 1, GBUF_MIN_DEPTH);
+        for (int y = y0; y < y1 && !isCovered; y++) {
+            for (int x = x0; x < x1; x++) {
+                if (minDepth[y * snapshot.width + x] < 1.0f) {
+                    isCovered = true;
+                    break;
+                }
+            }
+        }
+        tileCovered_[t] = isCovered ? 1 : 0;
+    });
+
+    // Moving the light may change the selection of every tile showing the
+    // mesh, while empty tiles never produce samples. Only the tiles whose
+    // samples have actually changed are updated, which are those where the
+    // selection crosses its thresholds for the light buffers kept the same.
+    const bool isLightDirty = isFull || previous_.lightPos != snapshot.lightPos ||
+                              !isSameParams(previous_.params, snapshot.params);
+    std::vector<int> tiles;
+    for (int t = 0; t < numTiles; t++) {
+        if (isDataDirty[t] || (isLightDirty && tileCovered_[t])) {
+            tiles.push_back(t);
+        }
+    }
+    hierarchy_.buildTiles(pyramid_, snapshot.lightPos, snapshot.params, tiles);
+
+    std::vector<char> isChanged(tiles.size(), 0);
+    parallelFor(0, static_cast<int>(tiles.size()), [&](int i) {
+        isChanged[i] = packTile(tiles[i]) ? 1 : 0;
+    });
+    std::vector<int> updated;
+    for (size_t i = 0; i < tiles.size(); i++) {
+        if (isChanged[i]) {
+            updated.push_back(tiles[i]);
+        }
+    }
+
+    // Patch the updated tiles, where a range which does not fit is moved to
+    // the spare room of its segment. All the tiles are laid out again when
+    // the spare room runs out.
+    version_++;
+    bool isOverflow = isFull;
+    for (int t : updated) {
+        for (int s = 0; s < SAMPLE_SEGMENTS && !isOverflow; s++) {
+            const int r = s * numTiles + t;
+            const int count = tileSegments_[t][s + 1] - tileSegments_[t][s];
+            if (count > rangeCapacities_[r] && !moveRange(r, count)) {
+                isOverflow = true;
+            }
+        }
+    }
+
+    if (isOverflow) {
+        layoutTiles();
+    } else {
+        for (int t : updated) {
+            writeTile(t);
+        }
+    }
+
+    SampleSet& result = results_.back();
+    result.samples.assign(tiledSamples_.begin(), tiledSamples_.end());
+    result.segmentOffsets = segmentOffsets_;
+    result.tree.reset();
+    result.blockVersions = blockVersions_;
+    result.layoutVersion = layoutVersion_;
+    result.version = version_;
+    result.numTiles = numTiles;
+    result.numUpdatedTiles = static_cast<int>(updated.size());
+    result.workingBytes = workingBytes(snapshot);
+    result.generation = snapshot.generation;
+    results_.publish();
+}
+
+bool SampleBuilder::isTileChanged(const GBufferSnapshot& snapshot, int x0, int y0, int x1, int y1) const {
+    for (int i = 0; i < GBUF_NUM_IMAGES; i++) {
+        const int channels = snapshot.channels[i];
+        if (channels != previous_.channels[i]) {
+            return true;
+        }
+
+        const size_t rowBytes = sizeof(float) * (x1 - x0) * channels;
+        for (int y = y0; y < y1; y++) {
+            // Images are stored bottom-up.
+            const size_t offset = (static_cast<size_t>(snapshot.height - y - 1) * snapshot.width + x0) * channels;
+            if (std::memcmp(&snapshot.images[i][offset], &previous_.images[i][offset], rowBytes) != 0) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+bool SampleBuilder::packTile(int tile) {
+    // The samples are sorted within every segment of the tile, so that the
+    // ranges of the tile are written without touching the other tiles.
+    const std::vector<Sample>& samples = hierarchy_.tileSamples(tile);
+    std::vector<PackedSample> packed;
+    std::vector<int> segments;
+    packSamples(samples.data(), static_cast<int>(samples.size()), bounds_, SAMPLE_SEGMENTS,
+                packed, segments);
+
+    // The samples are ordered deterministically, so that the same selection
+    // gives the same bytes.
+    const std::vector<PackedSample>& previous = tilePacked_[tile];
+    if (segments == tileSegments_[tile] && packed.size() == previous.size() &&
+        (packed.empty() || std::memcmp(packed.data(), previous.data(), sizeof(PackedSample) * packed.size()) == 0)) {
+        return false;
+    }
+
+    tilePacked_[tile].swap(packed);
+    tileSegments_[tile].swap(segments);
+    return true;
+}
+
+void SampleBuilder::layoutTiles() {
+    // Leave some room in every range so that small changes are patched in
+    // place, and some spare room in every segment for the ranges outgrowing
+    // theirs.
+    const int numTiles = hierarchy_.numTiles();
+    rangeBegins_.resize(SAMPLE_SEGMENTS * numTiles);
+    rangeCapacities_.resize(SAMPLE_SEGMENTS * numTiles);
+    segmentOffsets_.assign(SAMPLE_SEGMENTS + 1, 0);
+    spareBegins_.resize(SAMPLE_SEGMENTS);
+    int offset = 0;
+    for (int s = 0; s < SAMPLE_SEGMENTS; s++) {
+        segmentOffsets_[s] = offset;
+        for (int t = 0; t < numTiles; t++) {
+            const int r = s * numTiles + t;
+            const int count = tileSegments_[t][s + 1] - tileSegments_[t][s];
+            rangeBegins_[r] = offset;
+            rangeCapacities_[r] = tileCovered_[t] ? count + count / 4 + 16 : count;
+            offset += rangeCapacities_[r];
+        }
+        spareBegins_[s] = offset;
+        offset += (offset - segmentOffsets_[s]) / 2 + SAMPLE_BLOCK_SIZE;
+    }
+    segmentOffsets_[SAMPLE_SEGMENTS] = offset;
+
+    const PackedSample empty = {};
+    tiledSamples_.assign(offset, empty);
+    blockVersions_.assign((offset + SAMPLE_BLOCK_SIZE - 1) / SAMPLE_BLOCK_SIZE, version_);
+    for (int t = 0; t < numTiles; t++) {
+        writeTile(t);
+    }
+    layoutVersion_++;
+}
+
+bool SampleBuilder::moveRange(int range, int count) {
+    // The range is given twice the room it needs, since the selection moving
+    // with the light tends to grow the same tiles again.
+    const int s = range / hierarchy_.numTiles();
+    const int capacity = count * 2 + 16;
+    if (spareBegins_[s] + capacity > segmentOffsets_[s + 1]) {
+        return false;
+    }
+
+    // The old range is cleared, and is left unused until the next layout.
+    const PackedSample empty = {};
+    const int first = rangeBegins_[range];
+    std::fill(tiledSamples_.data() + first, tiledSamples_.data() + first + rangeCapacities_[range], empty);
+    touchSamples(first, first + rangeCapacities_[range]);
+
+    rangeBegins_[range] = spareBegins_[s];
+    rangeCapacities_[range] = capacity;
+    spareBegins_[s] += capacity;
+    return true;
+}
+
+void SampleBuilder::writeTile(int tile) {
+    const int numTiles = hierarchy_.numTiles();
+    const std::vector<PackedSample>& packed = tilePacked_[tile];
+    const std::vector<int>& segments = tileSegments_[tile];
+    const PackedSample empty = {};
+    for (int s = 0; s < SAMPLE_SEGMENTS; s++) {
+        const int r = s * numTiles + tile;
+        const int first = rangeBegins_[r];
+        const int last  = first + rangeCapacities_[r];
+        PackedSample* out = tiledSamples_.data() + first;
+        std::copy(packed.begin() + segments[s], packed.begin() + segments[s + 1], out);
+        std::fill(out + (segments[s + 1] - segments[s]), tiledSamples_.data() + last, empty);
+        touchSamples(first, last);
+    }
+}
+
+void SampleBuilder::touchSamples(int first, int last) {
+    if (last <= first) {
+        return;
+    }
+    for (int b = first / SAMPLE_BLOCK_SIZE; b <= (last - 1) / SAMPLE_BLOCK_SIZE; b++) {
+        blockVersions_[b] = version_;
+    }
+}
+
+size_t SampleBuilder::workingBytes(const GBufferSnapshot& snapshot) const {
+    // The pending, working and previous snapshots are of the same size
+    // while the light buffers are not resized.
+    size_t snapshotBytes = 0;
+    for (const auto& image : snapshot.images) {
+        snapshotBytes += sizeof(float) * image.capacity();
+    }
+
+    size_t bytes = snapshotBytes * 3 + pyramid_.memoryBytes() + hierarchy_.memoryBytes();
+    if (tiledGenerator_) {
+        bytes += tiledGenerator_->peakWorkingBytes();
+    }
+
+    // Packed samples kept by the incremental mode.
+    bytes += sizeof(PackedSample) * tiledSamples_.capacity();
+    for (const auto& packed : tilePacked_) {
+        bytes += sizeof(PackedSample) * packed.capacity();
+    }
+    return bytes;
+}
+
+void SampleBuilder::copyTile(const GBufferSnapshot& snapshot, int x0, int y0, int x1, int y1) {
+    ReadbackView views[GBUF_NUM_IMAGES];
+    for (int i = 0; i < GBUF_NUM_IMAGES; i++) {
+        views[i].data     = snapshot.images[i].data();
+        views[i].width    = snapshot.width;
+        views[i].height   = snapshot.height;
+        views[i].channels = snapshot.channels[i];
+    }
+    copyGBuffers(pyramid_, views, snapshot.mvpMat, x0, y0, x1, y1);
+}
+
+void copyGBuffers(GBufferPyramid& pyramid, const ReadbackView* views, const QMatrix4x4& mvpMat,
+                  int x0, int y0, int x1, int y1) {
+    const int finest = pyramid.levels() - 1;
+    const int width  = pyramid.width(finest);
+    const int height = pyramid.height(finest);
+    float* minDepthPlanes[] = { pyramid.plane(finest, GBUF_MIN_DEPTH) };
+    float* maxDepthPlanes[] = { pyramid.plane(finest, GBUF_MAX_DEPTH) };
+    float* normalPlanes[]   = { pyramid.plane(finest, GBUF_NORMAL_X),
+                                pyramid.plane(finest, GBUF_NORMAL_Y) };
+    float* texCoordPlanes[] = { pyramid.plane(finest, GBUF_TEXCOORD_U),
+                                pyramid.plane(finest, GBUF_TEXCOORD_V) };
+    float* const* planes[] = { minDepthPlanes, maxDepthPlanes, normalPlanes, texCoordPlanes };
+
+    for (int i = 0; i < GBUF_NUM_IMAGES; i++) {
+        views[i].copyToPlanes(planes[i], x0, y0, x1, y1);
+    }
+
+    // Columns of the inverse matrix, which maps the normalized device
+    // coordinates of the texel centers to the positions. Rows of the planes
+    // are flipped from those of OpenGL.
+    const QMatrix4x4 invMat = mvpMat.inverted();
+    const float* m = invMat.constData();
+
+    float* minDepth = minDepthPlanes[0];
+    float* maxDepth = maxDepthPlanes[0];
+    float* px = pyramid.plane(finest, GBUF_POSITION_X);
+    float* py = pyramid.plane(finest, GBUF_POSITION_Y);
+    float* pz = pyramid.plane(finest, GBUF_POSITION_Z);
+    float* nx = pyramid.plane(finest, GBUF_NORMAL_X);
+    float* ny = pyramid.plane(finest, GBUF_NORMAL_Y);
+    float* nz = pyramid.plane(finest, GBUF_NORMAL_Z);
+    for (int y = y0; y < y1; y++) {
+        const float ndcY = 1.0f - 2.0f * (y + 0.5f) / height;
+        for (int x = x0; x < x1; x++) {
+            const int i = y * width + x;
+
+            // Texels without fragments take the values of the cleared buffers.
+            maxDepth[i] = maxDepth[i] == 0.0f ? 1.0f : maxDepth[i] * 2.0f - 1.0f;
+            if (minDepth[i] >= 1.0f) {
+                px[i] = py[i] = pz[i] = 0.0f;
+                nx[i] = ny[i] = nz[i] = 0.0f;
+                continue;
+            }
+
+            const float ndcX = 2.0f * (x + 0.5f) / width - 1.0f;
+            const float ndcZ = minDepth[i] * 2.0f - 1.0f;
+            minDepth[i] = ndcZ;
+
+            const float invW = 1.0f / (m[3] * ndcX + m[7] * ndcY + m[11] * ndcZ + m[15]);
+            px[i] = (m[0] * ndcX + m[4] * ndcY + m[ 8] * ndcZ + m[12]) * invW;
+            py[i] = (m[1] * ndcX + m[5] * ndcY + m[ 9] * ndcZ + m[13]) * invW;
+            pz[i] = (m[2] * ndcX + m[6] * ndcY + m[10] * ndcZ + m[14]) * invW;
+
+            // Octahedral mapping back to the unit normal.
+            float ex = nx[i] * 2.0f - 1.0f;
+            float ey = ny[i] * 2.0f - 1.0f;
+            const float ez = 1.0f - std::abs(ex) - std::abs(ey);
+            const float t = std::max(-ez, 0.0f);
+            ex += ex >= 0.0f ? -t : t;
+            ey += ey >= 0.0f ? -t : t;
+            const float invLength = 1.0f / std::sqrt(ex * ex + ey * ey + ez * ez);
+            nx[i] = ex * invLength;
+            ny[i] = ey * invLength;
+            nz[i] = ez * invLength;
+        }
+    }
+}
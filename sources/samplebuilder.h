@@ -0,0 +1,191 @@
+#ifdef _MSC_VER
+#pragma once
+#endif
+
+#ifndef _SAMPLE_BUILDER_H_
+#define _SAMPLE_BUILDER_H_
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include <QtGui/qmatrix4x4.h>
+
+#include "gbufferreadback.h"
+#include "imagepyramid.h"
+#include "packedsample.h"
+#include "samplehierarchy.h"
+#include "samplecache.h"
+#include "sampletree.h"
+#include "tiledsamplegenerator.h"
+#include "triplebuffer.h"
+
+// Images read back from the light buffers. The depths are those of the depth
+// buffer in [0, 1], where the maximum depth is zero for the texels without
+// fragments, and the normals are stored by the octahedral mapping to
+// [0, 1]^2. The positions are reconstructed from the minimum depth.
+enum GBufferImage : int {
+    GBUF_IMAGE_MIN_DEPTH = 0,
+    GBUF_IMAGE_MAX_DEPTH,
+    GBUF_IMAGE_NORMAL,
+    GBUF_IMAGE_TEXCOORD,
+    GBUF_NUM_IMAGES
+};
+
+// Copy of the read back G-buffers with the parameters used to build samples.
+struct GBufferSnapshot {
+    int width  = 0;
+    int height = 0;
+    std::vector<float> images[GBUF_NUM_IMAGES];
+    int channels[GBUF_NUM_IMAGES] = { 0 };
+    QMatrix4x4 mvpMat;
+    bool isIncremental = false;
+    QVector3D lightPos;
+    HierarchyParams params;
+    std::string cacheKey;
+
+    // Index of the tile of a larger light buffer and the number of its
+    // tiles, or -1 for the whole buffer.
+    int tile = -1;
+    int numTiles = 0;
+
+    // Generation of the builder when the snapshot was submitted.
+    unsigned long long generation = 0;
+};
+
+// Number of samples whose version is tracked together.
+static constexpr int SAMPLE_BLOCK_SIZE = 1024;
+
+// Set of samples published by the worker, which are packed for the GPU. The
+// samples of the segment s occupy [segmentOffsets[s], segmentOffsets[s + 1]).
+// In the incremental mode, every segment holds a range of room for every
+// tile of the light buffers, and unused entries have zero radius. The block
+// of the samples [b, b + 1) * SAMPLE_BLOCK_SIZE whose version differs from
+// the uploaded one has to be uploaded again, and a change of "layoutVersion"
+// requires to upload all the samples. The tree of all the covered texels is
+// attached if it is enabled. "workingBytes" is the memory held by the worker
+// to build the set, which excludes the published samples.
+struct SampleSet {
+    std::vector<PackedSample> samples;
+    std::vector<int> segmentOffsets;
+    std::shared_ptr<const SampleTree> tree;
+    std::vector<unsigned long long> blockVersions;
+    unsigned long long layoutVersion = 0;
+    unsigned long long version = 0;
+    int numTiles = 0;
+    int numUpdatedTiles = 0;
+    size_t workingBytes = 0;
+    unsigned long long generation = 0;
+};
+
+// Copies the read back G-buffers to the finest level of the pyramid. The
+// depths are converted to the normalized device coordinates, the normals are
+// decoded, and the positions are reconstructed by the inverse of "mvpMat",
+// by which the G-buffers were rendered.
+void copyGBuffers(GBufferPyramid& pyramid, const ReadbackView* views, const QMatrix4x4& mvpMat,
+                  int x0, int y0, int x1, int y1);
+
+// Builds the sample hierarchy on a worker thread. The GUI thread hands a
+// snapshot of the read back G-buffers to "submit()", and takes the newest
+// finished sample set with "fetch()". The results are passed through a
+// lock-free triple buffer, so that the GUI thread never waits for the worker.
+// The samples are also packed to "bounds" and sorted on the worker.
+class SampleBuilder {
+public:
+    explicit SampleBuilder(const SampleBounds& bounds, const std::string& cacheDirectory = std::string());
+    virtual ~SampleBuilder();
+
+    // Copies the mapped G-buffers. Views are indexed by "GBufferImage".
+    // The samples are saved to the cache when the key is not empty.
+    void submit(const ReadbackView* views, const QMatrix4x4& mvpMat, bool isIncremental,
+                const QVector3D& lightPos, const HierarchyParams& params,
+                const std::string& cacheKey = std::string());
+
+    // Copies the mapped G-buffers of one tile of a light buffer which is too
+    // large to be read back at once. The tiles must be submitted in order,
+    // and the samples of all of them are published with the last one. A
+    // tile replaces the snapshot which has not been taken yet, so that the
+    // next one should be submitted only when "isPending()" is false.
+    void submitTile(const ReadbackView* views, const QMatrix4x4& mvpMat, int tile, int numTiles,
+                    const QVector3D& lightPos, const HierarchyParams& params,
+                    const std::string& cacheKey = std::string());
+
+    // The tree is built by full builds only, so incremental builds are
+    // disabled while it is enabled.
+    inline void setTreeEnabled(bool isEnabled) { isTreeEnabled_ = isEnabled; }
+
+    // Takes the newest sample set, and returns false if there is none or it
+    // is of a snapshot submitted before the last "cancel()".
+    bool fetch();
+    inline const SampleSet& sampleSet() const { return results_.front(); }
+
+    // Drops the snapshots submitted so far. The one not taken yet is not
+    // built, and the samples of those being built are not fetched, e.g.,
+    // when the samples are loaded from the cache instead.
+    void cancel();
+
+    // Whether a submitted snapshot is still being built, or its samples have
+    // not been fetched yet.
+    inline bool isBusy() const { return isBusy_ || results_.isFresh(); }
+
+    // Whether the submitted snapshot has not been taken by the worker yet.
+    bool isPending();
+
+private:
+    void copyViews(const ReadbackView* views);
+    void run();
+    void build(const GBufferSnapshot& snapshot);
+    void buildTile(const GBufferSnapshot& snapshot);
+    void buildIncremental(const GBufferSnapshot& snapshot);
+    void copyTile(const GBufferSnapshot& snapshot, int x0, int y0, int x1, int y1);
+    bool isTileChanged(const GBufferSnapshot& snapshot, int x0, int y0, int x1, int y1) const;
+    bool packTile(int tile);
+    void layoutTiles();
+    bool moveRange(int range, int count);
+    void writeTile(int tile);
+    void touchSamples(int first, int last);
+    size_t workingBytes(const GBufferSnapshot& snapshot) const;
+
+    std::thread worker_;
+    std::mutex mutex_;
+    std::condition_variable cond_;
+    GBufferSnapshot pending_;
+    GBufferSnapshot working_;
+    GBufferSnapshot previous_;
+    bool hasPrevious_ = false;
+    bool hasPending_ = false;
+    unsigned long long generation_ = 0;
+    bool isStopped_  = false;
+    std::atomic<bool> isTreeEnabled_{ false };
+    std::atomic<bool> isBusy_{ false };
+
+    GBufferPyramid pyramid_;
+    SampleHierarchy hierarchy_;
+    std::unique_ptr<TiledSampleGenerator> tiledGenerator_ = nullptr;
+    TripleBuffer<SampleSet> results_;
+    unsigned long long version_ = 0;
+    std::unique_ptr<SampleCache> cache_ = nullptr;
+    SampleBounds bounds_;
+
+    // State of the incremental mode. The packed samples of every tile are
+    // kept to lay out the tiles again. The range of the segment s of the
+    // tile t, r = s * numTiles + t, starts at "rangeBegins_[r]", and the
+    // ranges which have outgrown their room are moved to the spare room
+    // from "spareBegins_[s]" to the end of the segment.
+    std::vector<PackedSample> tiledSamples_;
+    std::vector<std::vector<PackedSample>> tilePacked_;
+    std::vector<std::vector<int>> tileSegments_;
+    std::vector<int> rangeBegins_;
+    std::vector<int> rangeCapacities_;
+    std::vector<int> segmentOffsets_;
+    std::vector<int> spareBegins_;
+    std::vector<unsigned long long> blockVersions_;
+    std::vector<char> tileCovered_;
+    unsigned long long layoutVersion_ = 0;
+};
+
+#endif  // _SAMPLE_BUILDER_H_
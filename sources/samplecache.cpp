@@ -0,0 +1,123 @@
+#include "samplecache.h"
+
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+
+#include <QtCore/qdir.h>
+#include <QtCore/qsavefile.h>
+
+namespace {
+
+// The version must be increased whenever the layout of "Sample" or the
+// sample selection changes, so that older files are not used.
+static const char     CACHE_MAGIC[4] = { 'S', 'L', 'F', 'C' };
+static const uint32_t CACHE_VERSION  = 2;
+static const int      CACHE_KEY_SIZE = 64;
+
+struct CacheHeader {
+    char     magic[4];
+    uint32_t version;
+    uint32_t sampleSize;
+    uint32_t numSamples;
+    char     key[CACHE_KEY_SIZE];
+};
+
+}  // anonymous namespace
+
+SampleCache::SampleCache(const std::string& directory)
+    : directory_{ directory } {
+    QDir().mkpath(QString::fromStdString(directory));
+}
+
+SampleCache::~SampleCache() {
+    release();
+}
+
+bool SampleCache::load(const std::string& key) {
+    release();
+    if (key.size() > CACHE_KEY_SIZE) {
+        return false;
+    }
+
+    file_ = std::make_unique<QFile>(QString::fromStdString(filePath(key)));
+    if (!file_->exists() || !file_->open(QFile::ReadOnly)) {
+        file_.reset();
+        return false;
+    }
+
+    const qint64 size = file_->size();
+    if (size < static_cast<qint64>(sizeof(CacheHeader))) {
+        release();
+        return false;
+    }
+
+    mapped_ = file_->map(0, size);
+    if (!mapped_) {
+        release();
+        return false;
+    }
+
+    // Files of another version, or broken ones, are simply not used.
+    CacheHeader header;
+    std::memcpy(&header, mapped_, sizeof(CacheHeader));
+    char storedKey[CACHE_KEY_SIZE] = { 0 };
+    std::memcpy(storedKey, key.c_str(), key.size());
+    if (std::memcmp(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC)) != 0 ||
+        header.version != CACHE_VERSION || header.sampleSize != sizeof(Sample) ||
+        std::memcmp(header.key, storedKey, CACHE_KEY_SIZE) != 0 ||
+        size != static_cast<qint64>(sizeof(CacheHeader) + sizeof(Sample) * header.numSamples)) {
+        std::cerr << "Ignore broken sample cache: " << filePath(key) << std::endl;
+        release();
+        return false;
+    }
+
+    samples_    = reinterpret_cast<const Sample*>(mapped_ + sizeof(CacheHeader));
+    numSamples_ = static_cast<int>(header.numSamples);
+    return true;
+}
+
+void SampleCache::release() {
+    if (file_) {
+        if (mapped_) {
+            file_->unmap(mapped_);
+        }
+        file_->close();
+        file_.reset();
+    }
+    mapped_     = nullptr;
+    samples_    = nullptr;
+    numSamples_ = 0;
+}
+
+bool SampleCache::save(const std::string& key, const std::vector<Sample>& samples) const {
+    if (key.size() > CACHE_KEY_SIZE) {
+        return false;
+    }
+
+    CacheHeader header;
+    std::memset(&header, 0, sizeof(CacheHeader));
+    std::memcpy(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+    header.version    = CACHE_VERSION;
+    header.sampleSize = sizeof(Sample);
+    header.numSamples = static_cast<uint32_t>(samples.size());
+    std::memcpy(header.key, key.c_str(), key.size());
+
+    // The file is replaced atomically, so that a reader never sees a partial file.
+    QSaveFile file(QString::fromStdString(filePath(key)));
+    if (!file.open(QFile::WriteOnly)) {
+        return false;
+    }
+
+    const qint64 bytes = sizeof(Sample) * samples.size();
+    if (file.write(reinterpret_cast<const char*>(&header), sizeof(CacheHeader)) != sizeof(CacheHeader) ||
+        (bytes > 0 && file.write(reinterpret_cast<const char*>(samples.data()), bytes) != bytes)) {
+        file.cancelWriting();
+        return false;
+    }
+    return file.commit();
+}
+
+std::string SampleCache::filePath(const std::string& key) const {
+    return directory_ + key + ".bin";
+}
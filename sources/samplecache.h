@@ -0,0 +1,42 @@
+#ifdef _MSC_VER
+#pragma once
+#endif
+
+#ifndef _SAMPLE_CACHE_H_
+#define _SAMPLE_CACHE_H_
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <QtCore/qfile.h>
+
+#include "samplehierarchy.h"
+
+// Versioned binary cache of sample sets on disk. Every sample set is stored
+// in its own file named by the key, which is a hash of everything the
+// samples depend on. "load()" maps the file into memory, so that the samples
+// are uploaded without being read or copied by the application.
+class SampleCache {
+public:
+    explicit SampleCache(const std::string& directory);
+    virtual ~SampleCache();
+
+    bool load(const std::string& key);
+    void release();
+    bool save(const std::string& key, const std::vector<Sample>& samples) const;
+
+    inline const Sample* samples() const { return samples_; }
+    inline int numSamples() const { return numSamples_; }
+
+private:
+    std::string filePath(const std::string& key) const;
+
+    std::string directory_;
+    std::unique_ptr<QFile> file_ = nullptr;
+    uchar* mapped_ = nullptr;
+    const Sample* samples_ = nullptr;
+    int numSamples_ = 0;
+};
+
+#endif  // _SAMPLE_CACHE_H_
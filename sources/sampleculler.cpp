@@ -0,0 +1,170 @@
+#include "sampleculler.h"
+
+#include <algorithm>
+#include <vector>
+
+#include <QtGui/qopenglcontext.h>
+#include <QtGui/qopenglextrafunctions.h>
+
+#include "shadersource.h"
+
+// Storage buffer bindings, which must match "cull.cs".
+static constexpr int SAMPLE_BINDING         = 0;
+static constexpr int CULLED_SAMPLE_BINDING  = 1;
+static constexpr int COMMAND_BINDING        = 2;
+
+// Work group sizes of the culling and of the depth pyramid.
+static constexpr int CULL_GROUP_SIZE = 256;
+static constexpr int DEPTH_GROUP_SIZE = 16;
+
+// Size of "DrawArraysIndirectCommand". Every segment has the commands of
+// the points and the quads.
+static constexpr int COMMAND_SIZE = 4;
+static constexpr int SEGMENT_COMMANDS_SIZE = 2 * COMMAND_SIZE;
+
+SampleCuller::SampleCuller(const QString& shaderDirectory) {
+    depthShader_ = linkComputeShader(shaderDirectory + "cull_depth.cs");
+    cullShader_  = linkComputeShader(shaderDirectory + "cull.cs");
+    isValid_ = depthShader_ && cullShader_;
+    if (!isValid_) {
+        return;
+    }
+
+    // The buffers are created by binding them once, so that vertex arrays
+    // can refer to them before the first culling.
+    auto f = QOpenGLContext::currentContext()->extraFunctions();
+    GLuint buffers[2];
+    f->glGenBuffers(2, buffers);
+    culledSamples_ = buffers[0];
+    commands_      = buffers[1];
+    for (GLuint buffer : buffers) {
+        f->glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffer);
+    }
+    f->glBindBuffer(GL_SHADER_STORAGE_BUFFER, commands_);
+    f->glBufferData(GL_SHADER_STORAGE_BUFFER,
+                    sizeof(GLuint) * SEGMENT_COMMANDS_SIZE * numSegments,
+                    nullptr, GL_DYNAMIC_DRAW);
+    f->glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+SampleCuller::~SampleCuller() {
+    auto f = QOpenGLContext::currentContext()->extraFunctions();
+    if (commands_ != 0) {
+        GLuint buffers[2] = { culledSamples_, commands_ };
+        f->glDeleteBuffers(2, buffers);
+    }
+    if (depthPyramid_ != 0) {
+        glDeleteTextures(1, &depthPyramid_);
+    }
+}
+
+bool SampleCuller::isSupported() {
+    QOpenGLContext* context = QOpenGLContext::currentContext();
+    return context->format().version() >= qMakePair(4, 3);
+}
+
+size_t SampleCuller::pointsCommandOffset(int segment) {
+    return sizeof(GLuint) * SEGMENT_COMMANDS_SIZE * segment;
+}
+
+size_t SampleCuller::quadsCommandOffset(int segment) {
+    return sizeof(GLuint) * (SEGMENT_COMMANDS_SIZE * segment + COMMAND_SIZE);
+}
+
+void SampleCuller::resizePyramid(int width, int height) {
+    if (width == width_ && height == height_) {
+        return;
+    }
+    width_  = width;
+    height_ = height;
+
+    levels_ = 1;
+    while ((std::max(width, height) >> levels_) > 0) {
+        levels_++;
+    }
+
+    auto f = QOpenGLContext::currentContext()->extraFunctions();
+    if (depthPyramid_ != 0) {
+        glDeleteTextures(1, &depthPyramid_);
+    }
+    glGenTextures(1, &depthPyramid_);
+    glBindTexture(GL_TEXTURE_2D, depthPyramid_);
+    f->glTexStorage2D(GL_TEXTURE_2D, levels_, GL_R32F, width, height);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+void SampleCuller::buildPyramid(GLuint depthMap) {
+    auto f = QOpenGLContext::currentContext()->extraFunctions();
+
+    depthShader_->bind();
+    f->glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, depthMap);
+    depthShader_->setUniformValue("uDepthMap", 0);
+
+    for (int l = 0; l < levels_; l++) {
+        const int levelWidth  = std::max(1, width_ >> l);
+        const int levelHeight = std::max(1, height_ >> l);
+        if (l > 0) {
+            f->glBindImageTexture(0, depthPyramid_, l - 1, GL_FALSE, 0, GL_READ_ONLY, GL_R32F);
+        }
+        f->glBindImageTexture(1, depthPyramid_, l, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+        depthShader_->setUniformValue("uLevel", l);
+        f->glDispatchCompute((levelWidth  + DEPTH_GROUP_SIZE - 1) / DEPTH_GROUP_SIZE,
+                             (levelHeight + DEPTH_GROUP_SIZE - 1) / DEPTH_GROUP_SIZE, 1);
+        f->glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+    }
+    f->glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+
+    f->glBindImageTexture(0, 0, 0, GL_FALSE, 0, GL_READ_ONLY, GL_R32F);
+    f->glBindImageTexture(1, 0, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+}
+
+void SampleCuller::cull(const CullParams& params) {
+    auto f = QOpenGLContext::currentContext()->extraFunctions();
+
+    resizePyramid(params.width, params.height);
+    buildPyramid(params.depthMap);
+
+    // The output holds all the samples in the worst case.
+    if (params.numSamples > sampleCapacity_) {
+        sampleCapacity_ = params.numSamples;
+        f->glBindBuffer(GL_SHADER_STORAGE_BUFFER, culledSamples_);
+        f->glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(PackedSample) * sampleCapacity_, nullptr, GL_DYNAMIC_DRAW);
+    }
+
+    // Commands start with no survivors. The quads take the survivors of
+    // the segment as the instances.
+    std::vector<GLuint> commands;
+    for (int s = 0; s < numSegments; s++) {
+        const GLuint first = static_cast<GLuint>(params.segmentOffsets[s]);
+        commands.insert(commands.end(), { 0, 1, first, 0 });
+        commands.insert(commands.end(), { 4, 0, 0, first });
+    }
+    f->glBindBuffer(GL_SHADER_STORAGE_BUFFER, commands_);
+    f->glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(GLuint) * commands.size(), commands.data());
+    f->glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    f->glBindBufferBase(GL_SHADER_STORAGE_BUFFER, SAMPLE_BINDING, params.sampleBuffer);
+    f->glBindBufferBase(GL_SHADER_STORAGE_BUFFER, CULLED_SAMPLE_BINDING, culledSamples_);
+    f->glBindBufferBase(GL_SHADER_STORAGE_BUFFER, COMMAND_BINDING, commands_);
+
+    cullShader_->bind();
+    f->glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, depthPyramid_);
+    cullShader_->setUniformValue("uDepthPyramid", 0);
+    cullShader_->setUniformValue("uMaxLevel", levels_ - 1);
+    cullShader_->setUniformValue("uMVPMat", params.mvpMat);
+    f->glUniform2i(cullShader_->uniformLocation("uScreenSize"), params.width, params.height);
+    cullShader_->setUniformValue("uNumSamples", params.numSamples);
+    cullShader_->setUniformValueArray("uSegmentOffsets", params.segmentOffsets, numSegments + 1);
+    cullShader_->setUniformValue("uSampleOrigin", params.bounds.origin);
+    cullShader_->setUniformValue("uSampleExtent", params.bounds.extent);
+    cullShader_->setUniformValueArray("uSupport", params.supports, params.numSupports, 1);
+    if (params.numSamples > 0) {
+        f->glDispatchCompute((params.numSamples + CULL_GROUP_SIZE - 1) / CULL_GROUP_SIZE, 1, 1);
+    }
+    f->glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT);
+    cullShader_->release();
+}
@@ -0,0 +1,80 @@
+#ifdef _MSC_VER
+#pragma once
+#endif
+
+#ifndef _SAMPLE_CULLER_H_
+#define _SAMPLE_CULLER_H_
+
+#include <memory>
+
+#include <QtGui/qopenglshaderprogram.h>
+#include <QtGui/qmatrix4x4.h>
+
+#include "packedsample.h"
+
+// Inputs of one culling pass. Textures and buffers are given by their names.
+struct CullParams {
+    QMatrix4x4 mvpMat;
+
+    // Packed samples, which are split into "SampleCuller::numSegments"
+    // ranges by the offsets.
+    GLuint sampleBuffer = 0;
+    int numSamples = 0;
+    const int* segmentOffsets = nullptr;
+    SampleBounds bounds;
+
+    // Depth buffer of the G-buffers, where the cleared depth marks the
+    // pixels not covered by the mesh.
+    GLuint depthMap = 0;
+    int width = 0;
+    int height = 0;
+
+    const float* supports = nullptr;
+    int numSupports = 0;
+};
+
+// Culling of the samples on the GPU (OpenGL 4.3). A sample is dropped when
+// the box around its support is outside the view frustum, or lies behind
+// every receiver over its screen bounds, which are found in a pyramid of the
+// maximum receiver depth. The survivors are copied to the range of their
+// segment, and the commands of "glDrawArraysIndirect()" are written for the
+// points and the instanced quads of every segment.
+class SampleCuller {
+public:
+    explicit SampleCuller(const QString& shaderDirectory);
+    virtual ~SampleCuller();
+
+    static bool isSupported();
+    inline bool isValid() const { return isValid_; }
+
+    void cull(const CullParams& params);
+
+    inline GLuint sampleBuffer() const { return culledSamples_; }
+    inline GLuint commandBuffer() const { return commands_; }
+
+    // Byte offsets of the commands in "commandBuffer()". The quads are
+    // drawn with the survivors as the instances.
+    static size_t pointsCommandOffset(int segment);
+    static size_t quadsCommandOffset(int segment);
+
+    static constexpr int numSegments = 4;
+
+private:
+    void resizePyramid(int width, int height);
+    void buildPyramid(GLuint depthMap);
+
+    std::unique_ptr<QOpenGLShaderProgram> depthShader_ = nullptr;
+    std::unique_ptr<QOpenGLShaderProgram> cullShader_ = nullptr;
+    bool isValid_ = false;
+
+    GLuint culledSamples_ = 0;
+    GLuint commands_ = 0;
+    int sampleCapacity_ = 0;
+
+    GLuint depthPyramid_ = 0;
+    int width_ = 0;
+    int height_ = 0;
+    int levels_ = 0;
+};
+
+#endif  // _SAMPLE_CULLER_H_
@@ -0,0 +1,430 @@
+#include "samplehierarchy.h"
+
+#include <cmath>
+#include <queue>
+#include <algorithm>
+
+#include "parallel.h"
+
+namespace {
+
+struct Cell {
+    float error;
+    int level;
+    int x;
+    int y;
+};
+
+// Cells are refined in the order of the error. Ties are broken by the
+// position, so that the selection is deterministic.
+struct CellOrder {
+    bool operator()(const Cell& c1, const Cell& c2) const {
+        if (c1.error != c2.error) return c1.error < c2.error;
+        if (c1.level != c2.level) return c1.level > c2.level;
+        if (c1.y != c2.y) return c1.y > c2.y;
+        return c1.x > c2.x;
+    }
+};
+
+inline bool isCovered(const GBufferPyramid& pyramid, int level, int x, int y) {
+    return pyramid.at(level, GBUF_MIN_DEPTH, x, y) < 1.0f;
+}
+
+// Radius of the samples of the level, which is the same as "build()"
+// for the three finest levels.
+inline float levelRadius(const GBufferPyramid& pyramid, const HierarchyParams& params, int level) {
+    return static_cast<float>(std::pow(2.0, pyramid.levels() - 3 - level) * params.texelScale);
+}
+
+Sample makeSample(const GBufferPyramid& pyramid, const HierarchyParams& params, int level, int x, int y) {
+    Sample s;
+    s.position = QVector3D(pyramid.at(level, GBUF_POSITION_X, x, y),
+                           pyramid.at(level, GBUF_POSITION_Y, x, y),
+                           pyramid.at(level, GBUF_POSITION_Z, x, y));
+    s.normal   = QVector3D(pyramid.at(level, GBUF_NORMAL_X, x, y),
+                           pyramid.at(level, GBUF_NORMAL_Y, x, y),
+                           pyramid.at(level, GBUF_NORMAL_Z, x, y));
+    s.texcoord = QVector2D(pyramid.at(level, GBUF_TEXCOORD_U, x, y),
+                           pyramid.at(level, GBUF_TEXCOORD_V, x, y));
+    s.radius   = levelRadius(pyramid, params, level);
+    return s;
+}
+
+// One sample for the cells, whose attributes are weighted by the areas of
+// the cells and whose area is the sum of theirs.
+Sample mergeCells(const GBufferPyramid& pyramid, const HierarchyParams& params, const Cell* cells, int numCells) {
+    Sample merged;
+    float area = 0.0f;
+    for (int i = 0; i < numCells; i++) {
+        const Sample s = makeSample(pyramid, params, cells[i].level, cells[i].x, cells[i].y);
+        const float w = s.radius * s.radius;
+        merged.position += s.position * w;
+        merged.normal   += s.normal * w;
+        merged.texcoord += s.texcoord * w;
+        area += w;
+    }
+    merged.position /= area;
+    merged.normal.normalize();
+    merged.texcoord /= area;
+    merged.radius = std::sqrt(area);
+    return merged;
+}
+
+}  // anonymous namespace
+
+void SampleHierarchy::resize(const GBufferPyramid& pyramid) {
+    const int levels = pyramid.levels();
+    rawMasks_.resize(levels);
+    masks_.resize(levels);
+    levelRowStarts_.assign(levels + 1, 0);
+    for (int l = 0; l < levels; l++) {
+        if (masks_[l].width() != pyramid.width(l) || masks_[l].height() != pyramid.height(l)) {
+            rawMasks_[l].resize(pyramid.width(l), pyramid.height(l));
+            masks_[l].resize(pyramid.width(l), pyramid.height(l));
+        }
+        levelRowStarts_[l + 1] = levelRowStarts_[l] + pyramid.height(l);
+    }
+
+    const int totalRows = levelRowStarts_[levels];
+    rowLevels_.resize(totalRows);
+    for (int l = 0; l < levels; l++) {
+        std::fill(rowLevels_.begin() + levelRowStarts_[l], rowLevels_.begin() + levelRowStarts_[l + 1], l);
+    }
+    rowOffsets_.resize(totalRows + 1);
+}
+
+void SampleHierarchy::build(const GBufferPyramid& pyramid, const QVector3D& lightPos, const HierarchyParams& params) {
+    resize(pyramid);
+    const int totalRows = static_cast<int>(rowLevels_.size());
+
+    // Classify the texels of all the levels.
+    parallelFor(0, totalRows, [&](int r) {
+        const int l = rowLevels_[r];
+        classifyRow(pyramid, l, r - levelRowStarts_[l], 0, pyramid.width(l), lightPos, params);
+    });
+
+    // Remove the texels whose parent is selected, and count the survivors.
+    parallelFor(0, totalRows, [&](int r) {
+        const int l = rowLevels_[r];
+        suppressRow(l, r - levelRowStarts_[l], 0, pyramid.width(l));
+        rowOffsets_[r + 1] = masks_[l].countRow(r - levelRowStarts_[l]);
+    });
+
+    // Exclusive prefix sum gives the output position of every row.
+    rowOffsets_[0] = 0;
+    for (int r = 0; r < totalRows; r++) {
+        rowOffsets_[r + 1] += rowOffsets_[r];
+    }
+
+    samples_.resize(rowOffsets_[totalRows]);
+    Sample* out = samples_.data();
+    parallelFor(0, totalRows, [&](int r) {
+        const int l = rowLevels_[r];
+        gatherRow(pyramid, params, l, r - levelRowStarts_[l], 0, pyramid.width(l), out + rowOffsets_[r]);
+    });
+}
+
+size_t SampleHierarchy::memoryBytes() const {
+    size_t bytes = 0;
+    for (size_t l = 0; l < masks_.size(); l++) {
+        bytes += sizeof(uint64_t) * masks_[l].wordsPerRow() * masks_[l].height() * 2;
+    }
+    bytes += sizeof(int) * (levelRowStarts_.capacity() + rowLevels_.capacity() + rowOffsets_.capacity());
+    bytes += sizeof(Sample) * samples_.capacity();
+    for (const auto& s : tileSamples_) {
+        bytes += sizeof(Sample) * s.capacity();
+    }
+    return bytes;
+}
+
+void SampleHierarchy::buildBudget(const GBufferPyramid& pyramid, const QVector3D& lightPos, const HierarchyParams& params) {
+    samples_.clear();
+    if (params.budget <= 0) {
+        return;
+    }
+
+    const int finest = pyramid.levels() - 1;
+    std::priority_queue<Cell, std::vector<Cell>, CellOrder> queue;
+    std::vector<Cell> leaves;
+    for (int y = 0; y < pyramid.height(0); y++) {
+        for (int x = 0; x < pyramid.width(0); x++) {
+            if (isCovered(pyramid, 0, x, y)) {
+                queue.push({ cellError(pyramid, 0, x, y, lightPos, params), 0, x, y });
+            }
+        }
+    }
+
+    // When the coarsest cells exceed the budget, neighboring cells in the
+    // row-scan order are merged into groups, so that the whole surface is
+    // still covered by exactly "params.budget" samples.
+    if (static_cast<int>(queue.size()) > params.budget) {
+        std::vector<Cell> cells;
+        while (!queue.empty()) {
+            cells.push_back(queue.top());
+            queue.pop();
+        }
+        std::sort(cells.begin(), cells.end(), [](const Cell& c1, const Cell& c2) {
+            if (c1.y != c2.y) return c1.y < c2.y;
+            return c1.x < c2.x;
+        });
+
+        const int numCells = static_cast<int>(cells.size());
+        for (int i = 0; i < params.budget; i++) {
+            const int begin = static_cast<int>(static_cast<long long>(numCells) * i / params.budget);
+            const int end = static_cast<int>(static_cast<long long>(numCells) * (i + 1) / params.budget);
+            samples_.push_back(mergeCells(pyramid, params, &cells[begin], end - begin));
+        }
+        return;
+    }
+
+    int count = static_cast<int>(queue.size());
+    while (!queue.empty()) {
+        const Cell cell = queue.top();
+        queue.pop();
+        if (cell.level == finest) {
+            leaves.push_back(cell);
+            continue;
+        }
+
+        Cell children[4];
+        int numChildren = 0;
+        for (int dy = 0; dy < 2; dy++) {
+            for (int dx = 0; dx < 2; dx++) {
+                const int cx = cell.x * 2 + dx;
+                const int cy = cell.y * 2 + dy;
+                if (isCovered(pyramid, cell.level + 1, cx, cy)) {
+                    children[numChildren++] = { cellError(pyramid, cell.level + 1, cx, cy, lightPos, params),
+                                                cell.level + 1, cx, cy };
+                }
+            }
+        }
+
+        const int rest = params.budget - count;
+        if (numChildren - 1 <= rest) {
+            for (int i = 0; i < numChildren; i++) {
+                queue.push(children[i]);
+            }
+            count += numChildren - 1;
+        } else if (rest == 0) {
+            leaves.push_back(cell);
+        } else {
+            // Use up the budget by refining the cell partially. The children
+            // of the largest errors are kept, and the others are merged into
+            // one sample whose area is the sum of theirs.
+            std::sort(children, children + numChildren, [](const Cell& c1, const Cell& c2) {
+                return CellOrder()(c2, c1);
+            });
+            for (int i = 0; i < rest; i++) {
+                leaves.push_back(children[i]);
+            }
+
+            samples_.push_back(mergeCells(pyramid, params, children + rest, numChildren - rest));
+            count = params.budget;
+        }
+    }
+
+    // Samples are ordered by level and then in row-scan order as in "build()".
+    std::sort(leaves.begin(), leaves.end(), [](const Cell& c1, const Cell& c2) {
+        if (c1.level != c2.level) return c1.level < c2.level;
+        if (c1.y != c2.y) return c1.y < c2.y;
+        return c1.x < c2.x;
+    });
+
+    std::vector<Sample> merged;
+    merged.swap(samples_);
+    samples_.reserve(leaves.size() + merged.size());
+    for (const Cell& c : leaves) {
+        samples_.push_back(makeSample(pyramid, params, c.level, c.x, c.y));
+    }
+    samples_.insert(samples_.end(), merged.begin(), merged.end());
+}
+
+float SampleHierarchy::cellError(const GBufferPyramid& pyramid, int level, int x, int y,
+                                 const QVector3D& lightPos, const HierarchyParams& params) const {
+    // Both criteria of "build()" as ratios to their thresholds, weighted by
+    // the area of the cell. The threshold "T" is matched to "build()" on the
+    // three finest levels.
+    const float depthGap = (pyramid.at(level, GBUF_MAX_DEPTH, x, y) - pyramid.at(level, GBUF_MIN_DEPTH, x, y)) * 10.0f;
+
+    const QVector3D P = QVector3D(pyramid.at(level, GBUF_POSITION_X, x, y),
+                                  pyramid.at(level, GBUF_POSITION_Y, x, y),
+                                  pyramid.at(level, GBUF_POSITION_Z, x, y));
+    const QVector3D N = QVector3D(pyramid.at(level, GBUF_NORMAL_X, x, y),
+                                  pyramid.at(level, GBUF_NORMAL_Y, x, y),
+                                  pyramid.at(level, GBUF_NORMAL_Z, x, y));
+    const float NdotL = std::abs(QVector3D::dotProduct(N, (lightPos - P).normalized()));
+
+    const double T = params.T * std::pow(2.0, level - (pyramid.levels() - 3)) / params.texelScale;
+    const float gapRatio  = depthGap / static_cast<float>(params.z0);
+    const float slopeRatio = static_cast<float>(params.alpha * params.Rw / (params.RPx * T)) / std::max(NdotL, 1.0e-4f);
+
+    const float radius = levelRadius(pyramid, params, level);
+    return radius * radius * std::max(gapRatio, slopeRatio);
+}
+
+void SampleHierarchy::classifyRow(const GBufferPyramid& pyramid, int level, int y, int x0, int x1,
+                                  const QVector3D& lightPos, const HierarchyParams& params) {
+    const int offset = y * pyramid.width(level);
+    const float* minDepth = pyramid.plane(level, GBUF_MIN_DEPTH) + offset;
+    const float* maxDepth = pyramid.plane(level, GBUF_MAX_DEPTH) + offset;
+    const float* px = pyramid.plane(level, GBUF_POSITION_X) + offset;
+    const float* py = pyramid.plane(level, GBUF_POSITION_Y) + offset;
+    const float* pz = pyramid.plane(level, GBUF_POSITION_Z) + offset;
+    const float* nx = pyramid.plane(level, GBUF_NORMAL_X) + offset;
+    const float* ny = pyramid.plane(level, GBUF_NORMAL_Y) + offset;
+    const float* nz = pyramid.plane(level, GBUF_NORMAL_Z) + offset;
+
+    // "T > Mx" with "Mx = alpha * Rw / (RPx * |N.L|)" is evaluated without the division.
+    // The threshold grows as the texels shrink, as it does for the finer levels.
+    const double T = params.T * std::pow(2.0, level) / params.texelScale;
+    const float lhs = static_cast<float>(T * params.RPx);
+    const float rhs = static_cast<float>(params.alpha * params.Rw);
+    const float z0  = static_cast<float>(params.z0);
+
+    uint64_t* bits = rawMasks_[level].row(y);
+    for (int w = x0 / 64; w * 64 < x1; w++) {
+        const int xs = std::max(x0, w * 64);
+        const int xe = std::min(x1, (w + 1) * 64);
+
+        uint64_t word = 0;
+        for (int x = xs; x < xe; x++) {
+            const float depthGap = (maxDepth[x] - minDepth[x]) * 10.0f;
+
+            const QVector3D L = QVector3D(lightPos.x() - px[x], lightPos.y() - py[x], lightPos.z() - pz[x]).normalized();
+            const float NdotL = nx[x] * L.x() + ny[x] * L.y() + nz[x] * L.z();
+
+            if (depthGap < z0 && lhs * std::abs(NdotL) > rhs) {
+                word |= 1ULL << (x - w * 64);
+            }
+        }
+
+        const uint64_t range = spanBits(xs - w * 64, xe - w * 64);
+        bits[w] = (bits[w] & ~range) | word;
+    }
+}
+
+void SampleHierarchy::suppressRow(int level, int y, int x0, int x1) {
+    const uint64_t* raw = rawMasks_[level].row(y);
+    uint64_t* bits = masks_[level].row(y);
+
+    // One parent word covers two words of this level.
+    const uint64_t* parent = level > 0 ? rawMasks_[level - 1].row(y / 2) : nullptr;
+    for (int w = x0 / 64; w * 64 < x1; w++) {
+        uint64_t word = raw[w];
+        if (parent) {
+            const uint64_t p = parent[w / 2];
+            const uint32_t half = static_cast<uint32_t>((w & 1) ? (p >> 32) : p);
+            word &= ~duplicateBits32(half);
+        }
+
+        const uint64_t range = spanBits(std::max(x0, w * 64) - w * 64, std::min(x1, (w + 1) * 64) - w * 64);
+        bits[w] = (bits[w] & ~range) | (word & range);
+    }
+}
+
+int SampleHierarchy::countRow(int level, int y, int x0, int x1) const {
+    const uint64_t* bits = masks_[level].row(y);
+    int count = 0;
+    for (int w = x0 / 64; w * 64 < x1; w++) {
+        const uint64_t range = spanBits(std::max(x0, w * 64) - w * 64, std::min(x1, (w + 1) * 64) - w * 64);
+        count += popCount64(bits[w] & range);
+    }
+    return count;
+}
+
+Sample* SampleHierarchy::gatherRow(const GBufferPyramid& pyramid, const HierarchyParams& params,
+                                   int level, int y, int x0, int x1, Sample* out) const {
+    const int offset = y * pyramid.width(level);
+    const float* px = pyramid.plane(level, GBUF_POSITION_X) + offset;
+    const float* py = pyramid.plane(level, GBUF_POSITION_Y) + offset;
+    const float* pz = pyramid.plane(level, GBUF_POSITION_Z) + offset;
+    const float* nx = pyramid.plane(level, GBUF_NORMAL_X) + offset;
+    const float* ny = pyramid.plane(level, GBUF_NORMAL_Y) + offset;
+    const float* nz = pyramid.plane(level, GBUF_NORMAL_Z) + offset;
+    const float* tu = pyramid.plane(level, GBUF_TEXCOORD_U) + offset;
+    const float* tv = pyramid.plane(level, GBUF_TEXCOORD_V) + offset;
+    const float radius = static_cast<float>(std::pow(0.5, level) * params.texelScale);
+
+    const uint64_t* bits = masks_[level].row(y);
+    for (int w = x0 / 64; w * 64 < x1; w++) {
+        uint64_t word = bits[w] & spanBits(std::max(x0, w * 64) - w * 64, std::min(x1, (w + 1) * 64) - w * 64);
+        while (word != 0) {
+            const int x = w * 64 + countTrailingZeros64(word);
+            out->position = QVector3D(px[x], py[x], pz[x]);
+            out->normal   = QVector3D(nx[x], ny[x], nz[x]);
+            out->texcoord = QVector2D(tu[x], tv[x]);
+            out->radius   = radius;
+            out++;
+            word &= word - 1;
+        }
+    }
+    return out;
+}
+
+void SampleHierarchy::resizeTiles(const GBufferPyramid& pyramid, int tileSize) {
+    resize(pyramid);
+    tileSize_ = tileSize;
+    tilesX_ = (pyramid.width(pyramid.levels() - 1) + tileSize - 1) / tileSize;
+    tilesY_ = (pyramid.height(pyramid.levels() - 1) + tileSize - 1) / tileSize;
+    tileSamples_.resize(tilesX_ * tilesY_);
+}
+
+void SampleHierarchy::buildTiles(const GBufferPyramid& pyramid, const QVector3D& lightPos,
+                                 const HierarchyParams& params, const std::vector<int>& tiles) {
+    const int levels = pyramid.levels();
+
+    // Tiles in the same tile row share words of the bit masks, so they are
+    // processed by the same thread. Tile rows are processed in parallel.
+    std::vector<std::vector<int>> tileRows(tilesY_);
+    for (int t : tiles) {
+        tileRows[t / tilesX_].push_back(t);
+    }
+
+    // Classify all the levels of a tile row before suppression, which looks
+    // at the parent level of the same tile row.
+    parallelFor(0, tilesY_, [&](int ty) {
+        for (int l = 0; l < levels; l++) {
+            const int shift = levels - 1 - l;
+            const int y0 = (ty * tileSize_) >> shift;
+            const int y1 = std::min(((ty + 1) * tileSize_) >> shift, pyramid.height(l));
+            for (int t : tileRows[ty]) {
+                const int tx = t % tilesX_;
+                const int x0 = (tx * tileSize_) >> shift;
+                const int x1 = std::min(((tx + 1) * tileSize_) >> shift, pyramid.width(l));
+                for (int y = y0; y < y1; y++) {
+                    classifyRow(pyramid, l, y, x0, x1, lightPos, params);
+                }
+            }
+        }
+
+        for (int t : tileRows[ty]) {
+            const int tx = t % tilesX_;
+            int count = 0;
+            for (int l = 0; l < levels; l++) {
+                const int shift = levels - 1 - l;
+                const int x0 = (tx * tileSize_) >> shift;
+                const int x1 = std::min(((tx + 1) * tileSize_) >> shift, pyramid.width(l));
+                const int y0 = (ty * tileSize_) >> shift;
+                const int y1 = std::min(((ty + 1) * tileSize_) >> shift, pyramid.height(l));
+                for (int y = y0; y < y1; y++) {
+                    suppressRow(l, y, x0, x1);
+                    count += countRow(l, y, x0, x1);
+                }
+            }
+
+            std::vector<Sample>& out = tileSamples_[t];
+            out.resize(count);
+            Sample* ptr = out.data();
+            for (int l = 0; l < levels; l++) {
+                const int shift = levels - 1 - l;
+                const int x0 = (tx * tileSize_) >> shift;
+                const int x1 = std::min(((tx + 1) * tileSize_) >> shift, pyramid.width(l));
+                const int y0 = (ty * tileSize_) >> shift;
+                const int y1 = std::min(((ty + 1) * tileSize_) >> shift, pyramid.height(l));
+                for (int y = y0; y < y1; y++) {
+                    ptr = gatherRow(pyramid, params, l, y, x0, x1, ptr);
+                }
+            }
+        }
+    });
+}
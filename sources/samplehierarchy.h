@@ -0,0 +1,100 @@
+#ifdef _MSC_VER
+#pragma once
+#endif
+
+#ifndef _SAMPLE_HIERARCHY_H_
+#define _SAMPLE_HIERARCHY_H_
+
+#include <vector>
+
+#include <QtGui/qvector2d.h>
+#include <QtGui/qvector3d.h>
+
+#include "bitmask.h"
+#include "imagepyramid.h"
+
+struct Sample {
+    QVector3D position;
+    QVector3D normal;
+    QVector2D texcoord;
+    float radius;
+};
+
+struct HierarchyParams {
+    double alpha = 30.0;
+    double Rw    = 1.0;
+    double RPx   = 0.1;
+    double z0    = 0.03;
+    double T     = 256.0;  // Threshold for level 0, doubled for each finer level.
+    int budget   = 0;      // Exact number of samples, or 0 to use the thresholds.
+
+    // Size of the texels relative to those of the light buffer of 1024^2,
+    // by which the radii of the samples are scaled and the thresholds are
+    // divided, so that larger buffers give finer samples of the same total
+    // area instead of more samples of the same size.
+    double texelScale = 1.0;
+};
+
+// Selects the irradiance samples from the G-buffer pyramid. Every texel of
+// every level is classified in parallel into bit masks, texels whose parent
+// is selected are suppressed, and the remaining ones are compacted with a
+// prefix sum over the rows into one sample array. The samples are ordered
+// by level and then in row-scan order, regardless of the number of threads.
+class SampleHierarchy {
+public:
+    SampleHierarchy() = default;
+
+    void build(const GBufferPyramid& pyramid, const QVector3D& lightPos, const HierarchyParams& params);
+
+    // Budgeted selection, which emits exactly "params.budget" samples unless
+    // fewer texels are covered. Starting from the coarsest level, the cell
+    // with the largest error is refined into its children until the budget
+    // is reached. When the children do not fit, some of them are merged into
+    // one sample, and so are the coarsest cells in groups when even they
+    // exceed the budget. The pyramid should be built up to a few coarsest texels,
+    // and its three finest levels correspond to those of "build()".
+    void buildBudget(const GBufferPyramid& pyramid, const QVector3D& lightPos, const HierarchyParams& params);
+
+    inline const std::vector<Sample>& samples() const { return samples_; }
+    inline int numSamples() const { return static_cast<int>(samples_.size()); }
+    inline const BitMask& mask(int level) const { return masks_[level]; }
+    size_t memoryBytes() const;
+
+    // Tile-based selection for incremental updates. The finest level is split
+    // into square tiles, and only the given tiles are selected again. The
+    // samples of a tile are ordered by level and then in row-scan order.
+    void resizeTiles(const GBufferPyramid& pyramid, int tileSize);
+    void buildTiles(const GBufferPyramid& pyramid, const QVector3D& lightPos,
+                    const HierarchyParams& params, const std::vector<int>& tiles);
+
+    inline int tileSize() const { return tileSize_; }
+    inline int numTilesX() const { return tilesX_; }
+    inline int numTilesY() const { return tilesY_; }
+    inline int numTiles() const { return tilesX_ * tilesY_; }
+    inline const std::vector<Sample>& tileSamples(int tile) const { return tileSamples_[tile]; }
+
+private:
+    void resize(const GBufferPyramid& pyramid);
+    void classifyRow(const GBufferPyramid& pyramid, int level, int y, int x0, int x1,
+                     const QVector3D& lightPos, const HierarchyParams& params);
+    void suppressRow(int level, int y, int x0, int x1);
+    int countRow(int level, int y, int x0, int x1) const;
+    Sample* gatherRow(const GBufferPyramid& pyramid, const HierarchyParams& params,
+                      int level, int y, int x0, int x1, Sample* out) const;
+    float cellError(const GBufferPyramid& pyramid, int level, int x, int y,
+                    const QVector3D& lightPos, const HierarchyParams& params) const;
+
+    std::vector<BitMask> rawMasks_;
+    std::vector<BitMask> masks_;
+    std::vector<int> levelRowStarts_;
+    std::vector<int> rowLevels_;
+    std::vector<int> rowOffsets_;
+    std::vector<Sample> samples_;
+
+    int tileSize_ = 0;
+    int tilesX_   = 0;
+    int tilesY_   = 0;
+    std::vector<std::vector<Sample>> tileSamples_;
+};
+
+#endif  // _SAMPLE_HIERARCHY_H_
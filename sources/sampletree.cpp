@@ -0,0 +1,170 @@
+#include "sampletree.h"
+
+#include <cmath>
+#include <algorithm>
+
+#include <QtGui/qvector4d.h>
+
+#include "parallel.h"
+
+// Roots per chunk of the cut. The costs of the subtrees vary a lot with the
+// view, so there are many more chunks than threads.
+static constexpr int CUT_CHUNK_ROOTS = 16;
+
+namespace {
+
+inline bool isCovered(const GBufferPyramid& pyramid, int level, int x, int y) {
+    return pyramid.at(level, GBUF_MIN_DEPTH, x, y) < 1.0f;
+}
+
+SampleNode makeNode(const GBufferPyramid& pyramid, double texelScale, int level, int x, int y) {
+    SampleNode node;
+    Sample& s = node.sample;
+    s.position = QVector3D(pyramid.at(level, GBUF_POSITION_X, x, y),
+                           pyramid.at(level, GBUF_POSITION_Y, x, y),
+                           pyramid.at(level, GBUF_POSITION_Z, x, y));
+    s.normal   = QVector3D(pyramid.at(level, GBUF_NORMAL_X, x, y),
+                           pyramid.at(level, GBUF_NORMAL_Y, x, y),
+                           pyramid.at(level, GBUF_NORMAL_Z, x, y));
+    s.texcoord = QVector2D(pyramid.at(level, GBUF_TEXCOORD_U, x, y),
+                           pyramid.at(level, GBUF_TEXCOORD_V, x, y));
+    s.radius   = static_cast<float>(std::pow(2.0, pyramid.levels() - 3 - level) * texelScale);
+    node.depthGap = (pyramid.at(level, GBUF_MAX_DEPTH, x, y) - pyramid.at(level, GBUF_MIN_DEPTH, x, y)) * 10.0f;
+    node.firstChild  = 0;
+    node.numChildren = 0;
+    return node;
+}
+
+// Splat size for the sample radius, which is interpolated between the levels
+// of the table as in the shaders.
+float splatSupport(const CutParams& params, float radius) {
+    const float t = std::min(std::max(std::log2(radius) + 2.0f, 0.0f), static_cast<float>(params.numSupports - 1));
+    const int i = std::min(static_cast<int>(t), params.numSupports - 2);
+    return params.supports[i] + (params.supports[i + 1] - params.supports[i]) * (t - i);
+}
+
+}  // anonymous namespace
+
+void SampleTree::build(const GBufferPyramid& pyramid, double texelScale) {
+    nodes_.clear();
+    numRoots_ = 0;
+
+    // Texel coordinates of the nodes, which are needed only while building.
+    struct Texel {
+        int level;
+        int x;
+        int y;
+    };
+    std::vector<Texel> texels;
+
+    for (int y = 0; y < pyramid.height(0); y++) {
+        for (int x = 0; x < pyramid.width(0); x++) {
+            if (isCovered(pyramid, 0, x, y)) {
+                nodes_.push_back(makeNode(pyramid, texelScale, 0, x, y));
+                texels.push_back({ 0, x, y });
+            }
+        }
+    }
+    numRoots_ = static_cast<int>(nodes_.size());
+
+    // Nodes are appended in the breadth-first order, so that the children
+    // of every node are contiguous.
+    const int finest = pyramid.levels() - 1;
+    for (size_t i = 0; i < nodes_.size(); i++) {
+        const Texel t = texels[i];
+        nodes_[i].firstChild  = static_cast<int>(nodes_.size());
+        nodes_[i].numChildren = 0;
+        if (t.level == finest) {
+            continue;
+        }
+
+        for (int dy = 0; dy < 2; dy++) {
+            for (int dx = 0; dx < 2; dx++) {
+                const int cx = t.x * 2 + dx;
+                const int cy = t.y * 2 + dy;
+                if (isCovered(pyramid, t.level + 1, cx, cy)) {
+                    nodes_.push_back(makeNode(pyramid, texelScale, t.level + 1, cx, cy));
+                    texels.push_back({ t.level + 1, cx, cy });
+                    nodes_[i].numChildren++;
+                }
+            }
+        }
+    }
+}
+
+void SampleTree::cut(const CutParams& params, std::vector<Sample>& samples) const {
+    samples.clear();
+    if (numRoots_ == 0) {
+        return;
+    }
+
+    // A displacement of length d moves the clip coordinates at most by
+    // d times the lengths of the rows of the matrix.
+    const QMatrix4x4& m = params.mvpMat;
+    const float rowLengths[] = {
+        QVector3D(m(0, 0), m(0, 1), m(0, 2)).length(),
+        QVector3D(m(1, 0), m(1, 1), m(1, 2)).length(),
+        QVector3D(m(3, 0), m(3, 1), m(3, 2)).length()
+    };
+
+    // Roots are split into contiguous chunks of a fixed size, whose results
+    // are concatenated in order, so that the output does not depend on the
+    // number of threads or on which thread cuts which chunk.
+    const int numChunks = (numRoots_ + CUT_CHUNK_ROOTS - 1) / CUT_CHUNK_ROOTS;
+    std::vector<std::vector<Sample>> chunks(numChunks);
+    parallelFor(0, numChunks, [&](int c) {
+        const int begin = c * CUT_CHUNK_ROOTS;
+        const int end   = std::min(begin + CUT_CHUNK_ROOTS, numRoots_);
+        for (int r = begin; r < end; r++) {
+            cutSubtree(r, params, rowLengths, chunks[c]);
+        }
+    });
+
+    size_t total = 0;
+    for (const auto& chunk : chunks) {
+        total += chunk.size();
+    }
+    samples.reserve(total);
+    for (const auto& chunk : chunks) {
+        samples.insert(samples.end(), chunk.begin(), chunk.end());
+    }
+}
+
+void SampleTree::cutSubtree(int root, const CutParams& params, const float* rowLengths,
+                            std::vector<Sample>& samples) const {
+    int stack[64];
+    int top = 0;
+    stack[top++] = root;
+    while (top > 0) {
+        const SampleNode& node = nodes_[stack[--top]];
+        const Sample& s = node.sample;
+        const QVector4D clip = params.mvpMat * QVector4D(s.position, 1.0f);
+        const float r = splatSupport(params, s.radius);
+
+        // Nodes behind the camera or outside the frustum are not drawn. The
+        // splat of a node never exceeds that of its parent, so the subtree
+        // is skipped as well.
+        const float mx = r * rowLengths[0];
+        const float my = r * rowLengths[1];
+        const float mw = r * rowLengths[2];
+        if (clip.w() + mw <= 0.0f ||
+            clip.x() + mx < -clip.w() - mw || clip.x() - mx > clip.w() + mw ||
+            clip.y() + my < -clip.w() - mw || clip.y() - my > clip.w() + mw) {
+            continue;
+        }
+
+        // A node over a depth discontinuity would smear the irradiance of
+        // one surface over the other, so that it is refined regardless of
+        // its size.
+        const float diameter = 2.0f * r * params.pixelsPerUnit / std::max(clip.w(), 1.0e-4f);
+        if (node.numChildren == 0 || (diameter <= params.targetPixels && node.depthGap < params.depthGap)) {
+            samples.push_back(s);
+            continue;
+        }
+
+        // Children are pushed in reverse, so that they are emitted in order.
+        for (int i = node.numChildren - 1; i >= 0; i--) {
+            stack[top++] = node.firstChild + i;
+        }
+    }
+}
@@ -0,0 +1,61 @@
+#ifdef _MSC_VER
+#pragma once
+#endif
+
+#ifndef _SAMPLE_TREE_H_
+#define _SAMPLE_TREE_H_
+
+#include <vector>
+
+#include <QtGui/qmatrix4x4.h>
+
+#include "imagepyramid.h"
+#include "samplehierarchy.h"
+
+struct SampleNode {
+    Sample sample;
+    float depthGap;  // Spread of the depths under the node, scaled as "HierarchyParams::z0".
+    int firstChild;
+    int numChildren;
+};
+
+// Parameters to cut the tree for a camera. A node is refined while the
+// projected diameter of its splat exceeds "targetPixels", or while it spans
+// a depth gap of "depthGap" or more, as the texels rejected by the sample
+// selection do. The splat sizes are those for the sample radii 2^(l - 2),
+// l = 0, ..., numSupports - 1, with which the splats are drawn.
+struct CutParams {
+    QMatrix4x4 mvpMat;
+    float pixelsPerUnit = 1.0f;  // Pixels for the unit length at the unit depth.
+    float targetPixels  = 8.0f;
+    float depthGap      = 0.03f;
+    const float* supports = nullptr;
+    int numSupports = 0;
+};
+
+// Covered texels of all the levels of the G-buffer pyramid as a tree. Every
+// node has the covered texels of the 2x2 block below it as its children, and
+// the children of a node are stored contiguously. The tree is cut for every
+// view, so that only the nodes of the appropriate size on the screen and
+// inside the view frustum are drawn.
+class SampleTree {
+public:
+    SampleTree() = default;
+
+    // The radii of the nodes are scaled by "texelScale" as those of
+    // "SampleHierarchy" (see "HierarchyParams").
+    void build(const GBufferPyramid& pyramid, double texelScale = 1.0);
+    void cut(const CutParams& params, std::vector<Sample>& samples) const;
+
+    inline int numNodes() const { return static_cast<int>(nodes_.size()); }
+    inline int numRoots() const { return numRoots_; }
+
+private:
+    void cutSubtree(int root, const CutParams& params, const float* rowLengths,
+                    std::vector<Sample>& samples) const;
+
+    std::vector<SampleNode> nodes_;
+    int numRoots_ = 0;
+};
+
+#endif  // _SAMPLE_TREE_H_
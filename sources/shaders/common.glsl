@@ -0,0 +1,161 @@
+// Functions shared by the shaders, which is inserted after the directives of
+// every shader (see "addShaderFromFile()").
+
+// Splat sizes for the sample radii 2^(l - 2), l = 0, ..., SUPPORT_LEVELS - 1,
+// which are interpolated for the radii in between.
+const int SUPPORT_LEVELS = 14;
+uniform float uSupport[SUPPORT_LEVELS];
+
+float supportRadius(float radius) {
+    float t = clamp(log2(radius) + 2.0, 0.0, float(SUPPORT_LEVELS - 1));
+    int i = min(int(t), SUPPORT_LEVELS - 2);
+    return mix(uSupport[i], uSupport[i + 1], t - float(i));
+}
+
+// Normals are stored by the octahedral mapping to [-1, 1]^2.
+vec2 encodeOctahedral(vec3 n) {
+    n /= abs(n.x) + abs(n.y) + abs(n.z);
+    if (n.z < 0.0) {
+        n.xy = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+    }
+    return n.xy;
+}
+
+vec3 decodeOctahedral(vec2 e) {
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    float t = max(-n.z, 0.0);
+    n.x += n.x >= 0.0 ? -t : t;
+    n.y += n.y >= 0.0 ? -t : t;
+    return normalize(n);
+}
+
+// Linear depth from the depth buffer in [0, 1] for the near and far planes.
+float linearDepth(float z, vec2 depthRange) {
+    float n = depthRange.x;
+    float f = depthRange.y;
+    return 2.0 * n * f / (f + n - (z * 2.0 - 1.0) * (f - n));
+}
+
+// Joint bilateral upsampling from the four nearest texels of an image at a
+// reduced resolution, whose G-buffers are taken at the texel centers as the
+// dipole pass did. "depth" is the linear depth and "normal" is the normal of
+// the pixel at "texCoord". Depth differences are relative to the depth. The
+// sizes of the image and the G-buffers are given, since their textures may
+// be larger (see "RenderTargetPool").
+const float DepthSigma = 0.01;
+const float NormalPower = 8.0;
+
+vec3 upsampleBilateral(sampler2D image, ivec2 size, sampler2D depthMap, sampler2D normalMap, ivec2 screenSize,
+                       vec2 depthRange, vec2 texCoord, float depth, vec3 normal) {
+    vec2 p = texCoord * vec2(size) - 0.5;
+    vec2 base = floor(p);
+    vec2 t = p - base;
+
+    vec3 sum = vec3(0.0, 0.0, 0.0);
+    float weight = 0.0;
+    for (int j = 0; j <= 1; j++) {
+        for (int i = 0; i <= 1; i++) {
+            ivec2 texel = clamp(ivec2(base) + ivec2(i, j), ivec2(0), size - 1);
+            vec2 uv = (vec2(texel) + 0.5) / vec2(size);
+            ivec2 pixel = min(ivec2(uv * vec2(screenSize)), screenSize - 1);
+            float d = linearDepth(texelFetch(depthMap, pixel, 0).x, depthRange);
+            vec3  n = decodeOctahedral(texelFetch(normalMap, pixel, 0).xy * 2.0 - 1.0);
+
+            float wb = (i == 0 ? 1.0 - t.x : t.x) * (j == 0 ? 1.0 - t.y : t.y);
+            float wd = exp(-abs(d - depth) / (DepthSigma * depth));
+            float wn = pow(max(0.0, dot(n, normal)), NormalPower);
+            float w = wb * wd * wn;
+
+            sum += w * texelFetch(image, texel, 0).xyz;
+            weight += w;
+        }
+    }
+
+    // No texel lies on the same surface, e.g., at thin silhouettes.
+    if (weight < 1.0e-4) {
+        return texelFetch(image, min(ivec2(texCoord * vec2(size)), size - 1), 0).xyz;
+    }
+    return sum / weight;
+}
+
+// Positions of the samples are quantized to the bounds of the mesh (see
+// "PackedSample").
+uniform vec3 uSampleOrigin;
+uniform vec3 uSampleExtent;
+
+#if __VERSION__ >= 420
+// Samples read from the storage buffers as the words of "PackedSample".
+vec3 samplePosition(uvec4 s) {
+    return uSampleOrigin + vec3(unpackUnorm2x16(s.x), unpackUnorm2x16(s.y).x) * uSampleExtent;
+}
+
+float sampleRadius(uvec4 s) {
+    return unpackHalf2x16(s.y).y;
+}
+
+vec3 sampleNormal(uvec4 s) {
+    return decodeOctahedral(unpackSnorm2x16(s.z));
+}
+#endif
+
+const float Pi = 3.14159265358979;
+
+// Constants of the dipole at the unit scale (see "MaterialLibrary").
+layout(std140) uniform Material {
+    vec4 mtrlSigmaTr;
+    vec4 mtrlAlphap;
+    vec4 mtrlZpos;
+    vec4 mtrlZneg;
+    vec4 mtrlEtaA;
+};
+
+uniform float uMtrlScale;
+
+// 0: exact, 1: table, 2: fast (see "DipoleMode").
+uniform int uDipoleMode;
+
+// Profile tabulated at r = uProfileMaxDist * u^2.
+uniform sampler1D uProfileMap;
+uniform float uProfileMaxDist;
+
+// Diffuse reflectance of the dipole between two points, which is evaluated
+// by the splats and the gather alike.
+vec3 diffRef(vec3 p0, vec3 p1) {
+    vec3 sigma_tr = mtrlSigmaTr.xyz * uMtrlScale;
+    vec3 zpos     = mtrlZpos.xyz / uMtrlScale;
+    vec3 zneg     = mtrlZneg.xyz / uMtrlScale;
+
+    float dist = distance(p0, p1);
+    float d2 = dist * dist;
+
+    vec3 dpos = sqrt(d2 + zpos * zpos);
+    vec3 dneg = sqrt(d2 + zneg * zneg);
+    vec3 posterm = zpos * (dpos * sigma_tr + 1.0) * exp(-sigma_tr * dpos) / (dpos * dpos * dpos);
+    vec3 negterm = zneg * (dneg * sigma_tr + 1.0) * exp(-sigma_tr * dneg) / (dneg * dneg * dneg);
+    vec3 rd = (mtrlAlphap.xyz / (4.0 * Pi)) * (posterm + negterm);
+    return max(vec3(0.0, 0.0, 0.0), rd);
+}
+
+vec3 diffRefTable(vec3 p0, vec3 p1) {
+    float u = sqrt(min(distance(p0, p1) / uProfileMaxDist, 1.0));
+    return texture(uProfileMap, u).rgb;
+}
+
+vec3 diffRefFast(vec3 p0, vec3 p1) {
+    vec3 sigma_tr = mtrlSigmaTr.xyz * uMtrlScale;
+    vec3 zpos     = mtrlZpos.xyz / uMtrlScale;
+    vec3 zneg     = mtrlZneg.xyz / uMtrlScale;
+
+    vec3 v = p0 - p1;
+    float d2 = dot(v, v);
+
+    vec3 dpos2 = d2 + zpos * zpos;
+    vec3 dneg2 = d2 + zneg * zneg;
+    vec3 invpos = inversesqrt(dpos2);
+    vec3 invneg = inversesqrt(dneg2);
+    vec3 dpos = dpos2 * invpos;
+    vec3 dneg = dneg2 * invneg;
+    vec3 posterm = zpos * (dpos * sigma_tr + 1.0) * exp(-sigma_tr * dpos) * (invpos * invpos * invpos);
+    vec3 negterm = zneg * (dneg * sigma_tr + 1.0) * exp(-sigma_tr * dneg) * (invneg * invneg * invneg);
+    return max(vec3(0.0, 0.0, 0.0), (mtrlAlphap.xyz / (4.0 * Pi)) * (posterm + negterm));
+}
@@ -0,0 +1,103 @@
+#version 430
+
+layout(local_size_x = 256) in;
+
+// Ranges of the samples drawn separately, which must match
+// "SampleCuller::numSegments".
+const int SEGMENTS = 4;
+
+// Commands of "glDrawArraysIndirect()" for every segment, i.e., the points
+// and the instanced quads of its survivors.
+const int COMMAND_SIZE = 4;
+const int POINTS_COMMAND = 0;
+const int QUADS_COMMAND = COMMAND_SIZE;
+
+// Samples packed as "PackedSample".
+layout(std430, binding = 0) readonly buffer SampleBuffer { uvec4 samples[]; };
+layout(std430, binding = 1) writeonly buffer CulledSamples { uvec4 culledSamples[]; };
+layout(std430, binding = 2) buffer DrawCommands { uint commands[]; };
+
+// Maximum depth of the receivers, whose level 0 is at the screen resolution.
+uniform sampler2D uDepthPyramid;
+uniform int uMaxLevel;
+
+uniform mat4  uMVPMat;
+uniform ivec2 uScreenSize;
+uniform int   uNumSamples;
+uniform int   uSegmentOffsets[SEGMENTS + 1];
+
+// Whether the support of the sample may contain a visible receiver. The box
+// around the support is tested against the frustum, and against the farthest
+// receiver over its screen bounds. Boxes crossing the camera plane are kept.
+bool isVisible(vec3 center, float s) {
+    vec2 lo = vec2(1.0e30);
+    vec2 hi = vec2(-1.0e30);
+    float nearDepth = 1.0e30;
+    int numBehind = 0;
+    for (int k = 0; k < 8; k++) {
+        vec3 corner = center + s * vec3((k & 1) != 0 ? 1.0 : -1.0,
+                                        (k & 2) != 0 ? 1.0 : -1.0,
+                                        (k & 4) != 0 ? 1.0 : -1.0);
+        vec4 clip = uMVPMat * vec4(corner, 1.0);
+        if (clip.w <= 0.0) {
+            numBehind++;
+            continue;
+        }
+        vec3 ndc = clip.xyz / clip.w;
+        lo = min(lo, ndc.xy);
+        hi = max(hi, ndc.xy);
+        nearDepth = min(nearDepth, ndc.z);
+    }
+
+    if (numBehind == 8) {
+        return false;
+    }
+    if (numBehind > 0) {
+        return true;
+    }
+    if (any(lessThan(hi, vec2(-1.0))) || any(greaterThan(lo, vec2(1.0))) || nearDepth > 1.0) {
+        return false;
+    }
+
+    // The level is chosen so that the bounds span at most 2x2 texels.
+    ivec2 pixelLo = clamp(ivec2((lo * 0.5 + 0.5) * vec2(uScreenSize)), ivec2(0), uScreenSize - 1);
+    ivec2 pixelHi = clamp(ivec2((hi * 0.5 + 0.5) * vec2(uScreenSize)), ivec2(0), uScreenSize - 1);
+    int extent = max(pixelHi.x - pixelLo.x, pixelHi.y - pixelLo.y) + 1;
+    int level = min(int(ceil(log2(float(extent)))), uMaxLevel);
+
+    ivec2 levelSize = max(uScreenSize >> level, ivec2(1));
+    ivec2 texelLo = min(pixelLo >> level, levelSize - 1);
+    ivec2 texelHi = min(pixelHi >> level, levelSize - 1);
+    float farDepth = -1.0e30;
+    for (int y = texelLo.y; y <= texelHi.y; y++) {
+        for (int x = texelLo.x; x <= texelHi.x; x++) {
+            farDepth = max(farDepth, texelFetch(uDepthPyramid, ivec2(x, y), level).r);
+        }
+    }
+    return nearDepth <= farDepth;
+}
+
+void main(void) {
+    int i = int(gl_GlobalInvocationID.x);
+    if (i >= uNumSamples) {
+        return;
+    }
+
+    // Padding of the sample buffer has zero radius.
+    uvec4 smp = samples[i];
+    float radius = sampleRadius(smp);
+    if (radius <= 0.0 || !isVisible(samplePosition(smp), supportRadius(radius))) {
+        return;
+    }
+
+    // Survivors are compacted within the range of their segment, which is
+    // counted by both of its commands.
+    int segment = 0;
+    while (segment < SEGMENTS - 1 && i >= uSegmentOffsets[segment + 1]) {
+        segment++;
+    }
+    int command = segment * 2 * COMMAND_SIZE;
+    uint slot = atomicAdd(commands[command + POINTS_COMMAND], 1u);
+    atomicAdd(commands[command + QUADS_COMMAND + 1], 1u);
+    culledSamples[uint(uSegmentOffsets[segment]) + slot] = smp;
+}
@@ -0,0 +1,44 @@
+#version 430
+
+layout(local_size_x = 16, local_size_y = 16) in;
+
+// Level 0 is taken from the depth buffer of the G-buffers in the normalized
+// device coordinates, and every coarser level takes the maximum of the finer
+// texels it covers.
+layout(r32f, binding = 0) uniform readonly image2D uSrcLevel;
+layout(r32f, binding = 1) uniform writeonly image2D uDstLevel;
+
+uniform sampler2D uDepthMap;
+uniform int uLevel;
+
+// Pixels not covered by the mesh have no receivers.
+const float EMPTY_DEPTH = -1.0e30;
+
+void main(void) {
+    ivec2 dstSize = imageSize(uDstLevel);
+    ivec2 pixel = ivec2(gl_GlobalInvocationID.xy);
+    if (any(greaterThanEqual(pixel, dstSize))) {
+        return;
+    }
+
+    float depth = EMPTY_DEPTH;
+    if (uLevel == 0) {
+        float texel = texelFetch(uDepthMap, pixel, 0).r;
+        if (texel < 1.0) {
+            depth = texel * 2.0 - 1.0;
+        }
+    } else {
+        // The last row and column also take the remainder of odd sizes.
+        ivec2 srcSize = imageSize(uSrcLevel);
+        ivec2 lo = pixel * 2;
+        ivec2 hi = min(pixel * 2 + 1, srcSize - 1);
+        if (pixel.x == dstSize.x - 1) hi.x = srcSize.x - 1;
+        if (pixel.y == dstSize.y - 1) hi.y = srcSize.y - 1;
+        for (int y = lo.y; y <= hi.y; y++) {
+            for (int x = lo.x; x <= hi.x; x++) {
+                depth = max(depth, imageLoad(uSrcLevel, ivec2(x, y)).r);
+            }
+        }
+    }
+    imageStore(uDstLevel, pixel, vec4(depth, 0.0, 0.0, 0.0));
+}
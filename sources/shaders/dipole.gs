@@ -14,6 +14,7 @@ out vec4 fPosScreen;
 out vec3 fNrmWorld;
 out vec2 fTexCoord;
 out float fRadius;
+out float fSupport;
 
 uniform mat4 uMVPMat;
 uniform mat4 uMVMat;
@@ -26,6 +27,11 @@ void processVertex(vec3 pos) {
 }
 
 void main(void) {
+    // Padding of the sample buffer has zero radius.
+    if (gRadius[0] <= 0.0) {
+        return;
+    }
+
     vec3 uAxis, vAxis, wAxis;
     wAxis = normalize(gNormal[0]);
     if (abs(wAxis.y) < 0.1) {
@@ -36,15 +42,17 @@ void main(void) {
     uAxis = cross(vAxis, wAxis);
     vAxis = cross(uAxis, wAxis);
 
-    float r = gRadius[0] * 0.1;
-    vec3 p00 = gPosition[0] - uAxis * r - vAxis * r;
-    vec3 p01 = gPosition[0] - uAxis * r + vAxis * r;
-    vec3 p10 = gPosition[0] + uAxis * r - vAxis * r;
-    vec3 p11 = gPosition[0] + uAxis * r + vAxis * r;
+    // The quad covers the distance where the dipole becomes negligible.
+    float s = supportRadius(gRadius[0]);
+    vec3 p00 = gPosition[0] - uAxis * s - vAxis * s;
+    vec3 p01 = gPosition[0] - uAxis * s + vAxis * s;
+    vec3 p10 = gPosition[0] + uAxis * s - vAxis * s;
+    vec3 p11 = gPosition[0] + uAxis * s + vAxis * s;
 
     fTexCoord  = gTexCoord[0];
     fNrmWorld = gNormal[0];
     fRadius = gRadius[0] * 0.1;
+    fSupport = s;
 
     processVertex(p00);
     processVertex(p01);
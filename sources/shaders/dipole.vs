@@ -1,7 +1,7 @@
 #version 330
 
 layout(location = 0) in vec3 vPosition;
-layout(location = 1) in vec3 vNormal;
+layout(location = 1) in vec2 vNormal;
 layout(location = 2) in vec2 vTexCoord;
 layout(location = 3) in float vRadius;
 
@@ -11,8 +11,8 @@ out vec2  gTexCoord;
 out float gRadius;
 
 void main(void) {
-    gPosition = vPosition;
-    gNormal   = vNormal;
+    gPosition = uSampleOrigin + vPosition * uSampleExtent;
+    gNormal   = decodeOctahedral(vNormal);
     gTexCoord = vTexCoord;
     gRadius   = vRadius;
 }
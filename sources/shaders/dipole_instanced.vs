@@ -0,0 +1,46 @@
+#version 330
+
+layout(location = 0) in vec3 vPosition;
+layout(location = 1) in vec2 vNormal;
+layout(location = 2) in vec2 vTexCoord;
+layout(location = 3) in float vRadius;
+layout(location = 4) in vec2 vCorner;
+
+out vec3 fPosWorld;
+out vec4 fPosScreen;
+out vec3 fNrmWorld;
+out vec2 fTexCoord;
+out float fRadius;
+out float fSupport;
+
+uniform mat4 uMVPMat;
+uniform mat4 uMVMat;
+
+void main(void) {
+    vec3 center = uSampleOrigin + vPosition * uSampleExtent;
+    vec3 normal = decodeOctahedral(vNormal);
+
+    // Same tangent frame as "dipole.gs".
+    vec3 uAxis, vAxis, wAxis;
+    wAxis = normal;
+    if (abs(wAxis.y) < 0.1) {
+        vAxis = vec3(0.0, 1.0, 0.0);
+    } else {
+        vAxis = vec3(1.0, 0.0, 0.0);
+    }
+    uAxis = cross(vAxis, wAxis);
+    vAxis = cross(uAxis, wAxis);
+
+    // The quad covers the distance where the dipole becomes negligible. The
+    // padding of the sample buffer has zero radius and collapses to a point.
+    float s = vRadius > 0.0 ? supportRadius(vRadius) : 0.0;
+    vec3 pos = center + uAxis * (vCorner.x * s) + vAxis * (vCorner.y * s);
+
+    gl_Position = uMVPMat * vec4(pos, 1.0);
+    fPosScreen = gl_Position;
+    fPosWorld  = center;
+    fNrmWorld  = normal;
+    fTexCoord  = vTexCoord;
+    fRadius    = vRadius * 0.1;
+    fSupport   = s;
+}
@@ -0,0 +1,10 @@
+#version 330
+
+out vec2 fTexCoord;
+
+// Covers the screen with one triangle generated from the vertex ID.
+void main(void) {
+    vec2 pos = vec2((gl_VertexID & 1) * 4.0 - 1.0, (gl_VertexID >> 1) * 4.0 - 1.0);
+    gl_Position = vec4(pos, 0.0, 1.0);
+    fTexCoord = pos * 0.5 + 0.5;
+}
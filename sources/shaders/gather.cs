@@ -0,0 +1,92 @@
+#version 430
+
+layout(local_size_x = 16, local_size_y = 16) in;
+
+const uint GROUP_SIZE = 256u;
+
+// Samples packed as "PackedSample".
+layout(std430, binding = 0) readonly buffer SampleBuffer { uvec4 samples[]; };
+layout(std430, binding = 3) readonly buffer TileSamples { uint tileSamples[]; };
+layout(std430, binding = 4) readonly buffer TileOffsets { uint tileOffsets[]; };
+
+layout(rgba32f, binding = 0) uniform writeonly image2D uTransImage;
+
+// Receivers are reconstructed from the depth of the G-buffers, whose
+// texture may be larger than their size.
+uniform sampler2D uDepthMap;
+uniform ivec2 uDepthSize;
+uniform mat4 uInvMVPMat;
+
+uniform ivec2 uScreenSize;
+uniform ivec2 uTileCount;
+uniform vec3  uLightPos;
+
+// Size of the list of the sample indices, which may have overflowed.
+uniform int   uCapacity;
+
+// Samples of the tile, which are loaded in chunks of the work group size.
+shared vec4 sharedPosSupport[GROUP_SIZE];
+shared vec4 sharedNrmArea[GROUP_SIZE];
+
+void main(void) {
+    ivec2 pixel = ivec2(gl_GlobalInvocationID.xy);
+    bool isInside = all(lessThan(pixel, uScreenSize));
+
+    // Background pixels keep the cleared depth. The receiver is the nearest
+    // texel of the G-buffers, which may have a larger size.
+    vec2 depthSize = vec2(uDepthSize);
+    vec2 texCoord = (vec2(pixel) + 0.5) / vec2(uScreenSize);
+    ivec2 texel = min(ivec2(texCoord * depthSize), ivec2(depthSize) - 1);
+    float depth = texelFetch(uDepthMap, texel, 0).x;
+    vec4 p = uInvMVPMat * vec4((vec2(texel) + 0.5) / depthSize * 2.0 - 1.0, depth * 2.0 - 1.0, 1.0);
+    vec3 pos = p.xyz / p.w;
+    bool isCovered = isInside && depth < 1.0;
+
+    uint tile  = gl_WorkGroupID.y * uint(uTileCount.x) + gl_WorkGroupID.x;
+    uint begin = min(tileOffsets[tile], uint(uCapacity));
+    uint end   = min(tileOffsets[tile + 1u], uint(uCapacity));
+
+    vec3 sum = vec3(0.0, 0.0, 0.0);
+    for (uint base = begin; base < end; base += GROUP_SIZE) {
+        uint k = base + gl_LocalInvocationIndex;
+        if (k < end) {
+            uvec4 smp = samples[tileSamples[k]];
+            vec3 center = samplePosition(smp);
+            vec3 normal = sampleNormal(smp);
+            float radius = sampleRadius(smp);
+
+            vec3 L = normalize(uLightPos - center);
+            float E = max(0.0, dot(normalize(normal), L));
+            float r = radius * 0.1;
+            sharedPosSupport[gl_LocalInvocationIndex] = vec4(center, supportRadius(radius));
+            sharedNrmArea[gl_LocalInvocationIndex] = vec4(normal, E * r * r * Pi * 0.001);
+        }
+        memoryBarrierShared();
+        barrier();
+
+        if (isCovered) {
+            uint n = min(GROUP_SIZE, end - base);
+            for (uint j = 0u; j < n; j++) {
+                vec4 ps = sharedPosSupport[j];
+                if (distance(pos, ps.xyz) > ps.w) {
+                    continue;
+                }
+
+                vec3 rd;
+                if (uDipoleMode == 1) {
+                    rd = diffRefTable(pos, ps.xyz);
+                } else if (uDipoleMode == 2) {
+                    rd = diffRefFast(pos, ps.xyz);
+                } else {
+                    rd = diffRef(pos, ps.xyz);
+                }
+                sum += rd * sharedNrmArea[j].w;
+            }
+        }
+        barrier();
+    }
+
+    if (isInside) {
+        imageStore(uTransImage, pixel, vec4(sum, 1.0));
+    }
+}
@@ -0,0 +1,82 @@
+#version 430
+
+layout(local_size_x = 256) in;
+
+const int TILE_SIZE = 16;
+
+// Samples packed as "PackedSample".
+layout(std430, binding = 0) readonly buffer SampleBuffer { uvec4 samples[]; };
+layout(std430, binding = 1) buffer TileCounts { uint tileCounts[]; };
+layout(std430, binding = 2) buffer TileCursors { uint tileCursors[]; };
+layout(std430, binding = 3) writeonly buffer TileSamples { uint tileSamples[]; };
+
+uniform mat4  uMVPMat;
+uniform ivec2 uScreenSize;
+uniform ivec2 uTileCount;
+uniform int   uNumSamples;
+
+// Size of the list of the sample indices, beyond which they are dropped.
+uniform int   uCapacity;
+
+// 0: count the samples of every tile, 1: write the sample indices.
+uniform int uPass;
+
+void main(void) {
+    int i = int(gl_GlobalInvocationID.x);
+    if (i >= uNumSamples) {
+        return;
+    }
+
+    // Padding of the sample buffer has zero radius.
+    float radius = sampleRadius(samples[i]);
+    if (radius <= 0.0) {
+        return;
+    }
+
+    vec3 center = samplePosition(samples[i]);
+    float s = supportRadius(radius);
+
+    // Screen bounds of the box around the support. The support crossing the
+    // camera plane covers the whole screen.
+    vec2 lo = vec2(1.0e30);
+    vec2 hi = vec2(-1.0e30);
+    bool isCrossing = false;
+    for (int k = 0; k < 8; k++) {
+        vec3 corner = center + s * vec3((k & 1) != 0 ? 1.0 : -1.0,
+                                        (k & 2) != 0 ? 1.0 : -1.0,
+                                        (k & 4) != 0 ? 1.0 : -1.0);
+        vec4 clip = uMVPMat * vec4(corner, 1.0);
+        if (clip.w <= 0.0) {
+            isCrossing = true;
+            break;
+        }
+        lo = min(lo, clip.xy / clip.w);
+        hi = max(hi, clip.xy / clip.w);
+    }
+
+    ivec2 tileLo = ivec2(0, 0);
+    ivec2 tileHi = uTileCount - 1;
+    if (!isCrossing) {
+        vec2 pixelLo = (lo * 0.5 + 0.5) * vec2(uScreenSize);
+        vec2 pixelHi = (hi * 0.5 + 0.5) * vec2(uScreenSize);
+        if (any(lessThan(pixelHi, vec2(0.0))) || any(greaterThanEqual(pixelLo, vec2(uScreenSize)))) {
+            return;
+        }
+        tileLo = ivec2(max(pixelLo, vec2(0.0))) / TILE_SIZE;
+        tileHi = min(ivec2(pixelHi) / TILE_SIZE, uTileCount - 1);
+    }
+
+    for (int y = tileLo.y; y <= tileHi.y; y++) {
+        for (int x = tileLo.x; x <= tileHi.x; x++) {
+            int tile = y * uTileCount.x + x;
+            if (uPass == 0) {
+                atomicAdd(tileCounts[tile], 1u);
+            } else {
+                uint slot = atomicAdd(tileCursors[tile], 1u);
+                if (slot < uint(uCapacity)) {
+                    tileSamples[slot] = uint(i);
+                }
+            }
+        }
+    }
+}
@@ -0,0 +1,52 @@
+#version 430
+
+layout(local_size_x = 1024) in;
+
+const uint GROUP_SIZE = 1024u;
+
+layout(std430, binding = 1) buffer TileCounts { uint tileCounts[]; };
+layout(std430, binding = 2) writeonly buffer TileCursors { uint tileCursors[]; };
+layout(std430, binding = 4) writeonly buffer TileOffsets { uint tileOffsets[]; };
+
+uniform int uNumTiles;
+
+shared uint partialSums[GROUP_SIZE];
+
+// Exclusive prefix sum of the tile counts by a single work group. Every
+// thread sums a contiguous chunk of the tiles, and the sums of the chunks
+// are scanned by the first thread. The total is put after the last tile,
+// and the counts are cleared for the next frame.
+void main(void) {
+    uint numTiles = uint(uNumTiles);
+    uint chunk = (numTiles + GROUP_SIZE - 1u) / GROUP_SIZE;
+    uint begin = min(gl_LocalInvocationIndex * chunk, numTiles);
+    uint end   = min(begin + chunk, numTiles);
+
+    uint sum = 0u;
+    for (uint k = begin; k < end; k++) {
+        sum += tileCounts[k];
+    }
+    partialSums[gl_LocalInvocationIndex] = sum;
+    memoryBarrierShared();
+    barrier();
+
+    if (gl_LocalInvocationIndex == 0u) {
+        uint total = 0u;
+        for (uint j = 0u; j < GROUP_SIZE; j++) {
+            uint count = partialSums[j];
+            partialSums[j] = total;
+            total += count;
+        }
+        tileOffsets[numTiles] = total;
+    }
+    memoryBarrierShared();
+    barrier();
+
+    uint offset = partialSums[gl_LocalInvocationIndex];
+    for (uint k = begin; k < end; k++) {
+        tileOffsets[k] = offset;
+        tileCursors[k] = offset;
+        offset += tileCounts[k];
+        tileCounts[k] = 0u;
+    }
+}
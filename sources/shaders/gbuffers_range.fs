@@ -0,0 +1,20 @@
+#version 330
+#extension GL_ARB_shader_image_load_store : require
+
+in vec3 fNormal;
+in vec2 fTexCoord;
+
+layout(location = 0) out vec2 outNormal;
+layout(location = 1) out vec2 outTexCoord;
+
+// Maximum depth is accumulated with atomics, because the fragments behind
+// the nearest surface are discarded by the depth test. Depth in [0, 1] has
+// the same order of the bit patterns as that of the values.
+layout(r32ui) coherent uniform uimage2D uMaxDepthImage;
+
+void main(void) {
+    imageAtomicMax(uMaxDepthImage, ivec2(gl_FragCoord.xy), floatBitsToUint(gl_FragCoord.z));
+
+    outNormal = encodeOctahedral(normalize(fNormal)) * 0.5 + 0.5;
+    outTexCoord = fTexCoord;
+}
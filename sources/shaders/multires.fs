@@ -0,0 +1,35 @@
+#version 330
+
+in vec2 fTexCoord;
+
+out vec4 outColor;
+
+// Translucency of the coarser sample levels, each rendered at half the
+// resolution of the previous one, and their sizes.
+uniform sampler2D uLevelMap1;
+uniform sampler2D uLevelMap2;
+uniform sampler2D uLevelMap3;
+uniform ivec2 uLevelSize1;
+uniform ivec2 uLevelSize2;
+uniform ivec2 uLevelSize3;
+
+// G-buffers, which guide the upsampling, and their size.
+uniform sampler2D uDepthMap;
+uniform sampler2D uNormalMap;
+uniform ivec2 uScreenSize;
+uniform vec2 uDepthRange;
+
+void main(void) {
+    ivec2 pixel = min(ivec2(fTexCoord * vec2(uScreenSize)), uScreenSize - 1);
+    float depth = linearDepth(texelFetch(uDepthMap, pixel, 0).x, uDepthRange);
+    vec3 normal = decodeOctahedral(texelFetch(uNormalMap, pixel, 0).xy * 2.0 - 1.0);
+
+    // Every level is upsampled from the texels at its own resolution.
+    vec3 rgb = upsampleBilateral(uLevelMap1, uLevelSize1, uDepthMap, uNormalMap, uScreenSize, uDepthRange,
+                                 fTexCoord, depth, normal) +
+               upsampleBilateral(uLevelMap2, uLevelSize2, uDepthMap, uNormalMap, uScreenSize, uDepthRange,
+                                 fTexCoord, depth, normal) +
+               upsampleBilateral(uLevelMap3, uLevelSize3, uDepthMap, uNormalMap, uScreenSize, uDepthRange,
+                                 fTexCoord, depth, normal);
+    outColor = vec4(rgb, 1.0);
+}
@@ -1,15 +1,30 @@
 #version 330
 
-in vec4 fPosScreen;
-in vec3 fPosCamera;
-in vec3 fNrmCamera;
 in vec2 fTexCoord;
-in vec3 fLightPos;
 
 out vec4 outColor;
 
 uniform sampler2D uTransMap;
 
+// Full-resolution G-buffers, which are shaded per pixel and guide the
+// upsampling of the translucency rendered at 1 / uTransScale of the
+// resolution. Pixels not covered by the mesh keep the cleared depth.
+uniform sampler2D uDepthMap;
+uniform sampler2D uNormalMap;
+uniform int  uTransScale;
+uniform vec2 uDepthRange;
+
+// Sizes of the G-buffers and the translucency, whose textures may be larger.
+uniform ivec2 uScreenSize;
+uniform ivec2 uTransSize;
+
+// Positions are reconstructed in the model space from the depth, and the
+// light is given in the camera space.
+uniform mat4 uInvMVPMat;
+uniform mat4 uMVMat;
+uniform mat3 uNormalMat;
+uniform vec3 uLightPos;
+
 uniform float refFactor;
 uniform float transFactor;
 
@@ -33,14 +48,34 @@ vec2 reflectRatio(vec3 V, vec3 N) {
     return vec2(Re, Tr);
 }
 
+vec3 reconstructPosition(ivec2 pixel, float depth) {
+    vec2 ndc = (vec2(pixel) + 0.5) / vec2(uScreenSize) * 2.0 - 1.0;
+    vec4 p = uInvMVPMat * vec4(ndc, depth * 2.0 - 1.0, 1.0);
+    return p.xyz / p.w;
+}
+
+// Translucency upsampled to the pixel, which is guided by the G-buffers.
+vec3 upsampleTrans(ivec2 pixel) {
+    float depth = linearDepth(texelFetch(uDepthMap, pixel, 0).x, uDepthRange);
+    vec3 normal = decodeOctahedral(texelFetch(uNormalMap, pixel, 0).xy * 2.0 - 1.0);
+    return upsampleBilateral(uTransMap, uTransSize, uDepthMap, uNormalMap, uScreenSize, uDepthRange,
+                             fTexCoord, depth, normal);
+}
+
 void main(void) {
-    vec3 V = normalize(-fPosCamera);
-    vec3 N = normalize(fNrmCamera);
-    vec3 L = normalize(fLightPos - fPosCamera);
+    ivec2 pixel = ivec2(gl_FragCoord.xy);
+    float depth = texelFetch(uDepthMap, pixel, 0).x;
+    if (depth == 1.0) {
+        discard;
+    }
+
+    vec3 posCamera = (uMVMat * vec4(reconstructPosition(pixel, depth), 1.0)).xyz;
+    vec3 V = normalize(-posCamera);
+    vec3 N = normalize(uNormalMat * decodeOctahedral(texelFetch(uNormalMap, pixel, 0).xy * 2.0 - 1.0));
+    vec3 L = normalize(uLightPos - posCamera);
     vec3 H = normalize(V + L);
 
-    vec2 texCoord = fPosScreen.xy / fPosScreen.w * 0.5 + 0.5;
-    vec3 trans = texture(uTransMap, texCoord).xyz;
+    vec3 trans = uTransScale > 1 ? upsampleTrans(pixel) : texelFetch(uTransMap, pixel, 0).xyz;
 
     float NdotL = max(0.0, dot(N, L));
     float NdotH = max(0.0, dot(N, H));
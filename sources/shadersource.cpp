@@ -0,0 +1,60 @@
+#include "shadersource.h"
+
+#include <iostream>
+
+#include <QtCore/qfile.h>
+#include <QtCore/qfileinfo.h>
+
+static const char* COMMON_SHADER = "common.glsl";
+
+namespace {
+
+QByteArray readShaderFile(const QString& filename) {
+    QFile file(filename);
+    if (!file.open(QIODevice::ReadOnly | QIODevice::Text)) {
+        std::cerr << "Failed to open shader file: " << filename.toStdString() << std::endl;
+        return QByteArray();
+    }
+    return file.readAll();
+}
+
+}  // anonymous namespace
+
+bool addShaderFromFile(QOpenGLShaderProgram& program, QOpenGLShader::ShaderType type, const QString& filename) {
+    const QByteArray source = readShaderFile(filename);
+    const QByteArray common = readShaderFile(QFileInfo(filename).path() + "/" + COMMON_SHADER);
+    if (source.isEmpty() || common.isEmpty()) {
+        return false;
+    }
+
+    // Directives at the top must precede any other code.
+    int pos = 0;
+    int numLines = 0;
+    while (pos < source.size()) {
+        const int end = source.indexOf('\n', pos);
+        const QByteArray line = source.mid(pos, end < 0 ? -1 : end - pos).trimmed();
+        if (!line.startsWith("#version") && !line.startsWith("#extension")) {
+            break;
+        }
+        pos = end < 0 ? source.size() : end + 1;
+        numLines++;
+    }
+
+    QByteArray code = source.left(pos);
+    code += common;
+    code += "\n#line " + QByteArray::number(numLines + 1) + "\n";
+    code += source.mid(pos);
+    return program.addShaderFromSourceCode(type, code);
+}
+
+std::unique_ptr<QOpenGLShaderProgram> linkComputeShader(const QString& filename) {
+    auto program = std::make_unique<QOpenGLShaderProgram>();
+    if (!addShaderFromFile(*program, QOpenGLShader::Compute, filename)) {
+        return nullptr;
+    }
+    program->link();
+    if (!program->isLinked()) {
+        return nullptr;
+    }
+    return program;
+}
@@ -0,0 +1,22 @@
+#ifdef _MSC_VER
+#pragma once
+#endif
+
+#ifndef _SHADER_SOURCE_H_
+#define _SHADER_SOURCE_H_
+
+#include <memory>
+
+#include <QtGui/qopenglshaderprogram.h>
+
+// Adds the shader of the file to the program. The functions shared by the
+// shaders, such as those decoding "PackedSample", are kept in "common.glsl"
+// of the same directory, which is inserted after the "#version" and the
+// "#extension" lines of the file. Errors are reported with the line numbers
+// of the file.
+bool addShaderFromFile(QOpenGLShaderProgram& program, QOpenGLShader::ShaderType type, const QString& filename);
+
+// Compute program of the file, or nullptr if it fails to compile or link.
+std::unique_ptr<QOpenGLShaderProgram> linkComputeShader(const QString& filename);
+
+#endif  // _SHADER_SOURCE_H_
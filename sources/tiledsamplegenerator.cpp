@@ -0,0 +1,36 @@
+#include "tiledsamplegenerator.h"
+
+#include <algorithm>
+
+#include "samplebuilder.h"
+
+TiledSampleGenerator::TiledSampleGenerator(int tileSize)
+    : tileSize_{ tileSize } {
+    static const int maxPyrLevels = 3;
+    pyramid_.resize(tileSize, tileSize, maxPyrLevels);
+}
+
+void TiledSampleGenerator::begin() {
+    numTiles_ = 0;
+    samples_.clear();
+    peakWorkingBytes_ = 0;
+}
+
+void TiledSampleGenerator::addTile(const ReadbackView* views, const QMatrix4x4& mvpMat,
+                                   const QVector3D& lightPos, const HierarchyParams& params) {
+    copyGBuffers(pyramid_, views, mvpMat, 0, 0, tileSize_, tileSize_);
+    pyramid_.build();
+    // The thresholds are used for every tile, since the budget would need
+    // the whole buffer at once.
+    HierarchyParams tileParams = params;
+    tileParams.budget = 0;
+    hierarchy_.build(pyramid_, lightPos, tileParams);
+
+    const std::vector<Sample>& samples = hierarchy_.samples();
+    samples_.insert(samples_.end(), samples.begin(), samples.end());
+    numTiles_++;
+
+    // The output samples are not a part of the working set.
+    const size_t workingBytes = pyramid_.memoryBytes() + hierarchy_.memoryBytes();
+    peakWorkingBytes_ = std::max(peakWorkingBytes_, workingBytes);
+}
@@ -0,0 +1,42 @@
+#ifdef _MSC_VER
+#pragma once
+#endif
+
+#ifndef _TILED_SAMPLE_GENERATOR_H_
+#define _TILED_SAMPLE_GENERATOR_H_
+
+#include <vector>
+
+#include "gbufferreadback.h"
+#include "imagepyramid.h"
+#include "samplehierarchy.h"
+
+// Streams the samples of a light buffer which is too large to be held at
+// once. The light buffer is rendered and read back tile by tile, and every
+// tile is passed to "addTile()", which selects its samples with a pyramid of
+// the tile size. Since the tile size is a multiple of the footprint of the
+// coarsest texel, the samples are the same as those of the whole buffer,
+// while the working set does not depend on the buffer size.
+class TiledSampleGenerator {
+public:
+    explicit TiledSampleGenerator(int tileSize);
+
+    void begin();
+    void addTile(const ReadbackView* views, const QMatrix4x4& mvpMat,
+                 const QVector3D& lightPos, const HierarchyParams& params);
+
+    inline int tileSize() const { return tileSize_; }
+    inline int numTiles() const { return numTiles_; }
+    inline const std::vector<Sample>& samples() const { return samples_; }
+    inline size_t peakWorkingBytes() const { return peakWorkingBytes_; }
+
+private:
+    int tileSize_;
+    int numTiles_ = 0;
+    GBufferPyramid pyramid_;
+    SampleHierarchy hierarchy_;
+    std::vector<Sample> samples_;
+    size_t peakWorkingBytes_ = 0;
+};
+
+#endif  // _TILED_SAMPLE_GENERATOR_H_
@@ -0,0 +1,57 @@
+#ifdef _MSC_VER
+#pragma once
+#endif
+
+#ifndef _TRIPLE_BUFFER_H_
+#define _TRIPLE_BUFFER_H_
+
+#include <atomic>
+
+// Lock-free triple buffer for one producer and one consumer thread.
+// The producer fills "back()" and calls "publish()", and the consumer
+// calls "update()" to take the newest published value into "front()".
+// Neither side ever waits for the other; values published in between
+// two updates are skipped.
+template <class T>
+class TripleBuffer {
+public:
+    TripleBuffer() = default;
+
+    TripleBuffer(const TripleBuffer&) = delete;
+    TripleBuffer& operator=(const TripleBuffer&) = delete;
+
+    // Producer side.
+    inline T& back() { return buffers_[backIndex_]; }
+
+    void publish() {
+        const int prev = middle_.exchange(backIndex_ | FRESH_BIT, std::memory_order_acq_rel);
+        backIndex_ = prev & INDEX_MASK;
+    }
+
+    // Consumer side.
+    bool update() {
+        if ((middle_.load(std::memory_order_relaxed) & FRESH_BIT) == 0) {
+            return false;
+        }
+
+        const int prev = middle_.exchange(frontIndex_, std::memory_order_acq_rel);
+        frontIndex_ = prev & INDEX_MASK;
+        return true;
+    }
+
+    inline const T& front() const { return buffers_[frontIndex_]; }
+
+    // Whether a value has been published since the last update.
+    inline bool isFresh() const { return (middle_.load(std::memory_order_relaxed) & FRESH_BIT) != 0; }
+
+private:
+    static constexpr int INDEX_MASK = 0x03;
+    static constexpr int FRESH_BIT  = 0x04;
+
+    T buffers_[3];
+    int backIndex_  = 0;
+    int frontIndex_ = 2;
+    std::atomic<int> middle_{ 1 };
+};
+
+#endif  // _TRIPLE_BUFFER_H_